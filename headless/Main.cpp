@@ -0,0 +1,261 @@
+#include "Objects.hpp"
+#include "Scenario.hpp"
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Runs a simulation flat out without a window, for long science runs, and reports throughput
+
+namespace
+{
+const double YEAR = 365.25 * 24 * 60 * 60;
+
+struct Options
+{
+	size_t particles = 1000;
+	double years = 100.0;
+	// Step length in seconds, 0 for adaptive steps
+	double dt = 7 * 24 * 60 * 60;
+	ForceSolverType solver = ForceSolverType::Automatic;
+	IntegratorType integrator = IntegratorType::Leapfrog;
+	unsigned threads = 0;
+	unsigned seed = 1;
+	// Years between snapshots, 0 for none
+	double snapshotEvery = 0.0;
+	std::string snapshotPrefix = "snapshot_";
+};
+
+void printUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]\n"
+			  << "  --particles N          asteroids scattered along Jupiter's orbit (1000)\n"
+			  << "  --years Y              simulated time in years (100)\n"
+			  << "  --dt SECONDS           step length, 0 for adaptive steps (one week)\n"
+			  << "  --solver NAME          auto, direct, barnes-hut or fmm (auto)\n"
+			  << "  --integrator NAME      euler, leapfrog, yoshida4, wisdom-holman, hybrid, block or respa (leapfrog)\n"
+			  << "  --threads N            worker threads, 0 for every hardware thread (0)\n"
+			  << "  --seed N               seed of the initial conditions (1)\n"
+			  << "  --snapshot-every Y     write the particles every Y years, 0 for never (0)\n"
+			  << "  --snapshot-prefix P    snapshots go to P000001.csv and so on (snapshot_)\n";
+}
+
+// A finite number without trailing characters; strtod also takes inf and nan
+bool parseNumber(const char* text, double& value)
+{
+	char* end = nullptr;
+	value = std::strtod(text, &end);
+	return end != text && *end == '\0' && std::isfinite(value);
+}
+
+// A whole number that fits value, without sign or trailing characters; value is unsigned,
+// for which from_chars takes no minus sign
+template <typename T>
+bool parseInteger(const char* text, T& value)
+{
+	const char* end = text + std::strlen(text);
+	const auto [last, error] = std::from_chars(text, end, value);
+	return error == std::errc() && last == end;
+}
+
+bool parseSolver(const std::string& name, ForceSolverType& solver)
+{
+	const std::map<std::string, ForceSolverType> solvers = {
+		{ "auto", ForceSolverType::Automatic },
+		{ "direct", ForceSolverType::DirectSum },
+		{ "barnes-hut", ForceSolverType::BarnesHut },
+		{ "fmm", ForceSolverType::FastMultipole }
+	};
+	auto found = solvers.find(name);
+	if (found == solvers.end()) return false;
+	solver = found->second;
+	return true;
+}
+
+bool parseIntegrator(const std::string& name, IntegratorType& integrator)
+{
+	const std::map<std::string, IntegratorType> integrators = {
+		{ "euler", IntegratorType::Euler },
+		{ "leapfrog", IntegratorType::Leapfrog },
+		{ "yoshida4", IntegratorType::Yoshida4 },
+		{ "wisdom-holman", IntegratorType::WisdomHolman },
+		{ "hybrid", IntegratorType::Hybrid },
+		{ "block", IntegratorType::BlockTimesteps },
+		{ "respa", IntegratorType::Respa }
+	};
+	auto found = integrators.find(name);
+	if (found == integrators.end()) return false;
+	integrator = found->second;
+	return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string option = argv[i];
+		if (option == "--help" || option == "-h") return false;
+		if (i + 1 == argc)
+		{
+			std::cerr << "Missing value for " << option << std::endl;
+			return false;
+		}
+
+		const char* value = argv[++i];
+		bool valid = true;
+		if (option == "--particles")
+		{
+			valid = parseInteger(value, options.particles);
+		}
+		else if (option == "--years")
+		{
+			valid = parseNumber(value, options.years) && options.years > 0 && std::isfinite(options.years * YEAR);
+		}
+		else if (option == "--dt")
+		{
+			valid = parseNumber(value, options.dt) && options.dt >= 0;
+		}
+		else if (option == "--solver")
+		{
+			valid = parseSolver(value, options.solver);
+		}
+		else if (option == "--integrator")
+		{
+			valid = parseIntegrator(value, options.integrator);
+		}
+		else if (option == "--threads")
+		{
+			valid = parseInteger(value, options.threads);
+		}
+		else if (option == "--seed")
+		{
+			valid = parseInteger(value, options.seed);
+		}
+		else if (option == "--snapshot-every")
+		{
+			valid = parseNumber(value, options.snapshotEvery) && options.snapshotEvery >= 0 && std::isfinite(options.snapshotEvery * YEAR);
+		}
+		else if (option == "--snapshot-prefix")
+		{
+			options.snapshotPrefix = value;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << option << std::endl;
+			return false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid value " << value << " for " << option << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+ParticleSystem initializeSimulation(const Options& options)
+{
+	ScenarioSettings scenario;
+	scenario.asteroids = options.particles;
+	scenario.layout = AsteroidLayout::Random;
+	scenario.seed = options.seed;
+	ParticleSystem particleSystem = makeJupiterScenario(scenario);
+	particleSystem.setForceSolverType(options.solver);
+	particleSystem.setIntegratorType(options.integrator);
+	particleSystem.setThreadCount(options.threads);
+	return particleSystem;
+}
+
+bool writeSnapshot(const ParticleSystem& particleSystem, const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file) return false;
+
+	file.precision(17);
+	file << "id,x,y,vx,vy,mass\n";
+	for (const ParticleStore* store : { &particleSystem.getStore(), &particleSystem.getPrescribedBodies() })
+	{
+		for (size_t i = 0; i < store->size(); i++)
+		{
+			file << store->id[i] << ',' << store->x[i] << ',' << store->y[i] << ',' << store->vx[i] << ','
+				 << store->vy[i] << ',' << store->mass[i] << '\n';
+		}
+	}
+	return bool(file);
+}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ParticleSystem particleSystem = initializeSimulation(options);
+
+	// Time the force solvers before the clock starts
+	if (options.solver == ForceSolverType::Automatic)
+	{
+		std::cout << "Using direct summation below " << particleSystem.getDirectSumCrossover() << " particles" << std::endl;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	const double duration = options.years * YEAR;
+	const double snapshotInterval = options.snapshotEvery * YEAR;
+	double nextSnapshot = snapshotInterval;
+	int snapshotCount = 0;
+	Clock::duration writing = Clock::duration::zero();
+	long long steps = 0;
+	double particleSteps = 0.0;
+
+	const Clock::time_point start = Clock::now();
+	while (particleSystem.getTime() < duration)
+	{
+		const double dt = options.dt > 0.0 ? options.dt : particleSystem.getAdaptiveTimestep();
+		particleSteps += particleSystem.getParticleCount();
+		particleSystem.step(std::min(dt, duration - particleSystem.getTime()));
+		steps++;
+
+		if (snapshotInterval > 0.0 && particleSystem.getTime() >= nextSnapshot)
+		{
+			const Clock::time_point writeStart = Clock::now();
+			char name[32];
+			std::snprintf(name, sizeof(name), "%06d.csv", ++snapshotCount);
+			if (!writeSnapshot(particleSystem, options.snapshotPrefix + name))
+			{
+				std::cerr << "Cannot write " << options.snapshotPrefix + name << std::endl;
+				return EXIT_FAILURE;
+			}
+			nextSnapshot += snapshotInterval;
+			writing += Clock::now() - writeStart;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(Clock::now() - start - writing).count();
+
+	size_t impacts = 0;
+	size_t ejections = 0;
+	for (const RemovedParticle& particle : particleSystem.getRemovedParticles())
+	{
+		impacts += particle.fate == ParticleFate::Impact;
+		ejections += particle.fate == ParticleFate::Ejection;
+	}
+
+	std::cout << "Simulated " << options.years << " years in " << steps << " steps and " << seconds << " s" << std::endl;
+	std::cout << "Steps per second: " << steps / seconds << std::endl;
+	std::cout << "Particle steps per second: " << particleSteps / seconds << std::endl;
+	std::cout << "Particles left: " << particleSystem.getParticleCount() << ", fell into the Sun: " << impacts
+			  << ", ejected: " << ejections << std::endl;
+	if (snapshotCount > 0)
+	{
+		std::cout << "Snapshots written: " << snapshotCount << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
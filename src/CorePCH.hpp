@@ -0,0 +1,56 @@
+#ifndef CORE_PRECOMPILED_HEADER_HPP
+#define CORE_PRECOMPILED_HEADER_HPP
+
+// The simulation core builds without SFML, the app adds it in PCH.hpp
+
+#ifndef _DEBUG
+	#ifndef NDEBUG
+		#define NDEBUG
+	#endif
+#endif // _DEBUG
+
+// Typical stdafx.h
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// Additional C/C++ libs
+// #include <atomic>
+// #include <cassert>
+#include <cmath>
+// #include <cstdlib>
+// #include <exception>
+// #include <functional>
+// #include <iomanip>
+// #include <mutex>
+// #include <random>
+// #include <sstream>
+// #include <thread>
+// #include <type_traits>
+
+// Windows
+#ifdef _WIN32
+	#ifndef UNICODE
+		#define UNICODE
+	#endif
+
+	#ifndef _UNICODE
+		#define _UNICODE
+	#endif
+
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#endif // _WIN32
+
+// Macros
+#define UNUSED(x) static_cast<void>(x)
+
+#endif // CORE_PRECOMPILED_HEADER_HPP
@@ -0,0 +1,57 @@
+#include "Ephemeris.hpp"
+#include "utils.hpp"
+#include <cmath>
+
+KeplerEphemeris::KeplerEphemeris(double mu, double semiMajorAxis, double eccentricity, double argumentOfPeriapsis,
+	double meanAnomaly, double scale, const Eigen::Vector2d& center) :
+	mu(mu),
+	semiMajorAxis(semiMajorAxis),
+	eccentricity(eccentricity),
+	argumentOfPeriapsis(argumentOfPeriapsis),
+	meanAnomaly(meanAnomaly),
+	scale(scale),
+	center(center),
+	meanMotion(std::sqrt(mu / (semiMajorAxis * semiMajorAxis * semiMajorAxis)))
+{
+}
+
+void KeplerEphemeris::evaluate(double time, Eigen::Vector2d& position, Eigen::Vector2d& velocity) const
+{
+	// Kepler's equation M = E - e sin E by Newton's method, from E = M, or pi for the very
+	// eccentric orbits where that start can overshoot
+	const double anomaly = std::remainder(meanAnomaly + meanMotion * time, 2 * M_PI);
+	double eccentricAnomaly = eccentricity < 0.8 ? anomaly : M_PI;
+	for (int i = 0; i < 50; i++)
+	{
+		const double delta = (eccentricAnomaly - eccentricity * std::sin(eccentricAnomaly) - anomaly)
+			/ (1.0 - eccentricity * std::cos(eccentricAnomaly));
+		eccentricAnomaly -= delta;
+		if (std::abs(delta) < 1e-15) break;
+	}
+
+	// In the orbital plane with periapsis along x, then turned by the argument of periapsis
+	const double cosE = std::cos(eccentricAnomaly);
+	const double sinE = std::sin(eccentricAnomaly);
+	const double minorFactor = std::sqrt(1.0 - eccentricity * eccentricity);
+	const double speedFactor = meanMotion * semiMajorAxis / (1.0 - eccentricity * cosE);
+	const Eigen::Rotation2Dd rotation(argumentOfPeriapsis);
+	position = center + scale * (rotation * Eigen::Vector2d(semiMajorAxis * (cosE - eccentricity), semiMajorAxis * minorFactor * sinE));
+	velocity = scale * (rotation * Eigen::Vector2d(-speedFactor * sinE, speedFactor * minorFactor * cosE));
+}
+
+double KeplerEphemeris::getPeriod() const
+{
+	return 2 * M_PI / meanMotion;
+}
+
+std::pair<std::shared_ptr<const KeplerEphemeris>, std::shared_ptr<const KeplerEphemeris>> makeBinaryEphemerides(
+	double mass1, double mass2, double semiMajorAxis, double eccentricity, double argumentOfPeriapsis, double meanAnomaly)
+{
+	// Both follow the relative orbit scaled by the other's share of the mass, on opposite sides
+	const double totalMass = mass1 + mass2;
+	const double mu = constants::G * totalMass;
+	return {
+		std::make_shared<KeplerEphemeris>(mu, semiMajorAxis, eccentricity, argumentOfPeriapsis, meanAnomaly, -mass2 / totalMass),
+		std::make_shared<KeplerEphemeris>(mu, semiMajorAxis, eccentricity, argumentOfPeriapsis, meanAnomaly, mass1 / totalMass)
+	};
+}
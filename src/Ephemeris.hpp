@@ -0,0 +1,48 @@
+#pragma once
+#include "Eigen/Dense"
+#include <memory>
+#include <utility>
+
+// Position and velocity of a body as a function of time, for bodies that follow a prescribed
+// path instead of being integrated
+class Ephemeris
+{
+public:
+	virtual ~Ephemeris() = default;
+
+	virtual void evaluate(double time, Eigen::Vector2d& position, Eigen::Vector2d& velocity) const = 0;
+};
+
+// Elliptic Kepler orbit, scaled and shifted: center + scale * r(t), where r(t) is the
+// orbit of a body around a mass with gravitational parameter mu. A scale below 1 gives the
+// orbit of one body of a pair around their barycenter; a negative scale puts it opposite.
+class KeplerEphemeris : public Ephemeris
+{
+private:
+	double mu;
+	double semiMajorAxis;
+	double eccentricity;
+	double argumentOfPeriapsis;
+	double meanAnomaly;
+	double scale;
+	Eigen::Vector2d center;
+
+	// Radians per second
+	double meanMotion;
+
+public:
+	// meanAnomaly is the mean anomaly at time 0; eccentricity must be below 1
+	KeplerEphemeris(double mu, double semiMajorAxis, double eccentricity, double argumentOfPeriapsis = 0.0,
+		double meanAnomaly = 0.0, double scale = 1.0, const Eigen::Vector2d& center = Eigen::Vector2d::Zero());
+
+	void evaluate(double time, Eigen::Vector2d& position, Eigen::Vector2d& velocity) const override;
+
+	double getPeriod() const;
+};
+
+// Ephemerides of two bodies on their mutual Kepler orbit around their barycenter at the
+// origin, as for the Sun and Jupiter in the restricted three-body problem. The second body
+// starts at periapsis along the x axis for a zero argument of periapsis and mean anomaly.
+std::pair<std::shared_ptr<const KeplerEphemeris>, std::shared_ptr<const KeplerEphemeris>> makeBinaryEphemerides(
+	double mass1, double mass2, double semiMajorAxis, double eccentricity = 0.0,
+	double argumentOfPeriapsis = 0.0, double meanAnomaly = 0.0);
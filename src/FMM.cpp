@@ -0,0 +1,524 @@
+#include "FMM.hpp"
+#include "Kernels.hpp"
+#include "utils.hpp"
+#include <cmath>
+
+namespace
+{
+constexpr size_t MAX_COEFFICIENTS = (FMMSolver::MAX_ORDER + 1) * (FMMSolver::MAX_ORDER + 2) / 2;
+
+// Expansion coefficients for the monomial x^a y^b are ordered by degree n = a + b, then by b
+inline size_t coefficientIndex(int a, int b)
+{
+	const int n = a + b;
+	return n * (n + 1) / 2 + b;
+}
+
+// out[(a, b)] = x^a y^b / (a! b!) for a + b <= order
+void scaledPowers(double x, double y, int order, double* out)
+{
+	double powerX[FMMSolver::MAX_ORDER + 1];
+	double powerY[FMMSolver::MAX_ORDER + 1];
+	powerX[0] = 1.0;
+	powerY[0] = 1.0;
+	for (int k = 1; k <= order; k++)
+	{
+		powerX[k] = powerX[k - 1] * x / k;
+		powerY[k] = powerY[k - 1] * y / k;
+	}
+
+	for (int n = 0; n <= order; n++)
+	{
+		for (int b = 0; b <= n; b++)
+		{
+			out[coefficientIndex(n - b, b)] = powerX[n - b] * powerY[b];
+		}
+	}
+}
+
+// out[(a, b)] = d^a/dx^a d^b/dy^b of 1/|r| at r = (x, y), for a + b <= order.
+// 1/|r| is g(rho) with rho = |r|^2 / 2, whose derivatives are g^(m) = (-1)^m (2m - 1)!! / |r|^(2m + 1), and
+// d^a/dx^a g(rho) = sum_i a! / (2^i i! (a - 2i)!) x^(a - 2i) g^(a - i)(rho); y works the same way.
+void derivatives(double x, double y, int order, const std::vector<double>& hermite, double* out)
+{
+	const double r2 = x * x + y * y;
+	const double inverseR2 = 1.0 / r2;
+
+	double g[FMMSolver::MAX_ORDER + 1];
+	g[0] = 1.0 / std::sqrt(r2);
+	for (int m = 1; m <= order; m++)
+	{
+		g[m] = -(2 * m - 1) * g[m - 1] * inverseR2;
+	}
+
+	double powerX[FMMSolver::MAX_ORDER + 1];
+	double powerY[FMMSolver::MAX_ORDER + 1];
+	powerX[0] = 1.0;
+	powerY[0] = 1.0;
+	for (int k = 1; k <= order; k++)
+	{
+		powerX[k] = powerX[k - 1] * x;
+		powerY[k] = powerY[k - 1] * y;
+	}
+
+	const int stride = FMMSolver::MAX_ORDER + 1;
+	for (int n = 0; n <= order; n++)
+	{
+		for (int b = 0; b <= n; b++)
+		{
+			const int a = n - b;
+			double sum = 0.0;
+			for (int i = 0; 2 * i <= a; i++)
+			{
+				for (int j = 0; 2 * j <= b; j++)
+				{
+					sum += hermite[a * stride + i] * hermite[b * stride + j] * powerX[a - 2 * i] * powerY[b - 2 * j] * g[n - i - j];
+				}
+			}
+			out[coefficientIndex(a, b)] = sum;
+		}
+	}
+}
+}
+
+void FMMSolver::setFMMSettings(const FMMSettings& settings)
+{
+	this->settings = settings;
+	this->settings.order = std::clamp(settings.order, 1, MAX_ORDER);
+}
+
+const FMMSettings& FMMSolver::getFMMSettings() const
+{
+	return settings;
+}
+
+void FMMSolver::prepareCoefficients()
+{
+	const int order = settings.order;
+	coefficientCount = (order + 1) * (order + 2) / 2;
+
+	double factorial[MAX_ORDER + 1];
+	factorial[0] = 1.0;
+	for (int k = 1; k <= MAX_ORDER; k++)
+	{
+		factorial[k] = factorial[k - 1] * k;
+	}
+
+	const int stride = MAX_ORDER + 1;
+	hermite.assign(stride * stride, 0.0);
+	for (int a = 0; a <= MAX_ORDER; a++)
+	{
+		for (int i = 0; 2 * i <= a; i++)
+		{
+			hermite[a * stride + i] = factorial[a] / (std::pow(2.0, i) * factorial[i] * factorial[a - 2 * i]);
+		}
+	}
+}
+
+void FMMSolver::calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	accelerations.resize(particles.size());
+	if (particles.empty()) return;
+
+	updateTree(particles, pool);
+	prepareCoefficients();
+	calculateMultipoles(pool);
+
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const size_t count = particles.size();
+
+	// With one thread the whole walk is one task, otherwise it is cut into pairs of
+	// subtrees small enough to spread over the threads
+	tasks.clear();
+	if (pool.getThreadCount() == 1)
+	{
+		tasks.emplace_back(0, 0);
+	}
+	else
+	{
+		collectTasks(0, 0, std::max<uint32_t>(TASK_MIN_PARTICLES, count / (pool.getThreadCount() * TASKS_PER_THREAD)));
+	}
+
+	const size_t blocks = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), tasks.size()));
+	const size_t localsSize = nodes.size() * coefficientCount;
+	blockLocals.assign(blocks * localsSize, 0.0);
+	blockAx.assign(blocks * count, 0.0);
+	blockAy.assign(blocks * count, 0.0);
+
+	// Block b takes every task t with t % blocks == b. A fixed assignment keeps the partial
+	// sums, and so the result, the same from run to run with the same thread count.
+	pool.parallelFor(blocks, [&](size_t blockBegin, size_t blockEnd) {
+		for (size_t block = blockBegin; block < blockEnd; block++)
+		{
+			double* local = &blockLocals[block * localsSize];
+			double* ax = &blockAx[block * count];
+			double* ay = &blockAy[block * count];
+			for (size_t t = block; t < tasks.size(); t += blocks)
+			{
+				interact(tasks[t].first, tasks[t].second, local, ax, ay);
+			}
+		}
+	}, 1);
+
+	locals.resize(localsSize);
+	pool.parallelFor(localsSize, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			double sum = 0.0;
+			for (size_t block = 0; block < blocks; block++)
+			{
+				sum += blockLocals[block * localsSize + i];
+			}
+			locals[i] = sum;
+		}
+	});
+
+	evaluateLocals(accelerations, pool);
+
+	const std::vector<uint32_t>& particleIndices = tree.getParticleIndices();
+	pool.parallelFor(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			Eigen::Vector2d direct = Eigen::Vector2d::Zero();
+			for (size_t block = 0; block < blocks; block++)
+			{
+				direct += Eigen::Vector2d(blockAx[block * count + i], blockAy[block * count + i]);
+			}
+			accelerations[particleIndices[i]] += direct;
+		}
+	});
+}
+
+void FMMSolver::calculateMultipoles(util::ThreadPool& pool)
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const std::vector<uint32_t>& leafNodes = tree.getLeafNodes();
+	const std::vector<double>& bodyX = tree.getBodyX();
+	const std::vector<double>& bodyY = tree.getBodyY();
+	const std::vector<double>& bodyMass = tree.getBodyMass();
+	const int order = settings.order;
+
+	multipoles.assign(nodes.size() * coefficientCount, 0.0);
+	radius.assign(nodes.size(), 0.0);
+
+	// Moments M_k = sum m t^k / k! of the leaf particles about the center of mass, t = x - z
+	pool.parallelFor(leafNodes.size(), [&](size_t begin, size_t end) {
+		double powers[MAX_COEFFICIENTS];
+		for (size_t l = begin; l < end; l++)
+		{
+			const uint32_t leaf = leafNodes[l];
+			const QuadTreeNode& node = nodes[leaf];
+			double* moments = &multipoles[leaf * coefficientCount];
+			double leafRadius = 0.0;
+
+			for (uint32_t i = node.particleBegin; i < node.particleBegin + node.particleCount; i++)
+			{
+				const double tx = bodyX[i] - node.centerOfMass.x();
+				const double ty = bodyY[i] - node.centerOfMass.y();
+				scaledPowers(tx, ty, order, powers);
+				for (size_t k = 0; k < coefficientCount; k++)
+				{
+					moments[k] += bodyMass[i] * powers[k];
+				}
+				leafRadius = std::max(leafRadius, std::sqrt(tx * tx + ty * ty));
+			}
+			radius[leaf] = leafRadius;
+		}
+	}, 256);
+
+	// Shift the children's moments to the parent's center, children before parents:
+	// M_k(parent) = sum_j M_j(child) d^(k - j) / (k - j)!, d = z_child - z_parent
+	double powers[MAX_COEFFICIENTS];
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		const QuadTreeNode& node = nodes[n];
+		if (node.isLeaf() || node.totalMass == 0.0) continue;
+
+		double* moments = &multipoles[n * coefficientCount];
+		for (uint32_t c = node.firstChild; c < node.next; c = nodes[c].next)
+		{
+			if (nodes[c].totalMass == 0.0) continue;
+
+			const Eigen::Vector2d d = nodes[c].centerOfMass - node.centerOfMass;
+			scaledPowers(d.x(), d.y(), order, powers);
+			const double* childMoments = &multipoles[c * coefficientCount];
+
+			for (int n1 = 0; n1 <= order; n1++)
+			{
+				for (int kb = 0; kb <= n1; kb++)
+				{
+					const int ka = n1 - kb;
+					double sum = 0.0;
+					for (int ja = 0; ja <= ka; ja++)
+					{
+						for (int jb = 0; jb <= kb; jb++)
+						{
+							sum += childMoments[coefficientIndex(ja, jb)] * powers[coefficientIndex(ka - ja, kb - jb)];
+						}
+					}
+					moments[coefficientIndex(ka, kb)] += sum;
+				}
+			}
+
+			radius[n] = std::max(radius[n], d.norm() + radius[c]);
+		}
+	}
+}
+
+bool FMMSolver::separated(uint32_t a, uint32_t b) const
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const double distance = (nodes[a].centerOfMass - nodes[b].centerOfMass).norm();
+	return radius[a] + radius[b] < settings.theta * distance;
+}
+
+bool FMMSolver::splitFirst(uint32_t a, uint32_t b) const
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	if (nodes[a].isLeaf()) return false;
+	if (nodes[b].isLeaf()) return true;
+	return radius[a] >= radius[b];
+}
+
+void FMMSolver::collectTasks(uint32_t a, uint32_t b, uint32_t taskSize)
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const QuadTreeNode& nodeA = nodes[a];
+	const QuadTreeNode& nodeB = nodes[b];
+	if (nodeA.totalMass == 0.0 || nodeB.totalMass == 0.0) return;
+
+	if (a == b)
+	{
+		if (nodeA.isLeaf() || nodeA.particleCount <= taskSize)
+		{
+			tasks.emplace_back(a, a);
+			return;
+		}
+		for (uint32_t c = nodeA.firstChild; c < nodeA.next; c = nodes[c].next)
+		{
+			collectTasks(c, c, taskSize);
+			for (uint32_t d = nodes[c].next; d < nodeA.next; d = nodes[d].next)
+			{
+				collectTasks(c, d, taskSize);
+			}
+		}
+		return;
+	}
+
+	if (nodeA.particleCount + nodeB.particleCount <= taskSize || separated(a, b) || (nodeA.isLeaf() && nodeB.isLeaf()))
+	{
+		tasks.emplace_back(a, b);
+		return;
+	}
+
+	if (splitFirst(a, b))
+	{
+		for (uint32_t c = nodeA.firstChild; c < nodeA.next; c = nodes[c].next)
+		{
+			collectTasks(c, b, taskSize);
+		}
+	}
+	else
+	{
+		for (uint32_t c = nodeB.firstChild; c < nodeB.next; c = nodes[c].next)
+		{
+			collectTasks(a, c, taskSize);
+		}
+	}
+}
+
+void FMMSolver::interact(uint32_t a, uint32_t b, double* local, double* ax, double* ay) const
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const QuadTreeNode& nodeA = nodes[a];
+	const QuadTreeNode& nodeB = nodes[b];
+	if (nodeA.totalMass == 0.0 || nodeB.totalMass == 0.0) return;
+
+	if (a == b)
+	{
+		if (nodeA.isLeaf())
+		{
+			interactBodies(a, a, ax, ay);
+			return;
+		}
+
+		// Every pair of children once, and each child with itself
+		for (uint32_t c = nodeA.firstChild; c < nodeA.next; c = nodes[c].next)
+		{
+			interact(c, c, local, ax, ay);
+			for (uint32_t d = nodes[c].next; d < nodeA.next; d = nodes[d].next)
+			{
+				interact(c, d, local, ax, ay);
+			}
+		}
+		return;
+	}
+
+	const bool leaves = nodeA.isLeaf() && nodeB.isLeaf();
+	if (leaves && nodeA.particleCount * nodeB.particleCount <= DIRECT_INTERACTION_LIMIT)
+	{
+		interactBodies(a, b, ax, ay);
+	}
+	else if (separated(a, b))
+	{
+		interactCells(a, b, local);
+	}
+	else if (leaves)
+	{
+		interactBodies(a, b, ax, ay);
+	}
+	else if (splitFirst(a, b))
+	{
+		for (uint32_t c = nodeA.firstChild; c < nodeA.next; c = nodes[c].next)
+		{
+			interact(c, b, local, ax, ay);
+		}
+	}
+	else
+	{
+		for (uint32_t c = nodeB.firstChild; c < nodeB.next; c = nodes[c].next)
+		{
+			interact(a, c, local, ax, ay);
+		}
+	}
+}
+
+void FMMSolver::interactCells(uint32_t a, uint32_t b, double* local) const
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const int order = settings.order;
+
+	// With R = z_b - z_a, the local coefficients of b gain
+	//   C_m(b) += sum_k (-1)^|k| M_k(a) D_(m + k)(R)
+	// and, since D_n(-R) = (-1)^|n| D_n(R), those of a gain
+	//   C_m(a) += (-1)^|m| sum_k M_k(b) D_(m + k)(R)
+	// so one set of derivatives serves both directions
+	const Eigen::Vector2d r = nodes[b].centerOfMass - nodes[a].centerOfMass;
+	double d[MAX_COEFFICIENTS];
+	derivatives(r.x(), r.y(), order, hermite, d);
+
+	const double* momentsA = &multipoles[a * coefficientCount];
+	const double* momentsB = &multipoles[b * coefficientCount];
+	double* localA = &local[a * coefficientCount];
+	double* localB = &local[b * coefficientCount];
+
+	for (int m = 0; m <= order; m++)
+	{
+		for (int mb = 0; mb <= m; mb++)
+		{
+			const int ma = m - mb;
+			double sumA = 0.0;
+			double sumB = 0.0;
+			for (int k = 0; k <= order - m; k++)
+			{
+				const double sign = (k & 1) ? -1.0 : 1.0;
+				for (int kb = 0; kb <= k; kb++)
+				{
+					const int ka = k - kb;
+					const double derivative = d[coefficientIndex(ma + ka, mb + kb)];
+					sumB += sign * momentsA[coefficientIndex(ka, kb)] * derivative;
+					sumA += momentsB[coefficientIndex(ka, kb)] * derivative;
+				}
+			}
+			localB[coefficientIndex(ma, mb)] += sumB;
+			localA[coefficientIndex(ma, mb)] += (m & 1) ? -sumA : sumA;
+		}
+	}
+}
+
+void FMMSolver::interactBodies(uint32_t a, uint32_t b, double* ax, double* ay) const
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const std::vector<double>& bodyX = tree.getBodyX();
+	const std::vector<double>& bodyY = tree.getBodyY();
+	const std::vector<double>& bodyMass = tree.getBodyMass();
+
+	const uint32_t beginA = nodes[a].particleBegin;
+	const uint32_t endA = beginA + nodes[a].particleCount;
+	const uint32_t endB = nodes[b].particleBegin + nodes[b].particleCount;
+
+	for (uint32_t i = beginA; i < endA; i++)
+	{
+		// Within one leaf only the pairs after i are left
+		const uint32_t first = a == b ? i + 1 : nodes[b].particleBegin;
+		kernels::accumulateMutualAcceleration(bodyX[i], bodyY[i], bodyMass[i],
+			&bodyX[first], &bodyY[first], &bodyMass[first], endB - first,
+			QuadTreeNode::MIN_DISTANCE, ax[i], ay[i], &ax[first], &ay[first]);
+	}
+}
+
+void FMMSolver::evaluateLocals(std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	const std::vector<uint32_t>& leafNodes = tree.getLeafNodes();
+	const std::vector<uint32_t>& particleIndices = tree.getParticleIndices();
+	const std::vector<double>& bodyX = tree.getBodyX();
+	const std::vector<double>& bodyY = tree.getBodyY();
+	const int order = settings.order;
+
+	// Shift every parent's expansion to its children, parents before children:
+	// C_m(child) += sum_j C_(m + j)(parent) d^j / j!, d = z_child - z_parent
+	double powers[MAX_COEFFICIENTS];
+	for (size_t n = 0; n < nodes.size(); n++)
+	{
+		const QuadTreeNode& node = nodes[n];
+		if (node.isLeaf() || node.totalMass == 0.0) continue;
+
+		const double* parentLocal = &locals[n * coefficientCount];
+		for (uint32_t c = node.firstChild; c < node.next; c = nodes[c].next)
+		{
+			if (nodes[c].totalMass == 0.0) continue;
+
+			const Eigen::Vector2d d = nodes[c].centerOfMass - node.centerOfMass;
+			scaledPowers(d.x(), d.y(), order, powers);
+			double* childLocal = &locals[c * coefficientCount];
+
+			for (int m = 0; m <= order; m++)
+			{
+				for (int mb = 0; mb <= m; mb++)
+				{
+					const int ma = m - mb;
+					double sum = 0.0;
+					for (int j = 0; j <= order - m; j++)
+					{
+						for (int jb = 0; jb <= j; jb++)
+						{
+							sum += parentLocal[coefficientIndex(ma + j - jb, mb + jb)] * powers[coefficientIndex(j - jb, jb)];
+						}
+					}
+					childLocal[coefficientIndex(ma, mb)] += sum;
+				}
+			}
+		}
+	}
+
+	// The acceleration is the gradient of the local expansion,
+	// a_x = G sum_m C_(m + e_x) s^m / m!, s = x - z_leaf, and likewise for y
+	pool.parallelFor(leafNodes.size(), [&](size_t begin, size_t end) {
+		double powers[MAX_COEFFICIENTS];
+		for (size_t l = begin; l < end; l++)
+		{
+			const uint32_t leaf = leafNodes[l];
+			const QuadTreeNode& node = nodes[leaf];
+			const double* leafLocal = &locals[leaf * coefficientCount];
+
+			for (uint32_t i = node.particleBegin; i < node.particleBegin + node.particleCount; i++)
+			{
+				scaledPowers(bodyX[i] - node.centerOfMass.x(), bodyY[i] - node.centerOfMass.y(), order - 1, powers);
+				double ax = 0.0;
+				double ay = 0.0;
+				for (int m = 0; m < order; m++)
+				{
+					for (int mb = 0; mb <= m; mb++)
+					{
+						const int ma = m - mb;
+						const double power = powers[coefficientIndex(ma, mb)];
+						ax += leafLocal[coefficientIndex(ma + 1, mb)] * power;
+						ay += leafLocal[coefficientIndex(ma, mb + 1)] * power;
+					}
+				}
+				accelerations[particleIndices[i]] = constants::G * Eigen::Vector2d(ax, ay);
+			}
+		}
+	}, 256);
+}
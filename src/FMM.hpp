@@ -0,0 +1,92 @@
+#pragma once
+#include "ForceSolver.hpp"
+#include <utility>
+#include <vector>
+
+struct FMMSettings
+{
+	// Highest order of the multipole and local expansions. The error of a cell-cell
+	// interaction falls roughly like theta^(order + 1).
+	int order = 4;
+
+	// Two cells interact through their expansions when (r_A + r_B) < theta * |z_A - z_B|,
+	// where r is the radius of a cell's particles around its center of mass
+	double theta = 0.5;
+};
+
+// Fast multipole method on the quadtree (Dehnen's scheme). Cells carry Cartesian multipole
+// moments of the 1/r potential about their center of mass; a dual-tree walk pairs cells that
+// are far enough apart, and each such pair is evaluated once for both sides, adding to the
+// local Taylor expansions of both cells. Local expansions are then passed down the tree and
+// evaluated at the particles. Cost is O(N) for a fixed order and theta.
+class FMMSolver : public TreeSolver
+{
+private:
+	FMMSettings settings;
+
+	// Number of coefficients per expansion, (order + 1)(order + 2) / 2
+	size_t coefficientCount = 0;
+
+	// hermite[a * (MAX_ORDER + 1) + i] = a! / (2^i i! (a - 2i)!), for the derivatives of 1/r
+	std::vector<double> hermite;
+
+	// Expansions per node, coefficientCount each
+	std::vector<double> multipoles;
+	std::vector<double> locals;
+
+	// Radius around the center of mass holding all of a node's particles
+	std::vector<double> radius;
+
+	// Pairs of nodes whose interaction is evaluated by one block of work
+	std::vector<std::pair<uint32_t, uint32_t>> tasks;
+
+	// Per block of work: local expansions of every node and accelerations of every particle,
+	// summed at the end since symmetric interactions write to both sides
+	std::vector<double> blockLocals;
+	std::vector<double> blockAx;
+	std::vector<double> blockAy;
+
+	void prepareCoefficients();
+
+	// Particle to multipole at the leaves, multipole to multipole upwards
+	void calculateMultipoles(util::ThreadPool& pool);
+
+	// Whether two cells may interact through their expansions
+	bool separated(uint32_t a, uint32_t b) const;
+
+	// Whether the walk should open a rather than b, which is the larger of the two unless it is a leaf
+	bool splitFirst(uint32_t a, uint32_t b) const;
+
+	// Split the dual-tree walk into independent pairs of subtrees
+	void collectTasks(uint32_t a, uint32_t b, uint32_t taskSize);
+
+	// Dual-tree walk on the pair (a, b), or the self-interaction of a if a == b
+	void interact(uint32_t a, uint32_t b, double* local, double* ax, double* ay) const;
+
+	// Multipole to local, both ways
+	void interactCells(uint32_t a, uint32_t b, double* local) const;
+
+	// Direct sum between the particles of two leaves, or within one
+	void interactBodies(uint32_t a, uint32_t b, double* ax, double* ay) const;
+
+	// Local to local downwards, local to particle at the leaves
+	void evaluateLocals(std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool);
+
+public:
+	// Largest order the expansions may have
+	static constexpr int MAX_ORDER = 12;
+
+	// Two leaves with at most this many particle pairs are summed directly even when they
+	// are far apart, which is cheaper than their expansions
+	static constexpr uint32_t DIRECT_INTERACTION_LIMIT = 64;
+
+	// With several threads the walk is cut into about this many tasks per thread,
+	// none smaller than TASK_MIN_PARTICLES particles unless it cannot be split
+	static constexpr uint32_t TASKS_PER_THREAD = 16;
+	static constexpr uint32_t TASK_MIN_PARTICLES = 1024;
+
+	void calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) override;
+
+	void setFMMSettings(const FMMSettings& settings);
+	const FMMSettings& getFMMSettings() const;
+};
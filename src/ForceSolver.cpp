@@ -0,0 +1,289 @@
+#include "ForceSolver.hpp"
+#include "Kernels.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+
+namespace
+{
+void findTargets(const ParticleStore& particles, uint8_t minLevel, std::vector<uint32_t>& targets)
+{
+	targets.clear();
+	for (uint32_t i = 0; i < particles.size(); i++)
+	{
+		if (particles.level[i] >= minLevel)
+			targets.push_back(i);
+	}
+}
+}
+
+void ForceSolver::calculateActiveAccelerations(ParticleStore& particles, uint8_t, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	calculateAccelerations(particles, accelerations, pool);
+}
+
+// Direct summation
+
+void DirectSumSolver::calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	const size_t count = particles.size();
+	accelerations.resize(count);
+	if (count == 0) return;
+
+	// The store is already laid out as the kernels want it
+	const double* bodyX = particles.x.data();
+	const double* bodyY = particles.y.data();
+	const double* bodyMass = particles.mass.data();
+
+	const size_t tiles = (count + TILE_SIZE - 1) / TILE_SIZE;
+	if (tilePairs.size() != tiles * (tiles + 1) / 2)
+	{
+		tilePairs.clear();
+		for (uint32_t i = 0; i < tiles; i++)
+		{
+			for (uint32_t j = i; j < tiles; j++)
+			{
+				tilePairs.emplace_back(i, j);
+			}
+		}
+	}
+
+	const size_t blocks = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), tilePairs.size()));
+	blockAx.assign(blocks * count, 0.0);
+	blockAy.assign(blocks * count, 0.0);
+
+	// Block b takes every pair p with p % blocks == b, so uneven pairs (the diagonal ones are
+	// half the work) spread out evenly. The assignment is fixed, which keeps every block's
+	// partial sums, and so the result, the same from run to run.
+	pool.parallelFor(blocks, [&](size_t blockBegin, size_t blockEnd) {
+		for (size_t block = blockBegin; block < blockEnd; block++)
+		{
+			double* ax = &blockAx[block * count];
+			double* ay = &blockAy[block * count];
+
+			for (size_t p = block; p < tilePairs.size(); p += blocks)
+			{
+				const size_t tileA = tilePairs[p].first * TILE_SIZE;
+				const size_t tileB = tilePairs[p].second * TILE_SIZE;
+				const size_t endA = std::min(tileA + TILE_SIZE, count);
+				const size_t endB = std::min(tileB + TILE_SIZE, count);
+
+				for (size_t i = tileA; i < endA; i++)
+				{
+					// Within a tile only the pairs after i are left
+					const size_t first = tileA == tileB ? i + 1 : tileB;
+					kernels::accumulateMutualAcceleration(bodyX[i], bodyY[i], bodyMass[i],
+						&bodyX[first], &bodyY[first], &bodyMass[first], endB - first,
+						QuadTreeNode::MIN_DISTANCE, ax[i], ay[i], &ax[first], &ay[first]);
+				}
+			}
+		}
+	}, 1);
+
+	pool.parallelFor(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			Eigen::Vector2d acceleration = Eigen::Vector2d::Zero();
+			for (size_t block = 0; block < blocks; block++)
+			{
+				acceleration += Eigen::Vector2d(blockAx[block * count + i], blockAy[block * count + i]);
+			}
+			accelerations[i] = acceleration;
+		}
+	});
+}
+
+void DirectSumSolver::calculateActiveAccelerations(ParticleStore& particles, uint8_t minLevel, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	// With every particle active the pairwise sum does half the work
+	findTargets(particles, minLevel, targets);
+	if (targets.size() == particles.size())
+	{
+		calculateAccelerations(particles, accelerations, pool);
+		return;
+	}
+
+	accelerations.resize(particles.size());
+	pool.parallelFor(targets.size(), [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++)
+		{
+			const uint32_t i = targets[t];
+			double ax = 0.0;
+			double ay = 0.0;
+			kernels::accumulateAcceleration(particles.x[i], particles.y[i],
+				particles.x.data(), particles.y.data(), particles.mass.data(), particles.size(),
+				QuadTreeNode::MIN_DISTANCE, ax, ay);
+			accelerations[i] = Eigen::Vector2d(ax, ay);
+		}
+	}, 16);
+}
+
+// Barnes-Hut
+
+void BarnesHutSolver::calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	if (particles.empty())
+	{
+		accelerations.clear();
+		return;
+	}
+
+	updateTree(particles, pool);
+
+	// Every walk only reads the tree and writes its own particles, so the result
+	// does not depend on the thread count
+	tree.calculateAccelerations(accelerations, pool);
+}
+
+void BarnesHutSolver::calculateActiveAccelerations(ParticleStore& particles, uint8_t minLevel, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool)
+{
+	if (particles.empty())
+	{
+		accelerations.clear();
+		return;
+	}
+
+	// Inactive particles have moved as well, so the whole tree is brought up to date,
+	// usually by a refit. The slots are only final after that.
+	updateTree(particles, pool);
+	findTargets(particles, minLevel, targets);
+	if (targets.size() == particles.size())
+	{
+		tree.calculateAccelerations(accelerations, pool);
+		return;
+	}
+
+	tree.calculateAccelerations(particles, targets, accelerations, pool);
+}
+
+// Tree solvers
+
+void TreeSolver::reset()
+{
+	tree.clear();
+}
+
+void TreeSolver::setSettings(const TreeSettings& settings)
+{
+	tree.setSettings(settings);
+}
+
+const TreeSettings& TreeSolver::getSettings() const
+{
+	return tree.getSettings();
+}
+
+const TreeStatistics& TreeSolver::getStatistics() const
+{
+	return tree.getStatistics();
+}
+
+void TreeSolver::updateTree(ParticleStore& particles, util::ThreadPool& pool)
+{
+	// Particles barely move between substeps, so the previous tree is usually refitted
+	if (!tree.refit(particles, pool))
+	{
+		rebuildTree(particles, pool);
+	}
+}
+
+void TreeSolver::rebuildTree(ParticleStore& particles, util::ThreadPool& pool)
+{
+	// Calculate bounds for all particles with some padding
+	Eigen::Vector2d minBounds = particles.getPosition(0);
+	Eigen::Vector2d maxBounds = particles.getPosition(0);
+
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		minBounds.x() = std::min(minBounds.x(), particles.x[i]);
+		minBounds.y() = std::min(minBounds.y(), particles.y[i]);
+		maxBounds.x() = std::max(maxBounds.x(), particles.x[i]);
+		maxBounds.y() = std::max(maxBounds.y(), particles.y[i]);
+	}
+
+	// Add padding (10% on each side); the loose root lets refits run until a particle leaves it
+	Eigen::Vector2d size = maxBounds - minBounds;
+	double padding = std::max(size.x(), size.y()) * 0.1;
+	if (padding < 1e9) padding = 1e9; // Minimum padding
+
+	minBounds.x() -= padding;
+	minBounds.y() -= padding;
+	maxBounds.x() += padding;
+	maxBounds.y() += padding;
+
+	// Rebuild the quadtree in place
+	tree.setBounds(minBounds, maxBounds);
+	tree.build(particles, pool);
+
+	// Move particles into the new tree's Z-order, so that neighbours in space are
+	// neighbours in memory during the force walk
+	particles.permute(tree.getParticleIndices());
+	tree.setSortedOrder();
+}
+
+// Crossover
+
+namespace
+{
+// Seconds per call of the faster of a few runs
+double timeSolver(ForceSolver& solver, ParticleStore& particles, util::ThreadPool& pool)
+{
+	std::vector<Eigen::Vector2d> accelerations;
+	double best = 1e30;
+	for (int run = 0; run < 3; run++)
+	{
+		// Start from scratch each time, as after a step that moved every particle out of its cell
+		solver.reset();
+		auto start = std::chrono::steady_clock::now();
+		solver.calculateAccelerations(particles, accelerations, pool);
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+}
+
+size_t measureDirectSumCrossover(util::ThreadPool& pool)
+{
+	// Direct summation wins for at least this many particles, and Barnes-Hut is used above this many
+	constexpr size_t MIN_COUNT = 32;
+	constexpr size_t MAX_COUNT = 16384;
+
+	static std::mutex mutex;
+	static std::map<unsigned, size_t> crossovers;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto cached = crossovers.find(pool.getThreadCount());
+	if (cached != crossovers.end())
+	{
+		return cached->second;
+	}
+
+	// A central mass with a disc of light bodies, like the simulated systems
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> radius(1e11, 1e12);
+	std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+	ParticleStore particles;
+	particles.add(0, 1.0f, 2e30, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero());
+
+	DirectSumSolver directSum;
+	BarnesHutSolver barnesHut;
+	size_t crossover = MAX_COUNT;
+	for (size_t count = MIN_COUNT; count <= MAX_COUNT; count *= 2)
+	{
+		while (particles.size() < count)
+		{
+			Eigen::Vector2d position = Eigen::Rotation2Dd(angle(rng)) * Eigen::Vector2d(radius(rng), 0.0);
+			particles.add(particles.size(), 1.0f, 1e20, position, Eigen::Vector2d::Zero());
+		}
+
+		if (timeSolver(barnesHut, particles, pool) < timeSolver(directSum, particles, pool))
+		{
+			crossover = count;
+			break;
+		}
+	}
+
+	crossovers[pool.getThreadCount()] = crossover;
+	return crossover;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "Eigen/Dense"
+#include "ParticleStore.hpp"
+#include "QuadTree.hpp"
+#include "ThreadPool.hpp"
+#include <utility>
+#include <vector>
+
+enum class ForceSolverType
+{
+	// Direct summation below the measured crossover, Barnes-Hut above it
+	Automatic,
+	DirectSum,
+	BarnesHut,
+	FastMultipole
+};
+
+// Computes the gravitational acceleration of every particle
+class ForceSolver
+{
+public:
+	virtual ~ForceSolver() = default;
+
+	// Write the acceleration of every particle into accelerations, indexed like particles.
+	// A solver may permute the particles to improve memory locality, but never adds or removes any.
+	virtual void calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) = 0;
+
+	// Accelerations of the particles on block timestep level minLevel or deeper only; every
+	// particle is still a source. Entries of the other particles are unspecified. The default
+	// calculates every particle.
+	virtual void calculateActiveAccelerations(ParticleStore& particles, uint8_t minLevel, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool);
+
+	// Forget everything derived from earlier particles, called when particles are added or removed
+	virtual void reset() {}
+};
+
+// Exact O(N^2) summation. Particles are processed in tiles that fit in the L1 cache, and
+// every pair of tiles is visited once, applying each interaction to both of its bodies.
+// Also the reference solution for accuracy checks of the approximate solvers.
+class DirectSumSolver : public ForceSolver
+{
+private:
+	// Slots of the particles whose accelerations are asked for
+	std::vector<uint32_t> targets;
+
+	// Pairs (i, j) of tiles with i <= j
+	std::vector<std::pair<uint32_t, uint32_t>> tilePairs;
+
+	// One acceleration buffer per block of work, summed at the end, since both tiles of a pair are written
+	std::vector<double> blockAx;
+	std::vector<double> blockAy;
+
+public:
+	// Bodies per tile; three tiles of coordinates and masses take 12 KiB
+	static constexpr size_t TILE_SIZE = 256;
+
+	void calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) override;
+	void calculateActiveAccelerations(ParticleStore& particles, uint8_t minLevel, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) override;
+};
+
+// Base of the solvers working on a persistent quadtree, which is refitted while the particles stay in their cells
+class TreeSolver : public ForceSolver
+{
+private:
+	// Build a new tree around all particles and sort the storage into its Z-order
+	void rebuildTree(ParticleStore& particles, util::ThreadPool& pool);
+
+protected:
+	QuadTree tree;
+
+	// Slots of the particles whose accelerations are asked for
+	std::vector<uint32_t> targets;
+
+	// Refit the tree to the particles, or rebuild it if that fails
+	void updateTree(ParticleStore& particles, util::ThreadPool& pool);
+
+public:
+	void reset() override;
+
+	void setSettings(const TreeSettings& settings);
+	const TreeSettings& getSettings() const;
+	const TreeStatistics& getStatistics() const;
+};
+
+class BarnesHutSolver : public TreeSolver
+{
+public:
+	void calculateAccelerations(ParticleStore& particles, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) override;
+	void calculateActiveAccelerations(ParticleStore& particles, uint8_t minLevel, std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) override;
+};
+
+// Smallest particle count at which Barnes-Hut beats direct summation on this machine with this
+// many threads. Measured on synthetic discs the first time it is asked for, then cached.
+size_t measureDirectSumCrossover(util::ThreadPool& pool);
@@ -0,0 +1,836 @@
+#include "Integrator.hpp"
+#include "Kernels.hpp"
+#include "Objects.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <mutex>
+#include <numeric>
+
+void EulerIntegrator::step(ParticleSystem& system, double dt)
+{
+	system.calculateForces();
+	system.update(dt);
+}
+
+void LeapfrogIntegrator::step(ParticleSystem& system, double dt)
+{
+	if (!accelerationsCurrent)
+	{
+		system.calculateForces();
+		system.forEachBodyBlock([](const kernels::BodyState& bodies) {
+			kernels::kickFromForces(bodies, 0.0);
+		});
+	}
+
+	const double halfStep = 0.5 * dt;
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kick(bodies, halfStep);
+		kernels::drift(bodies, dt);
+	});
+	system.advanceTime(dt);
+
+	system.calculateForces();
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kickFromForces(bodies, halfStep);
+	});
+	accelerationsCurrent = true;
+}
+
+void LeapfrogIntegrator::reset()
+{
+	accelerationsCurrent = false;
+}
+
+void Yoshida4Integrator::step(ParticleSystem& system, double dt)
+{
+	LeapfrogIntegrator::step(system, W1 * dt);
+	LeapfrogIntegrator::step(system, W0 * dt);
+	LeapfrogIntegrator::step(system, W1 * dt);
+}
+
+void WisdomHolmanIntegrator::step(ParticleSystem& system, double dt)
+{
+	ParticleStore& particles = system.getStore();
+	if (particles.size() < 2)
+	{
+		// Nothing to orbit
+		system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+			kernels::drift(bodies, dt);
+		});
+		return;
+	}
+
+	size_t central = std::max_element(particles.mass.begin(), particles.mass.end()) - particles.mass.begin();
+	const double centralMass = particles.mass[central];
+
+	// Barycenter, which moves in a straight line
+	double totalMass = 0.0;
+	Eigen::Vector2d barycenter = Eigen::Vector2d::Zero();
+	Eigen::Vector2d barycenterVelocity = Eigen::Vector2d::Zero();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		totalMass += particles.mass[i];
+		barycenter += particles.mass[i] * particles.getPosition(i);
+		barycenterVelocity += particles.mass[i] * particles.getVelocity(i);
+	}
+	barycenter /= totalMass;
+	barycenterVelocity /= totalMass;
+
+	// To democratic heliocentric coordinates; the central body sits at the origin
+	const Eigen::Vector2d centralPosition = particles.getPosition(central);
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		for (size_t i = 0; i < bodies.count; i++)
+		{
+			bodies.x[i] -= centralPosition.x();
+			bodies.y[i] -= centralPosition.y();
+			bodies.vx[i] -= barycenterVelocity.x();
+			bodies.vy[i] -= barycenterVelocity.y();
+		}
+	});
+
+	const double halfStep = 0.5 * dt;
+	if (!accelerationsCurrent)
+	{
+		central = calculateInteractions(system, central);
+		system.forEachBodyBlock([](const kernels::BodyState& bodies) {
+			kernels::kickFromForces(bodies, 0.0);
+		});
+	}
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kick(bodies, halfStep);
+	});
+	jump(system, central, halfStep);
+
+	advanceOrbits(system, central, constants::G * centralMass, dt);
+
+	jump(system, central, halfStep);
+	central = calculateInteractions(system, central);
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kickFromForces(bodies, halfStep);
+	});
+	accelerationsCurrent = true;
+
+	// Back to barycentric coordinates: the central body goes where it keeps the barycenter
+	// on its line and the total momentum unchanged
+	Eigen::Vector2d weightedPosition = Eigen::Vector2d::Zero();
+	Eigen::Vector2d momentum = Eigen::Vector2d::Zero();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (i == central) continue;
+		weightedPosition += particles.mass[i] * particles.getPosition(i);
+		momentum += particles.mass[i] * particles.getVelocity(i);
+	}
+	barycenter += barycenterVelocity * dt;
+	const Eigen::Vector2d newCentralPosition = barycenter - weightedPosition / totalMass;
+	const Eigen::Vector2d newCentralVelocity = -momentum / centralMass;
+	particles.x[central] = 0.0;
+	particles.y[central] = 0.0;
+	particles.vx[central] = newCentralVelocity.x();
+	particles.vy[central] = newCentralVelocity.y();
+
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		for (size_t i = 0; i < bodies.count; i++)
+		{
+			bodies.x[i] += newCentralPosition.x();
+			bodies.y[i] += newCentralPosition.y();
+			bodies.vx[i] += barycenterVelocity.x();
+			bodies.vy[i] += barycenterVelocity.y();
+		}
+	});
+	estimateTimestep(system, central);
+}
+
+void WisdomHolmanIntegrator::estimateTimestep(ParticleSystem& system, size_t central)
+{
+	// The central body was massless in the force calculation but still a target, so only the
+	// others miss its pull
+	const ParticleStore& particles = system.getStore();
+	const double mu = constants::G * particles.mass[central];
+	const Eigen::Vector2d centralPosition = particles.getPosition(central);
+	totalAccelerations = system.getAccelerations();
+	system.getThreadPool().parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const Eigen::Vector2d separation = centralPosition - particles.getPosition(i);
+			const double distance = separation.norm();
+			if (i == central || distance < QuadTreeNode::MIN_DISTANCE) continue;
+			totalAccelerations[i] += mu / (distance * distance * distance) * separation;
+		}
+	}, 256);
+	system.estimateTimestep(totalAccelerations);
+}
+
+size_t WisdomHolmanIntegrator::calculateInteractions(ParticleSystem& system, size_t central)
+{
+	// A massless central body drops out of every other body's acceleration, and the force
+	// on itself comes out as zero
+	ParticleStore& particles = system.getStore();
+	const int centralId = particles.id[central];
+	const double centralMass = particles.mass[central];
+	particles.mass[central] = 0.0;
+	system.calculateForces(false);
+
+	// The force calculation may have reordered the particles
+	central = particles.findSlot(centralId);
+	particles.mass[central] = centralMass;
+	return central;
+}
+
+void WisdomHolmanIntegrator::advanceOrbits(ParticleSystem& system, size_t central, double mu, double dt)
+{
+	// The central body's own slot is left out, it has no orbit around itself
+	const double* centralX = &system.getStore().x[central];
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		size_t split = bodies.count;
+		if (centralX >= bodies.x && centralX < bodies.x + bodies.count)
+			split = centralX - bodies.x;
+		kernels::keplerDrift(bodies.x, bodies.y, bodies.vx, bodies.vy, split, mu, dt);
+		if (split < bodies.count)
+			kernels::keplerDrift(bodies.x + split + 1, bodies.y + split + 1, bodies.vx + split + 1, bodies.vy + split + 1, bodies.count - split - 1, mu, dt);
+	});
+}
+
+void WisdomHolmanIntegrator::jump(ParticleSystem& system, size_t central, double dt)
+{
+	ParticleStore& particles = system.getStore();
+	Eigen::Vector2d momentum = Eigen::Vector2d::Zero();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (i == central) continue;
+		momentum += particles.mass[i] * particles.getVelocity(i);
+	}
+
+	const Eigen::Vector2d shift = momentum * dt / particles.mass[central];
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		for (size_t i = 0; i < bodies.count; i++)
+		{
+			bodies.x[i] += shift.x();
+			bodies.y[i] += shift.y();
+		}
+	});
+}
+
+void WisdomHolmanIntegrator::reset()
+{
+	accelerationsCurrent = false;
+}
+
+void BlockTimestepIntegrator::step(ParticleSystem& system, double dt)
+{
+	ParticleStore& particles = system.getStore();
+	util::ThreadPool& pool = system.getThreadPool();
+	const int maxLevel = settings.maxLevel;
+	const uint32_t ticks = 1u << maxLevel;
+	const double tick = dt / ticks;
+
+	if (!accelerationsCurrent)
+	{
+		// Everyone starts on the shortest step, levels relax at the following boundaries
+		const std::vector<Eigen::Vector2d>& accelerations = system.calculateActiveAccelerations(0);
+		pool.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				particles.ax[i] = accelerations[i].x() + particles.getExternalAcceleration(i).x();
+				particles.ay[i] = accelerations[i].y() + particles.getExternalAcceleration(i).y();
+				particles.fx[i] = 0.0;
+				particles.fy[i] = 0.0;
+				particles.level[i] = maxLevel;
+			}
+		});
+	}
+
+	// Opening half kicks, every particle is at the start of its step
+	pool.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const double halfStep = 0.5 * std::ldexp(dt, -particles.level[i]);
+			particles.vx[i] += particles.ax[i] * halfStep;
+			particles.vy[i] += particles.ay[i] * halfStep;
+		}
+	});
+
+	for (uint32_t t = 1; t <= ticks; t++)
+	{
+		system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+			kernels::drift(bodies, tick);
+		});
+		system.advanceTime(tick);
+
+		// The particles due now are those whose step divides t
+		const int minLevel = maxLevel - std::countr_zero(t);
+		const std::vector<Eigen::Vector2d>& accelerations = system.calculateActiveAccelerations(minLevel);
+
+		pool.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				if (particles.level[i] < minLevel) continue;
+
+				// Forces applied from outside count towards this kick
+				const double step = std::ldexp(dt, -particles.level[i]);
+				const Eigen::Vector2d acceleration = accelerations[i] + particles.getExternalAcceleration(i);
+				const double jerk = (acceleration - particles.getAcceleration(i)).norm() / step;
+				particles.fx[i] = 0.0;
+				particles.fy[i] = 0.0;
+
+				// Closing half kick of this step
+				particles.vx[i] += acceleration.x() * 0.5 * step;
+				particles.vy[i] += acceleration.y() * 0.5 * step;
+				particles.ax[i] = acceleration.x();
+				particles.ay[i] = acceleration.y();
+
+				// At the end of the whole step any level is allowed; its opening kick comes with the next step
+				const int level = chooseLevel(acceleration.norm(), jerk, dt, t == ticks ? 0 : minLevel);
+				particles.level[i] = level;
+				if (t < ticks)
+				{
+					const double halfStep = 0.5 * std::ldexp(dt, -level);
+					particles.vx[i] += acceleration.x() * halfStep;
+					particles.vy[i] += acceleration.y() * halfStep;
+				}
+			}
+		});
+	}
+
+	accelerationsCurrent = true;
+}
+
+int BlockTimestepIntegrator::chooseLevel(double acceleration, double jerk, double dt, int minLevel) const
+{
+	// Without any jerk the longest allowed step is taken
+	const double wanted = settings.eta * acceleration / jerk;
+	int level = minLevel;
+	while (level < settings.maxLevel && std::ldexp(dt, -level) > wanted)
+	{
+		level++;
+	}
+	return level;
+}
+
+void BlockTimestepIntegrator::reset()
+{
+	accelerationsCurrent = false;
+}
+
+void BlockTimestepIntegrator::setSettings(const BlockTimestepSettings& settings)
+{
+	this->settings = settings;
+	this->settings.maxLevel = std::clamp(settings.maxLevel, 0, MAX_LEVEL);
+	reset();
+}
+
+const BlockTimestepSettings& BlockTimestepIntegrator::getSettings() const
+{
+	return settings;
+}
+
+namespace
+{
+template <typename T>
+void gatherInto(std::vector<T>& values, const std::vector<uint32_t>& order)
+{
+	std::vector<T> gathered(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		gathered[i] = values[order[i]];
+	}
+	values.swap(gathered);
+}
+}
+
+void RespaIntegrator::step(ParticleSystem& system, double dt)
+{
+	if (slowAccelerations.size() != settings.levels.size())
+	{
+		slowAccelerations.resize(settings.levels.size());
+	}
+
+	if (!accelerationsCurrent)
+	{
+		calculateFastAccelerations(system);
+	}
+
+	// Opening impulses of the levels starting a period, reusing the accelerations of the
+	// closing impulse of the period before
+	for (size_t level = 0; level < settings.levels.size(); level++)
+	{
+		const uint64_t period = getPeriod(level);
+		if (stepCount % period != 0) continue;
+		if (slowAccelerations[level].empty())
+		{
+			calculateSlowAccelerations(system, level);
+		}
+		kickSlow(system, level, 0.5 * period * dt);
+	}
+
+	const double halfStep = 0.5 * dt;
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kick(bodies, halfStep);
+		kernels::drift(bodies, dt);
+	});
+	system.advanceTime(dt);
+	calculateFastAccelerations(system);
+	system.forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::kick(bodies, halfStep);
+	});
+	accelerationsCurrent = true;
+	stepCount++;
+
+	for (size_t level = 0; level < settings.levels.size(); level++)
+	{
+		const uint64_t period = getPeriod(level);
+		if (stepCount % period != 0) continue;
+		calculateSlowAccelerations(system, level);
+		kickSlow(system, level, 0.5 * period * dt);
+	}
+}
+
+double RespaIntegrator::findDominantMass(const ParticleSystem& system) const
+{
+	const ParticleStore& particles = system.getStore();
+	const ParticleStore& prescribed = system.getPrescribedBodies();
+	const double totalMass = std::accumulate(particles.mass.begin(), particles.mass.end(), 0.0)
+		+ std::accumulate(prescribed.mass.begin(), prescribed.mass.end(), 0.0);
+	return settings.dominantMassFraction * totalMass;
+}
+
+size_t RespaIntegrator::findLevel(double mass) const
+{
+	for (size_t level = 0; level + 1 < settings.levels.size(); level++)
+	{
+		if (mass >= settings.levels[level].minMass)
+			return level;
+	}
+	return settings.levels.size() - 1;
+}
+
+void RespaIntegrator::calculateFastAccelerations(ParticleSystem& system)
+{
+	ParticleStore& particles = system.getStore();
+	const double dominant = findDominantMass(system);
+	dominantX.clear();
+	dominantY.clear();
+	dominantMass.clear();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (particles.mass[i] < dominant) continue;
+		dominantX.push_back(particles.x[i]);
+		dominantY.push_back(particles.y[i]);
+		dominantMass.push_back(particles.mass[i]);
+	}
+
+	// Prescribed bodies are in the fast force whatever their mass, the slow levels leave them out
+	const ParticleStore& prescribed = system.getPrescribedBodies();
+	dominantX.insert(dominantX.end(), prescribed.x.begin(), prescribed.x.end());
+	dominantY.insert(dominantY.end(), prescribed.y.begin(), prescribed.y.end());
+	dominantMass.insert(dominantMass.end(), prescribed.mass.begin(), prescribed.mass.end());
+
+	// A handful of sources per particle, the kernel skips a body's own slot
+	system.getThreadPool().parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			// Forces applied from outside count towards the fast kicks
+			double ax = particles.getExternalAcceleration(i).x();
+			double ay = particles.getExternalAcceleration(i).y();
+			kernels::accumulateAcceleration(particles.x[i], particles.y[i],
+				dominantX.data(), dominantY.data(), dominantMass.data(), dominantMass.size(),
+				QuadTreeNode::MIN_DISTANCE, ax, ay);
+			particles.ax[i] = ax;
+			particles.ay[i] = ay;
+			particles.fx[i] = 0.0;
+			particles.fy[i] = 0.0;
+		}
+	}, 256);
+}
+
+void RespaIntegrator::calculateSlowAccelerations(ParticleSystem& system, size_t level)
+{
+	// The solver sees only this level's sources; the hidden bodies keep their slots and
+	// still get the acceleration from the visible ones
+	ParticleStore& particles = system.getStore();
+	const double dominant = findDominantMass(system);
+	savedMass.assign(particles.mass.begin(), particles.mass.end());
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (particles.mass[i] >= dominant || findLevel(particles.mass[i]) != level)
+			particles.mass[i] = 0.0;
+	}
+	if (slowIds.empty())
+	{
+		slowIds = particles.id;
+	}
+
+	// Every particle is on block timestep level 0 or deeper
+	const std::vector<Eigen::Vector2d>& accelerations = system.calculateActiveAccelerations(0, false);
+
+	// The force calculation may have reordered the particles, everything kept by slot follows them
+	if (particles.id != slowIds)
+	{
+		const int maxId = *std::max_element(slowIds.begin(), slowIds.end());
+		std::vector<uint32_t> oldSlots(maxId + 1);
+		for (uint32_t slot = 0; slot < slowIds.size(); slot++)
+		{
+			oldSlots[slowIds[slot]] = slot;
+		}
+		std::vector<uint32_t> order(particles.size());
+		for (size_t i = 0; i < particles.size(); i++)
+		{
+			order[i] = oldSlots[particles.id[i]];
+		}
+
+		gatherInto(savedMass, order);
+		for (std::vector<Eigen::Vector2d>& stored : slowAccelerations)
+		{
+			if (!stored.empty())
+				gatherInto(stored, order);
+		}
+		slowIds = particles.id;
+	}
+
+	std::copy(savedMass.begin(), savedMass.end(), particles.mass.begin());
+	slowAccelerations[level] = accelerations;
+}
+
+void RespaIntegrator::kickSlow(ParticleSystem& system, size_t level, double dt)
+{
+	ParticleStore& particles = system.getStore();
+	const std::vector<Eigen::Vector2d>& accelerations = slowAccelerations[level];
+	system.getThreadPool().parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			particles.vx[i] += accelerations[i].x() * dt;
+			particles.vy[i] += accelerations[i].y() * dt;
+		}
+	});
+}
+
+uint64_t RespaIntegrator::getPeriod(size_t level) const
+{
+	uint64_t period = 1;
+	for (size_t i = 0; i <= level; i++)
+	{
+		period *= settings.levels[i].ratio;
+	}
+	return period;
+}
+
+void RespaIntegrator::reset()
+{
+	stepCount = 0;
+	accelerationsCurrent = false;
+	slowAccelerations.assign(settings.levels.size(), {});
+	slowIds.clear();
+}
+
+void RespaIntegrator::setSettings(const RespaSettings& settings)
+{
+	this->settings = settings;
+	if (this->settings.levels.empty())
+	{
+		this->settings.levels.emplace_back();
+	}
+	for (RespaLevel& level : this->settings.levels)
+	{
+		level.ratio = std::max(level.ratio, 1);
+	}
+	reset();
+}
+
+const RespaSettings& RespaIntegrator::getSettings() const
+{
+	return settings;
+}
+
+void HybridIntegrator::step(ParticleSystem& system, double dt)
+{
+	stepSize = dt;
+	WisdomHolmanIntegrator::step(system, dt);
+}
+
+double HybridIntegrator::changeover(double distance, double changeoverRadius)
+{
+	const double y = std::clamp((distance - 0.1 * changeoverRadius) / (0.9 * changeoverRadius), 0.0, 1.0);
+	return y * y * y * (10.0 + y * (-15.0 + y * 6.0));
+}
+
+void HybridIntegrator::findBigBodies(ParticleSystem& system, size_t central)
+{
+	// Positions are relative to the central body here
+	const ParticleStore& particles = system.getStore();
+	const double centralMass = particles.mass[central];
+	changeoverRadii.assign(particles.size(), 0.0);
+	bigBodies.clear();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (i == central || particles.mass[i] < settings.bigMassFraction * centralMass) continue;
+
+		const double hillRadius = particles.getPosition(i).norm() * std::cbrt(particles.mass[i] / (3.0 * centralMass));
+		const double stepDistance = particles.getVelocity(i).norm() * stepSize;
+		changeoverRadii[i] = std::max(settings.hillRadii * hillRadius, settings.stepDistance * stepDistance);
+		bigBodies.push_back(i);
+	}
+}
+
+void HybridIntegrator::findEncounters(ParticleSystem& system, size_t central, double lookahead)
+{
+	const ParticleStore& particles = system.getStore();
+	encounters.clear();
+	if (bigBodies.empty()) return;
+
+	// Every body against the few big ones; encounters are rare, so the lock is too
+	std::mutex mutex;
+	system.getThreadPool().parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			if (i == central) continue;
+			for (uint32_t big : bigBodies)
+			{
+				// Two big bodies are a single pair
+				if (big == i || (changeoverRadii[i] > 0.0 && big > i)) continue;
+
+				// Closest approach on straight lines during the lookahead
+				const Eigen::Vector2d separation = particles.getPosition(i) - particles.getPosition(big);
+				const Eigen::Vector2d velocity = particles.getVelocity(i) - particles.getVelocity(big);
+				const double speedSquared = velocity.squaredNorm();
+				const double time = speedSquared > 0.0 ? std::clamp(-separation.dot(velocity) / speedSquared, 0.0, lookahead) : 0.0;
+				const double changeoverRadius = std::max(changeoverRadii[i], changeoverRadii[big]);
+				if ((separation + velocity * time).norm() < changeoverRadius)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					encounters.push_back({ static_cast<uint32_t>(i), big, changeoverRadius });
+				}
+			}
+		}
+	}, 256);
+
+	// Independent of the order the threads found them in
+	std::sort(encounters.begin(), encounters.end(), [](const Encounter& a, const Encounter& b) {
+		return a.body != b.body ? a.body < b.body : a.big < b.big;
+	});
+}
+
+size_t HybridIntegrator::calculateInteractions(ParticleSystem& system, size_t central)
+{
+	central = WisdomHolmanIntegrator::calculateInteractions(system, central);
+
+	// Take the part of each close pair that the encounter integrator handles out of the kicks
+	ParticleStore& particles = system.getStore();
+	findBigBodies(system, central);
+	findEncounters(system, central, 0.0);
+	for (const Encounter& encounter : encounters)
+	{
+		const Eigen::Vector2d separation = particles.getPosition(encounter.big) - particles.getPosition(encounter.body);
+		const double distance = separation.norm();
+		const double weight = 1.0 - changeover(distance, encounter.changeoverRadius);
+		const Eigen::Vector2d pull = weight * constants::G / (distance * distance * distance) * separation;
+		const Eigen::Vector2d force = particles.mass[encounter.body] * particles.mass[encounter.big] * pull;
+		if (particles.mass[encounter.body] > 0.0)
+		{
+			particles.fx[encounter.body] -= force.x();
+			particles.fy[encounter.body] -= force.y();
+		}
+		else
+		{
+			// A massless body's acceleration went straight into its slot
+			particles.ax[encounter.body] -= particles.mass[encounter.big] * pull.x();
+			particles.ay[encounter.body] -= particles.mass[encounter.big] * pull.y();
+		}
+		particles.fx[encounter.big] += force.x();
+		particles.fy[encounter.big] += force.y();
+	}
+	return central;
+}
+
+void HybridIntegrator::advanceOrbits(ParticleSystem& system, size_t central, double mu, double dt)
+{
+	findBigBodies(system, central);
+	findEncounters(system, central, dt);
+	encounterCount = encounters.size();
+
+	// Everyone takes the Kepler drift, the bodies of encounters then redo their step from
+	// where they started
+	ParticleStore& particles = system.getStore();
+	std::vector<std::pair<uint32_t, std::array<double, 4>>> starts;
+	for (const Encounter& encounter : encounters)
+	{
+		for (uint32_t slot : { encounter.body, encounter.big })
+			starts.push_back({ slot, { particles.x[slot], particles.y[slot], particles.vx[slot], particles.vy[slot] } });
+	}
+
+	WisdomHolmanIntegrator::advanceOrbits(system, central, mu, dt);
+	if (encounters.empty()) return;
+
+	for (const auto& [slot, state] : starts)
+	{
+		particles.x[slot] = state[0];
+		particles.y[slot] = state[1];
+		particles.vx[slot] = state[2];
+		particles.vy[slot] = state[3];
+	}
+	integrateEncounters(system, mu, dt);
+}
+
+namespace
+{
+// Dormand-Prince 5(4) tableau
+constexpr int STAGES = 7;
+constexpr double DP_C[STAGES] = { 0.0, 1.0 / 5, 3.0 / 10, 4.0 / 5, 8.0 / 9, 1.0, 1.0 };
+constexpr double DP_A[STAGES][STAGES] = {
+	{},
+	{ 1.0 / 5 },
+	{ 3.0 / 40, 9.0 / 40 },
+	{ 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+	{ 19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729 },
+	{ 9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656 },
+	{ 35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84 }
+};
+// Fifth order weights, and their difference from the embedded fourth order ones
+constexpr double DP_B[STAGES] = { 35.0 / 384, 0.0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0.0 };
+constexpr double DP_E[STAGES] = { 71.0 / 57600, 0.0, -71.0 / 16695, 71.0 / 1920, -17253.0 / 339200, 22.0 / 525, -1.0 / 40 };
+}
+
+void HybridIntegrator::integrateEncounters(ParticleSystem& system, double mu, double dt)
+{
+	ParticleStore& particles = system.getStore();
+
+	// Bodies of the encounters, and the pairs by their index among those
+	std::vector<uint32_t> bodies;
+	for (const Encounter& encounter : encounters)
+	{
+		bodies.push_back(encounter.body);
+		bodies.push_back(encounter.big);
+	}
+	std::sort(bodies.begin(), bodies.end());
+	bodies.erase(std::unique(bodies.begin(), bodies.end()), bodies.end());
+	auto indexOf = [&](uint32_t slot) {
+		return std::lower_bound(bodies.begin(), bodies.end(), slot) - bodies.begin();
+	};
+
+	const size_t count = bodies.size();
+	std::vector<double> state(4 * count);
+	for (size_t k = 0; k < count; k++)
+	{
+		const uint32_t slot = bodies[k];
+		state[4 * k] = particles.x[slot];
+		state[4 * k + 1] = particles.y[slot];
+		state[4 * k + 2] = particles.vx[slot];
+		state[4 * k + 3] = particles.vy[slot];
+	}
+
+	// Kepler motion around the central body, plus the part of each pair's interaction the kicks leave out
+	auto derivative = [&](const std::vector<double>& y, std::vector<double>& dydt) {
+		for (size_t k = 0; k < count; k++)
+		{
+			const double x = y[4 * k];
+			const double yPosition = y[4 * k + 1];
+			const double r = std::hypot(x, yPosition);
+			const double scale = -mu / (r * r * r);
+			dydt[4 * k] = y[4 * k + 2];
+			dydt[4 * k + 1] = y[4 * k + 3];
+			dydt[4 * k + 2] = scale * x;
+			dydt[4 * k + 3] = scale * yPosition;
+		}
+		for (const Encounter& encounter : encounters)
+		{
+			const size_t a = indexOf(encounter.body);
+			const size_t b = indexOf(encounter.big);
+			const double dx = y[4 * b] - y[4 * a];
+			const double dy = y[4 * b + 1] - y[4 * a + 1];
+			const double distance = std::hypot(dx, dy);
+			if (distance < QuadTreeNode::MIN_DISTANCE) continue;
+
+			const double weight = 1.0 - changeover(distance, encounter.changeoverRadius);
+			const double scale = weight * constants::G / (distance * distance * distance);
+			dydt[4 * a + 2] += scale * particles.mass[encounter.big] * dx;
+			dydt[4 * a + 3] += scale * particles.mass[encounter.big] * dy;
+			dydt[4 * b + 2] -= scale * particles.mass[encounter.body] * dx;
+			dydt[4 * b + 3] -= scale * particles.mass[encounter.body] * dy;
+		}
+	};
+
+	std::array<std::vector<double>, STAGES> k;
+	for (std::vector<double>& stage : k)
+		stage.resize(state.size());
+	std::vector<double> trial(state.size());
+
+	// A body that ends up on the central one would otherwise stall the loop
+	const double minStep = dt * 1e-12;
+	double time = 0.0;
+	double h = dt / 16.0;
+	while (time < dt)
+	{
+		h = std::min(h, dt - time);
+		for (int stage = 0; stage < STAGES; stage++)
+		{
+			for (size_t i = 0; i < state.size(); i++)
+			{
+				double sum = 0.0;
+				for (int j = 0; j < stage; j++)
+					sum += DP_A[stage][j] * k[j][i];
+				trial[i] = state[i] + h * sum;
+			}
+			derivative(trial, k[stage]);
+		}
+
+		// Error of each body's position and velocity relative to their size
+		double error = 0.0;
+		for (size_t body = 0; body < count; body++)
+		{
+			for (size_t part = 0; part < 4; part += 2)
+			{
+				const size_t i = 4 * body + part;
+				double deltaX = 0.0;
+				double deltaY = 0.0;
+				for (int stage = 0; stage < STAGES; stage++)
+				{
+					deltaX += DP_E[stage] * k[stage][i];
+					deltaY += DP_E[stage] * k[stage][i + 1];
+				}
+				const double size = std::max(std::hypot(state[i], state[i + 1]), std::numeric_limits<double>::min());
+				error = std::max(error, h * std::hypot(deltaX, deltaY) / (settings.tolerance * size));
+			}
+		}
+
+		if (error <= 1.0 || h <= minStep)
+		{
+			for (size_t i = 0; i < state.size(); i++)
+			{
+				double sum = 0.0;
+				for (int stage = 0; stage < STAGES; stage++)
+					sum += DP_B[stage] * k[stage][i];
+				state[i] += h * sum;
+			}
+			time += h;
+		}
+
+		// Usual step size control for a fourth order error estimate
+		const double factor = error > 0.0 ? 0.9 * std::pow(error, -0.2) : 5.0;
+		h = std::max(h * (std::isfinite(factor) ? std::clamp(factor, 0.2, 5.0) : 0.2), minStep);
+	}
+
+	for (size_t body = 0; body < count; body++)
+	{
+		const uint32_t slot = bodies[body];
+		particles.x[slot] = state[4 * body];
+		particles.y[slot] = state[4 * body + 1];
+		particles.vx[slot] = state[4 * body + 2];
+		particles.vy[slot] = state[4 * body + 3];
+	}
+}
+
+void HybridIntegrator::setSettings(const HybridSettings& settings)
+{
+	this->settings = settings;
+	reset();
+}
+
+const HybridSettings& HybridIntegrator::getSettings() const
+{
+	return settings;
+}
+
+size_t HybridIntegrator::getEncounterCount() const
+{
+	return encounterCount;
+}
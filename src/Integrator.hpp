@@ -0,0 +1,310 @@
+#pragma once
+#include "Eigen/Dense"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class ParticleSystem; // Forward declaration
+
+enum class IntegratorType
+{
+	// First order, one force calculation per step; kept for comparison
+	Euler,
+	// Second order symplectic kick-drift-kick, one force calculation per step
+	Leapfrog,
+	// Fourth order composition of three leapfrog steps (Yoshida 1990), three force calculations per step
+	Yoshida4,
+	// Mixed-variable symplectic, Kepler orbits around the most massive body solved exactly
+	WisdomHolman,
+	// Wisdom-Holman with close encounters handed to an adaptive integrator
+	Hybrid,
+	// Leapfrog with power of two steps per particle, forces only for the particles due
+	BlockTimesteps,
+	// Leapfrog on the pull of the dominant bodies, with the swarm's self-gravity kicked in
+	// every few steps (multiple time stepping)
+	Respa
+};
+
+struct BlockTimestepSettings
+{
+	// Deepest level; the shortest step is dt / 2^maxLevel
+	int maxLevel = 6;
+
+	// A particle wants steps of at most eta |a| / |da/dt|, a fraction of the time its
+	// acceleration takes to change
+	double eta = 0.05;
+};
+
+// One slow force level of the multiple time stepping integrator
+struct RespaLevel
+{
+	// Kicks of this level are this many steps of the next faster level apart
+	int ratio = 8;
+
+	// Swarm bodies of at least this mass are sources on this level, unless a faster level
+	// took them; the slowest level takes the rest
+	double minMass = 0.0;
+};
+
+struct RespaSettings
+{
+	// Bodies with at least this fraction of the total mass are dominant. Their pull on every
+	// particle is the fast force, summed directly at every step.
+	double dominantMassFraction = 1e-7;
+
+	// Slow levels from the fastest to the slowest, each evaluated by the selected force solver
+	std::vector<RespaLevel> levels = { RespaLevel() };
+};
+
+// Global step control from the dynamical times of the particles, see ParticleSystem::getAdaptiveTimestep
+struct TimestepSettings
+{
+	// Fraction of the shortest dynamical time taken as the step; 0.01 is about 600 steps per orbit
+	double eta = 0.01;
+
+	// Bounds on the step in seconds
+	double minStep = 60.0 * 60.0;
+	double maxStep = 60.0 * 60.0 * 24.0 * 30.0;
+};
+
+// Shortest dynamical times over all particles, relative to the barycenter, at the last full
+// force calculation. Infinite while unknown.
+struct TimestepEstimate
+{
+	// sqrt(r / |a|), the time to fall a distance comparable to the distance from the barycenter
+	double freeFallTime = std::numeric_limits<double>::infinity();
+
+	// r / |v|, the time to cross the distance from the barycenter
+	double crossingTime = std::numeric_limits<double>::infinity();
+};
+
+struct HybridSettings
+{
+	// Bodies of at least this fraction of the central mass are big. Every body can have an
+	// encounter with a big one; two small bodies never do.
+	double bigMassFraction = 1e-7;
+
+	// The changeover radius of a big body is the larger of this many Hill radii and the
+	// distance it covers at this fraction of its speed in one step (Chambers 1999)
+	double hillRadii = 3.0;
+	double stepDistance = 0.4;
+
+	// Relative error allowed per substep of the encounter integrator
+	double tolerance = 1e-12;
+};
+
+// Advances a particle system by one step, asking it for forces when the scheme needs them
+class Integrator
+{
+public:
+	virtual ~Integrator() = default;
+
+	virtual void step(ParticleSystem& system, double dt) = 0;
+
+	// Forget everything derived from earlier states, called when particles are added or
+	// removed, or moved by something else
+	virtual void reset() {}
+};
+
+// Semi-implicit Euler: forces at the current positions, then velocities, then positions
+class EulerIntegrator : public Integrator
+{
+public:
+	void step(ParticleSystem& system, double dt) override;
+};
+
+// Kick-drift-kick leapfrog. The accelerations of the closing kick are those at the start of
+// the next step, so after the first step every step takes a single force calculation.
+// Symplectic and time reversible, so the energy error stays bounded over long runs.
+class LeapfrogIntegrator : public Integrator
+{
+private:
+	// Whether the accelerations stored with the particles belong to their current positions
+	bool accelerationsCurrent = false;
+
+public:
+	void step(ParticleSystem& system, double dt) override;
+	void reset() override;
+};
+
+// Three leapfrog steps of w1 dt, w0 dt and w1 dt, which cancel the third order error terms
+class Yoshida4Integrator : public LeapfrogIntegrator
+{
+public:
+	static inline const double W1 = 1.0 / (2.0 - std::cbrt(2.0));
+	static inline const double W0 = 1.0 - 2.0 * W1;
+
+	void step(ParticleSystem& system, double dt) override;
+};
+
+// Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison & Lee 1998).
+// Positions are taken relative to the most massive body and velocities relative to the
+// barycenter, which splits the Hamiltonian into Kepler orbits around the central body,
+// solved exactly, the interactions between the other bodies, applied as kicks, and a
+// linear drift from the central body's motion. The step can be a sizeable fraction of an
+// orbital period, as long as no two bodies come close to each other.
+class WisdomHolmanIntegrator : public Integrator
+{
+private:
+	// Whether the stored accelerations are the interactions at the current positions
+	bool accelerationsCurrent = false;
+
+	// Accelerations of the whole system, for the step estimate
+	std::vector<Eigen::Vector2d> totalAccelerations;
+
+	// Move every body by dt * (sum of m v of the others) / M_central. The central body's slot
+	// moves too; it carries no coordinate of its own here and is placed again at the end of the step.
+	void jump(ParticleSystem& system, size_t central, double dt);
+
+	// Dynamical times from the last interactions with the central body's pull added back, in
+	// barycentric coordinates, since the force calculation never sees the whole system
+	void estimateTimestep(ParticleSystem& system, size_t central);
+
+protected:
+	// Interaction forces without the central body, which the Kepler drift handles, left in
+	// the particles' force arrays. Returns the central body's slot afterwards.
+	virtual size_t calculateInteractions(ParticleSystem& system, size_t central);
+
+	// Move every body but the central one along its orbit around the central body, which
+	// has gravitational parameter mu, for dt
+	virtual void advanceOrbits(ParticleSystem& system, size_t central, double mu, double dt);
+
+public:
+	void step(ParticleSystem& system, double dt) override;
+	void reset() override;
+};
+
+// Kick-drift-kick leapfrog with hierarchical block timesteps. A step of dt is cut into
+// 2^maxLevel ticks; a particle on level k is kicked every 2^(maxLevel - k) ticks, and only the
+// particles due get their forces calculated, while every particle drifts each tick so the
+// sources are in the right place. Levels follow each particle's acceleration and jerk; a
+// particle may move to a longer step only where that step's boundaries line up with the
+// current tick. All particles are synchronized at the end of every step.
+class BlockTimestepIntegrator : public Integrator
+{
+private:
+	BlockTimestepSettings settings;
+
+	// Whether the stored accelerations and levels belong to the current positions
+	bool accelerationsCurrent = false;
+
+	// Level whose step fits the criterion, between minLevel and maxLevel
+	int chooseLevel(double acceleration, double jerk, double dt, int minLevel) const;
+
+public:
+	// Block timestep levels are stored in a byte
+	static constexpr int MAX_LEVEL = 30;
+
+	void step(ParticleSystem& system, double dt) override;
+	void reset() override;
+
+	void setSettings(const BlockTimestepSettings& settings);
+	const BlockTimestepSettings& getSettings() const;
+};
+
+// Impulse multiple time stepping (r-RESPA, Tuckerman, Berne & Martyna 1992). Every step is a
+// kick-drift-kick leapfrog on the fast force of the dominant bodies. The slow forces of the
+// swarm act as impulses: level k kicks by half its period at the start and the end of every
+// ratio_1 * ... * ratio_k steps, calculated once per period, which keeps the scheme
+// symplectic. Velocities are synchronized whenever every level closes its period; steps
+// within a period should all have the same dt.
+class RespaIntegrator : public Integrator
+{
+private:
+	RespaSettings settings;
+
+	// Steps since the last reset, which tell when each level is due
+	uint64_t stepCount = 0;
+
+	// Whether the fast accelerations stored with the particles belong to their current positions
+	bool accelerationsCurrent = false;
+
+	// Accelerations of each slow level at the last kick, by slot, and the ids that were in
+	// those slots. Empty while a level has none.
+	std::vector<std::vector<Eigen::Vector2d>> slowAccelerations;
+	std::vector<int> slowIds;
+
+	// Dominant bodies gathered for the direct sum, and masses put aside while sources are hidden
+	std::vector<double> dominantX;
+	std::vector<double> dominantY;
+	std::vector<double> dominantMass;
+	std::vector<double> savedMass;
+
+	// Mass at and above which a body is dominant
+	double findDominantMass(const ParticleSystem& system) const;
+
+	// Slow level whose sources include a swarm body of this mass
+	size_t findLevel(double mass) const;
+
+	void calculateFastAccelerations(ParticleSystem& system);
+	void calculateSlowAccelerations(ParticleSystem& system, size_t level);
+	void kickSlow(ParticleSystem& system, size_t level, double dt);
+
+	// Steps between two kicks of a slow level
+	uint64_t getPeriod(size_t level) const;
+
+public:
+	void step(ParticleSystem& system, double dt) override;
+	void reset() override;
+
+	void setSettings(const RespaSettings& settings);
+	const RespaSettings& getSettings() const;
+};
+
+// Hybrid symplectic integrator after MERCURY (Chambers 1999). The interaction between a big
+// body and any other body is split by a smooth changeover function K(r), which is 1 beyond
+// the pair's changeover radius and falls to 0 at a tenth of it. The K part is kicked as in the
+// Wisdom-Holman map; the rest joins the Kepler part, which bodies in an encounter during
+// the step advance together with an adaptive Dormand-Prince integrator. Everyone else keeps
+// the exact Kepler drift, so the step can stay long while only the encountering bodies pay.
+class HybridIntegrator : public WisdomHolmanIntegrator
+{
+private:
+	// Pair of slots within their changeover radius
+	struct Encounter
+	{
+		uint32_t body;
+		uint32_t big;
+		double changeoverRadius;
+	};
+
+	HybridSettings settings;
+
+	// Step being taken, which the changeover radii depend on
+	double stepSize = 0.0;
+
+	// Changeover radius of every slot, 0 for small bodies, and the big slots
+	std::vector<double> changeoverRadii;
+	std::vector<uint32_t> bigBodies;
+
+	std::vector<Encounter> encounters;
+	size_t encounterCount = 0;
+
+	void findBigBodies(ParticleSystem& system, size_t central);
+
+	// Pairs that come within their changeover radius while moving on straight lines for lookahead
+	void findEncounters(ParticleSystem& system, size_t central, double lookahead);
+
+	// Advance the bodies of the encounters along their orbits and the unkicked part of their
+	// interactions
+	void integrateEncounters(ParticleSystem& system, double mu, double dt);
+
+protected:
+	size_t calculateInteractions(ParticleSystem& system, size_t central) override;
+	void advanceOrbits(ParticleSystem& system, size_t central, double mu, double dt) override;
+
+public:
+	// Part of a pair's interaction kicked in the Wisdom-Holman map, 10y^3 - 15y^4 + 6y^5 with
+	// y = (r - 0.1 r_c) / 0.9 r_c clamped to [0, 1]
+	static double changeover(double distance, double changeoverRadius);
+
+	void step(ParticleSystem& system, double dt) override;
+
+	void setSettings(const HybridSettings& settings);
+	const HybridSettings& getSettings() const;
+
+	// Pairs integrated as encounters during the last step
+	size_t getEncounterCount() const;
+};
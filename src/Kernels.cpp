@@ -0,0 +1,538 @@
+#include "Kernels.hpp"
+#include "utils.hpp"
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+	#include <immintrin.h>
+#endif
+
+void kernels::accumulateAcceleration(double x, double y,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double& ax, double& ay)
+{
+	const double minDistanceSquared = minDistance * minDistance;
+	double sumX = 0.0;
+	double sumY = 0.0;
+	size_t j = 0;
+
+#if defined(__AVX512F__)
+	const __m512d px = _mm512_set1_pd(x);
+	const __m512d py = _mm512_set1_pd(y);
+	const __m512d minR2 = _mm512_set1_pd(minDistanceSquared);
+	__m512d accX = _mm512_setzero_pd();
+	__m512d accY = _mm512_setzero_pd();
+	for (; j + 8 <= sourceCount; j += 8)
+	{
+		__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(sourceX + j), px);
+		__m512d dy = _mm512_sub_pd(_mm512_loadu_pd(sourceY + j), py);
+		__m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+		__mmask8 near = _mm512_cmp_pd_mask(r2, minR2, _CMP_LT_OQ);
+
+		// m / r^3, zeroed for skipped sources
+		__m512d r = _mm512_sqrt_pd(r2);
+		__m512d scale = _mm512_div_pd(_mm512_loadu_pd(sourceMass + j), _mm512_mul_pd(r2, r));
+		scale = _mm512_mask_blend_pd(near, scale, _mm512_setzero_pd());
+
+		accX = _mm512_fmadd_pd(scale, dx, accX);
+		accY = _mm512_fmadd_pd(scale, dy, accY);
+	}
+	sumX += _mm512_reduce_add_pd(accX);
+	sumY += _mm512_reduce_add_pd(accY);
+#elif defined(__AVX2__)
+	const __m256d px = _mm256_set1_pd(x);
+	const __m256d py = _mm256_set1_pd(y);
+	const __m256d minR2 = _mm256_set1_pd(minDistanceSquared);
+	__m256d accX = _mm256_setzero_pd();
+	__m256d accY = _mm256_setzero_pd();
+	for (; j + 4 <= sourceCount; j += 4)
+	{
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(sourceX + j), px);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(sourceY + j), py);
+		__m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+		__m256d far = _mm256_cmp_pd(r2, minR2, _CMP_GE_OQ);
+
+		// m / r^3, zeroed for skipped sources
+		__m256d r = _mm256_sqrt_pd(r2);
+		__m256d scale = _mm256_div_pd(_mm256_loadu_pd(sourceMass + j), _mm256_mul_pd(r2, r));
+		scale = _mm256_and_pd(scale, far);
+
+		accX = _mm256_add_pd(accX, _mm256_mul_pd(scale, dx));
+		accY = _mm256_add_pd(accY, _mm256_mul_pd(scale, dy));
+	}
+	double laneX[4];
+	double laneY[4];
+	_mm256_storeu_pd(laneX, accX);
+	_mm256_storeu_pd(laneY, accY);
+	sumX += (laneX[0] + laneX[1]) + (laneX[2] + laneX[3]);
+	sumY += (laneY[0] + laneY[1]) + (laneY[2] + laneY[3]);
+#endif
+
+	// Remainder, or everything without SIMD. Branch-free so the compiler can vectorize it.
+	for (; j < sourceCount; j++)
+	{
+		double dx = sourceX[j] - x;
+		double dy = sourceY[j] - y;
+		double r2 = dx * dx + dy * dy;
+		double scale = r2 < minDistanceSquared ? 0.0 : sourceMass[j] / (r2 * std::sqrt(r2));
+		sumX += scale * dx;
+		sumY += scale * dy;
+	}
+
+	ax += constants::G * sumX;
+	ay += constants::G * sumY;
+}
+
+void kernels::accumulateAccelerations(const double* targetX, const double* targetY, size_t targetCount,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double* targetAx, double* targetAy)
+{
+	// Meant for many targets and few sources, such as test particles around the massive
+	// bodies, so the inner loop runs over the targets. It has no branches and the compiler
+	// vectorizes it on its own.
+	const double minDistanceSquared = minDistance * minDistance;
+	for (size_t j = 0; j < sourceCount; j++)
+	{
+		const double x = sourceX[j];
+		const double y = sourceY[j];
+		const double gm = constants::G * sourceMass[j];
+		for (size_t i = 0; i < targetCount; i++)
+		{
+			double dx = x - targetX[i];
+			double dy = y - targetY[i];
+			double r2 = dx * dx + dy * dy;
+			double scale = r2 < minDistanceSquared ? 0.0 : gm / (r2 * std::sqrt(r2));
+			targetAx[i] += scale * dx;
+			targetAy[i] += scale * dy;
+		}
+	}
+}
+
+void kernels::accumulateMutualAcceleration(double x, double y, double mass,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double& ax, double& ay, double* sourceAx, double* sourceAy)
+{
+	const double minDistanceSquared = minDistance * minDistance;
+	double sumX = 0.0;
+	double sumY = 0.0;
+	size_t j = 0;
+
+#if defined(__AVX512F__)
+	const __m512d px = _mm512_set1_pd(x);
+	const __m512d py = _mm512_set1_pd(y);
+	const __m512d targetMass = _mm512_set1_pd(mass);
+	const __m512d g = _mm512_set1_pd(constants::G);
+	const __m512d minR2 = _mm512_set1_pd(minDistanceSquared);
+	__m512d accX = _mm512_setzero_pd();
+	__m512d accY = _mm512_setzero_pd();
+	for (; j + 8 <= sourceCount; j += 8)
+	{
+		__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(sourceX + j), px);
+		__m512d dy = _mm512_sub_pd(_mm512_loadu_pd(sourceY + j), py);
+		__m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+		__mmask8 near = _mm512_cmp_pd_mask(r2, minR2, _CMP_LT_OQ);
+
+		// G / r^3, zeroed for skipped sources
+		__m512d r = _mm512_sqrt_pd(r2);
+		__m512d w = _mm512_div_pd(g, _mm512_mul_pd(r2, r));
+		w = _mm512_mask_blend_pd(near, w, _mm512_setzero_pd());
+
+		__m512d pull = _mm512_mul_pd(w, _mm512_loadu_pd(sourceMass + j));
+		accX = _mm512_fmadd_pd(pull, dx, accX);
+		accY = _mm512_fmadd_pd(pull, dy, accY);
+
+		__m512d reaction = _mm512_mul_pd(w, targetMass);
+		_mm512_storeu_pd(sourceAx + j, _mm512_fnmadd_pd(reaction, dx, _mm512_loadu_pd(sourceAx + j)));
+		_mm512_storeu_pd(sourceAy + j, _mm512_fnmadd_pd(reaction, dy, _mm512_loadu_pd(sourceAy + j)));
+	}
+	sumX += _mm512_reduce_add_pd(accX);
+	sumY += _mm512_reduce_add_pd(accY);
+#elif defined(__AVX2__)
+	const __m256d px = _mm256_set1_pd(x);
+	const __m256d py = _mm256_set1_pd(y);
+	const __m256d targetMass = _mm256_set1_pd(mass);
+	const __m256d g = _mm256_set1_pd(constants::G);
+	const __m256d minR2 = _mm256_set1_pd(minDistanceSquared);
+	__m256d accX = _mm256_setzero_pd();
+	__m256d accY = _mm256_setzero_pd();
+	for (; j + 4 <= sourceCount; j += 4)
+	{
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(sourceX + j), px);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(sourceY + j), py);
+		__m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+		__m256d far = _mm256_cmp_pd(r2, minR2, _CMP_GE_OQ);
+
+		// G / r^3, zeroed for skipped sources
+		__m256d r = _mm256_sqrt_pd(r2);
+		__m256d w = _mm256_div_pd(g, _mm256_mul_pd(r2, r));
+		w = _mm256_and_pd(w, far);
+
+		__m256d pull = _mm256_mul_pd(w, _mm256_loadu_pd(sourceMass + j));
+		accX = _mm256_add_pd(accX, _mm256_mul_pd(pull, dx));
+		accY = _mm256_add_pd(accY, _mm256_mul_pd(pull, dy));
+
+		__m256d reaction = _mm256_mul_pd(w, targetMass);
+		_mm256_storeu_pd(sourceAx + j, _mm256_sub_pd(_mm256_loadu_pd(sourceAx + j), _mm256_mul_pd(reaction, dx)));
+		_mm256_storeu_pd(sourceAy + j, _mm256_sub_pd(_mm256_loadu_pd(sourceAy + j), _mm256_mul_pd(reaction, dy)));
+	}
+	double laneX[4];
+	double laneY[4];
+	_mm256_storeu_pd(laneX, accX);
+	_mm256_storeu_pd(laneY, accY);
+	sumX += (laneX[0] + laneX[1]) + (laneX[2] + laneX[3]);
+	sumY += (laneY[0] + laneY[1]) + (laneY[2] + laneY[3]);
+#endif
+
+	for (; j < sourceCount; j++)
+	{
+		double dx = sourceX[j] - x;
+		double dy = sourceY[j] - y;
+		double r2 = dx * dx + dy * dy;
+		double w = r2 < minDistanceSquared ? 0.0 : constants::G / (r2 * std::sqrt(r2));
+		sumX += w * sourceMass[j] * dx;
+		sumY += w * sourceMass[j] * dy;
+		sourceAx[j] -= w * mass * dx;
+		sourceAy[j] -= w * mass * dy;
+	}
+
+	ax += sumX;
+	ay += sumY;
+}
+
+void kernels::accumulateCellAcceleration(double x, double y, const CellList& cells, double& ax, double& ay)
+{
+	// With R the offset from the cell to the target and t the offset of a body from the
+	// cell's center, expanding 1/|R - t| gives
+	//   a = G (M grad(1/r) + 1/2 Q : grad^3(1/r) - 1/6 O : grad^4(1/r))
+	// The dipole term vanishes about the center of mass.
+	double sumX = 0.0;
+	double sumY = 0.0;
+	size_t j = 0;
+
+#if defined(__AVX512F__)
+	const __m512d px = _mm512_set1_pd(x);
+	const __m512d py = _mm512_set1_pd(y);
+	const __m512d one = _mm512_set1_pd(1.0);
+	const __m512d half = _mm512_set1_pd(0.5);
+	const __m512d three = _mm512_set1_pd(3.0);
+	const __m512d fifteen = _mm512_set1_pd(15.0);
+	__m512d accX = _mm512_setzero_pd();
+	__m512d accY = _mm512_setzero_pd();
+	for (; j + 8 <= cells.count; j += 8)
+	{
+		__m512d rx = _mm512_sub_pd(px, _mm512_loadu_pd(cells.x + j));
+		__m512d ry = _mm512_sub_pd(py, _mm512_loadu_pd(cells.y + j));
+		__m512d r2 = _mm512_fmadd_pd(rx, rx, _mm512_mul_pd(ry, ry));
+		__m512d inverseR2 = _mm512_div_pd(one, r2);
+		__m512d inverseR3 = _mm512_div_pd(inverseR2, _mm512_sqrt_pd(r2));
+		__m512d inverseR5 = _mm512_mul_pd(inverseR3, inverseR2);
+		__m512d inverseR7 = _mm512_mul_pd(inverseR5, inverseR2);
+
+		__m512d qxx = _mm512_loadu_pd(cells.qxx + j);
+		__m512d qxy = _mm512_loadu_pd(cells.qxy + j);
+		__m512d qyy = _mm512_loadu_pd(cells.qyy + j);
+		__m512d qrx = _mm512_fmadd_pd(qxx, rx, _mm512_mul_pd(qxy, ry));
+		__m512d qry = _mm512_fmadd_pd(qxy, rx, _mm512_mul_pd(qyy, ry));
+		__m512d rqr = _mm512_fmadd_pd(rx, qrx, _mm512_mul_pd(ry, qry));
+		__m512d traceQ = _mm512_add_pd(qxx, qyy);
+
+		// -M / r^3 + 3/2 tr(Q) / r^5 - 15/2 (R Q R) / r^7 along R, plus 3 Q R / r^5
+		__m512d radial = _mm512_mul_pd(_mm512_loadu_pd(cells.mass + j), inverseR3);
+		radial = _mm512_fmsub_pd(_mm512_mul_pd(half, _mm512_mul_pd(three, traceQ)), inverseR5, radial);
+		radial = _mm512_fnmadd_pd(_mm512_mul_pd(half, _mm512_mul_pd(fifteen, rqr)), inverseR7, radial);
+		__m512d tangential = _mm512_mul_pd(three, inverseR5);
+
+		accX = _mm512_fmadd_pd(radial, rx, _mm512_fmadd_pd(tangential, qrx, accX));
+		accY = _mm512_fmadd_pd(radial, ry, _mm512_fmadd_pd(tangential, qry, accY));
+	}
+	sumX += _mm512_reduce_add_pd(accX);
+	sumY += _mm512_reduce_add_pd(accY);
+#elif defined(__AVX2__)
+	const __m256d px = _mm256_set1_pd(x);
+	const __m256d py = _mm256_set1_pd(y);
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d threeHalves = _mm256_set1_pd(1.5);
+	const __m256d fifteenHalves = _mm256_set1_pd(7.5);
+	const __m256d three = _mm256_set1_pd(3.0);
+	__m256d accX = _mm256_setzero_pd();
+	__m256d accY = _mm256_setzero_pd();
+	for (; j + 4 <= cells.count; j += 4)
+	{
+		__m256d rx = _mm256_sub_pd(px, _mm256_loadu_pd(cells.x + j));
+		__m256d ry = _mm256_sub_pd(py, _mm256_loadu_pd(cells.y + j));
+		__m256d r2 = _mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry));
+		__m256d inverseR2 = _mm256_div_pd(one, r2);
+		__m256d inverseR3 = _mm256_div_pd(inverseR2, _mm256_sqrt_pd(r2));
+		__m256d inverseR5 = _mm256_mul_pd(inverseR3, inverseR2);
+		__m256d inverseR7 = _mm256_mul_pd(inverseR5, inverseR2);
+
+		__m256d qxx = _mm256_loadu_pd(cells.qxx + j);
+		__m256d qxy = _mm256_loadu_pd(cells.qxy + j);
+		__m256d qyy = _mm256_loadu_pd(cells.qyy + j);
+		__m256d qrx = _mm256_add_pd(_mm256_mul_pd(qxx, rx), _mm256_mul_pd(qxy, ry));
+		__m256d qry = _mm256_add_pd(_mm256_mul_pd(qxy, rx), _mm256_mul_pd(qyy, ry));
+		__m256d rqr = _mm256_add_pd(_mm256_mul_pd(rx, qrx), _mm256_mul_pd(ry, qry));
+		__m256d traceQ = _mm256_add_pd(qxx, qyy);
+
+		// -M / r^3 + 3/2 tr(Q) / r^5 - 15/2 (R Q R) / r^7 along R, plus 3 Q R / r^5
+		__m256d radial = _mm256_mul_pd(_mm256_mul_pd(threeHalves, traceQ), inverseR5);
+		radial = _mm256_sub_pd(radial, _mm256_mul_pd(_mm256_loadu_pd(cells.mass + j), inverseR3));
+		radial = _mm256_sub_pd(radial, _mm256_mul_pd(_mm256_mul_pd(fifteenHalves, rqr), inverseR7));
+		__m256d tangential = _mm256_mul_pd(three, inverseR5);
+
+		accX = _mm256_add_pd(accX, _mm256_add_pd(_mm256_mul_pd(radial, rx), _mm256_mul_pd(tangential, qrx)));
+		accY = _mm256_add_pd(accY, _mm256_add_pd(_mm256_mul_pd(radial, ry), _mm256_mul_pd(tangential, qry)));
+	}
+	double laneX[4];
+	double laneY[4];
+	_mm256_storeu_pd(laneX, accX);
+	_mm256_storeu_pd(laneY, accY);
+	sumX += (laneX[0] + laneX[1]) + (laneX[2] + laneX[3]);
+	sumY += (laneY[0] + laneY[1]) + (laneY[2] + laneY[3]);
+#endif
+
+	// Remainder, or everything without SIMD
+	for (; j < cells.count; j++)
+	{
+		const double rx = x - cells.x[j];
+		const double ry = y - cells.y[j];
+		const double r2 = rx * rx + ry * ry;
+		const double inverseR2 = 1.0 / r2;
+		const double inverseR3 = inverseR2 / std::sqrt(r2);
+		const double inverseR5 = inverseR3 * inverseR2;
+		const double inverseR7 = inverseR5 * inverseR2;
+
+		// Monopole
+		double fx = -cells.mass[j] * rx * inverseR3;
+		double fy = -cells.mass[j] * ry * inverseR3;
+
+		// Quadrupole: 1/2 (3 (tr(Q) R + 2 Q R) / r^5 - 15 (R Q R) R / r^7)
+		const double qrx = cells.qxx[j] * rx + cells.qxy[j] * ry;
+		const double qry = cells.qxy[j] * rx + cells.qyy[j] * ry;
+		const double rqr = rx * qrx + ry * qry;
+		const double traceQ = cells.qxx[j] + cells.qyy[j];
+		fx += 0.5 * (3.0 * (traceQ * rx + 2.0 * qrx) * inverseR5 - 15.0 * rqr * rx * inverseR7);
+		fy += 0.5 * (3.0 * (traceQ * ry + 2.0 * qry) * inverseR5 - 15.0 * rqr * ry * inverseR7);
+
+		sumX += fx;
+		sumY += fy;
+	}
+
+	if (cells.oxxx)
+	{
+		for (j = 0; j < cells.count; j++)
+		{
+			const double rx = x - cells.x[j];
+			const double ry = y - cells.y[j];
+			const double r2 = rx * rx + ry * ry;
+			const double inverseR2 = 1.0 / r2;
+			const double inverseR5 = inverseR2 * inverseR2 / std::sqrt(r2);
+			const double inverseR7 = inverseR5 * inverseR2;
+			const double inverseR9 = inverseR7 * inverseR2;
+
+			// Octupole: -1/6 (105 O(R, R, R) R / r^9 - 45 ((v.R) R + O(R, R)) / r^7 + 9 v / r^5),
+			// where v_k = sum_i O_iik
+			const double vx = cells.oxxx[j] + cells.oxyy[j];
+			const double vy = cells.oxxy[j] + cells.oyyy[j];
+			const double orrx = cells.oxxx[j] * rx * rx + 2.0 * cells.oxxy[j] * rx * ry + cells.oxyy[j] * ry * ry;
+			const double orry = cells.oxxy[j] * rx * rx + 2.0 * cells.oxyy[j] * rx * ry + cells.oyyy[j] * ry * ry;
+			const double orrr = orrx * rx + orry * ry;
+			const double vr = vx * rx + vy * ry;
+			sumX -= (105.0 * orrr * rx * inverseR9 - 45.0 * (vr * rx + orrx) * inverseR7 + 9.0 * vx * inverseR5) / 6.0;
+			sumY -= (105.0 * orrr * ry * inverseR9 - 45.0 * (vr * ry + orry) * inverseR7 + 9.0 * vy * inverseR5) / 6.0;
+		}
+	}
+
+	ax += constants::G * sumX;
+	ay += constants::G * sumY;
+}
+
+void kernels::integrateEuler(const BodyState& bodies, double dt)
+{
+	size_t i = 0;
+
+#if defined(__AVX512F__)
+	const __m512d step = _mm512_set1_pd(dt);
+	const __m512d zero = _mm512_setzero_pd();
+	for (; i + 8 <= bodies.count; i += 8)
+	{
+		__m512d mass = _mm512_loadu_pd(bodies.mass + i);
+		__mmask8 massive = _mm512_cmp_pd_mask(mass, zero, _CMP_GT_OQ);
+		__m512d inverseMass = _mm512_div_pd(_mm512_set1_pd(1.0), mass);
+		__m512d ax = _mm512_mask_mul_pd(_mm512_loadu_pd(bodies.ax + i), massive, _mm512_loadu_pd(bodies.fx + i), inverseMass);
+		__m512d ay = _mm512_mask_mul_pd(_mm512_loadu_pd(bodies.ay + i), massive, _mm512_loadu_pd(bodies.fy + i), inverseMass);
+		__m512d vx = _mm512_fmadd_pd(ax, step, _mm512_loadu_pd(bodies.vx + i));
+		__m512d vy = _mm512_fmadd_pd(ay, step, _mm512_loadu_pd(bodies.vy + i));
+		_mm512_storeu_pd(bodies.x + i, _mm512_fmadd_pd(vx, step, _mm512_loadu_pd(bodies.x + i)));
+		_mm512_storeu_pd(bodies.y + i, _mm512_fmadd_pd(vy, step, _mm512_loadu_pd(bodies.y + i)));
+		_mm512_storeu_pd(bodies.vx + i, vx);
+		_mm512_storeu_pd(bodies.vy + i, vy);
+		_mm512_storeu_pd(bodies.ax + i, ax);
+		_mm512_storeu_pd(bodies.ay + i, ay);
+		_mm512_storeu_pd(bodies.fx + i, zero);
+		_mm512_storeu_pd(bodies.fy + i, zero);
+	}
+#elif defined(__AVX2__)
+	const __m256d step = _mm256_set1_pd(dt);
+	const __m256d zero = _mm256_setzero_pd();
+	for (; i + 4 <= bodies.count; i += 4)
+	{
+		__m256d mass = _mm256_loadu_pd(bodies.mass + i);
+		__m256d massive = _mm256_cmp_pd(mass, zero, _CMP_GT_OQ);
+		__m256d inverseMass = _mm256_div_pd(_mm256_set1_pd(1.0), mass);
+		__m256d ax = _mm256_blendv_pd(_mm256_loadu_pd(bodies.ax + i), _mm256_mul_pd(_mm256_loadu_pd(bodies.fx + i), inverseMass), massive);
+		__m256d ay = _mm256_blendv_pd(_mm256_loadu_pd(bodies.ay + i), _mm256_mul_pd(_mm256_loadu_pd(bodies.fy + i), inverseMass), massive);
+		__m256d vx = _mm256_add_pd(_mm256_loadu_pd(bodies.vx + i), _mm256_mul_pd(ax, step));
+		__m256d vy = _mm256_add_pd(_mm256_loadu_pd(bodies.vy + i), _mm256_mul_pd(ay, step));
+		_mm256_storeu_pd(bodies.x + i, _mm256_add_pd(_mm256_loadu_pd(bodies.x + i), _mm256_mul_pd(vx, step)));
+		_mm256_storeu_pd(bodies.y + i, _mm256_add_pd(_mm256_loadu_pd(bodies.y + i), _mm256_mul_pd(vy, step)));
+		_mm256_storeu_pd(bodies.vx + i, vx);
+		_mm256_storeu_pd(bodies.vy + i, vy);
+		_mm256_storeu_pd(bodies.ax + i, ax);
+		_mm256_storeu_pd(bodies.ay + i, ay);
+		_mm256_storeu_pd(bodies.fx + i, zero);
+		_mm256_storeu_pd(bodies.fy + i, zero);
+	}
+#endif
+
+	for (; i < bodies.count; i++)
+	{
+		if (bodies.mass[i] > 0.0)
+		{
+			bodies.ax[i] = bodies.fx[i] / bodies.mass[i];
+			bodies.ay[i] = bodies.fy[i] / bodies.mass[i];
+		}
+		bodies.vx[i] += bodies.ax[i] * dt;
+		bodies.vy[i] += bodies.ay[i] * dt;
+		bodies.x[i] += bodies.vx[i] * dt;
+		bodies.y[i] += bodies.vy[i] * dt;
+		bodies.fx[i] = 0.0;
+		bodies.fy[i] = 0.0;
+	}
+}
+
+// The leapfrog parts each stream through a few arrays without any branches,
+// which the compiler vectorizes on its own
+
+void kernels::drift(const BodyState& bodies, double dt)
+{
+	for (size_t i = 0; i < bodies.count; i++)
+	{
+		bodies.x[i] += bodies.vx[i] * dt;
+		bodies.y[i] += bodies.vy[i] * dt;
+	}
+}
+
+void kernels::kick(const BodyState& bodies, double dt)
+{
+	for (size_t i = 0; i < bodies.count; i++)
+	{
+		bodies.vx[i] += bodies.ax[i] * dt;
+		bodies.vy[i] += bodies.ay[i] * dt;
+	}
+}
+
+void kernels::kickFromForces(const BodyState& bodies, double dt)
+{
+	for (size_t i = 0; i < bodies.count; i++)
+	{
+		if (bodies.mass[i] > 0.0)
+		{
+			bodies.ax[i] = bodies.fx[i] / bodies.mass[i];
+			bodies.ay[i] = bodies.fy[i] / bodies.mass[i];
+		}
+		bodies.vx[i] += bodies.ax[i] * dt;
+		bodies.vy[i] += bodies.ay[i] * dt;
+		bodies.fx[i] = 0.0;
+		bodies.fy[i] = 0.0;
+	}
+}
+
+namespace
+{
+// Stumpff functions c2(z) = (1 - cos sqrt z) / z and c3(z) = (sqrt z - sin sqrt z) / sqrt z^3,
+// continued to negative z through cosh and sinh
+void stumpff(double z, double& c2, double& c3)
+{
+	// Both closed forms cancel badly near zero, where the series converge fast
+	if (std::abs(z) < 0.1)
+	{
+		c2 = 1.0 / 2 - z * (1.0 / 24 - z * (1.0 / 720 - z * (1.0 / 40320 - z / 3628800)));
+		c3 = 1.0 / 6 - z * (1.0 / 120 - z * (1.0 / 5040 - z * (1.0 / 362880 - z / 39916800)));
+	}
+	else if (z > 0.0)
+	{
+		double s = std::sqrt(z);
+		c2 = (1.0 - std::cos(s)) / z;
+		c3 = (s - std::sin(s)) / (z * s);
+	}
+	else
+	{
+		double s = std::sqrt(-z);
+		c2 = (std::cosh(s) - 1.0) / -z;
+		c3 = (std::sinh(s) - s) / (-z * s);
+	}
+}
+}
+
+void kernels::keplerDrift(double* x, double* y, double* vx, double* vy, size_t count, double mu, double dt)
+{
+	constexpr int MAX_ITERATIONS = 50;
+	const double sqrtMu = std::sqrt(mu);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const double r0 = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+		const double v0Squared = vx[i] * vx[i] + vy[i] * vy[i];
+		const double sigma0 = (x[i] * vx[i] + y[i] * vy[i]) / sqrtMu;
+
+		// Inverse semi-major axis, negative for hyperbolic orbits
+		const double alpha = 2.0 / r0 - v0Squared / mu;
+
+		// Solve the universal Kepler equation F(chi) = sqrt(mu) dt with Laguerre-Conway
+		// iterations, which converge from any starting point
+		double chi = sqrtMu * dt / r0;
+		if (alpha > 0.0)
+			chi = sqrtMu * dt * alpha;
+
+		double c2 = 0.5;
+		double c3 = 1.0 / 6.0;
+		for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++)
+		{
+			const double chiSquared = chi * chi;
+			const double z = alpha * chiSquared;
+			stumpff(z, c2, c3);
+
+			const double f = sigma0 * chiSquared * c2 + (1.0 - alpha * r0) * chiSquared * chi * c3 + r0 * chi - sqrtMu * dt;
+			const double df = sigma0 * chi * (1.0 - z * c3) + (1.0 - alpha * r0) * chiSquared * c2 + r0;
+			const double ddf = sigma0 * (1.0 - z * c2) + (1.0 - alpha * r0) * chi * (1.0 - z * c3);
+
+			constexpr double n = 5.0;
+			const double root = std::sqrt(std::abs((n - 1.0) * (n - 1.0) * df * df - n * (n - 1.0) * f * ddf));
+			const double delta = n * f / (df + (df >= 0.0 ? root : -root));
+			chi -= delta;
+			if (std::abs(delta) <= 4.0 * std::numeric_limits<double>::epsilon() * std::abs(chi))
+				break;
+		}
+
+		const double chiSquared = chi * chi;
+		const double z = alpha * chiSquared;
+		stumpff(z, c2, c3);
+
+		// Lagrange coefficients
+		const double f = 1.0 - chiSquared / r0 * c2;
+		const double g = dt - chiSquared * chi / sqrtMu * c3;
+		const double newX = f * x[i] + g * vx[i];
+		const double newY = f * y[i] + g * vy[i];
+		const double r = std::sqrt(newX * newX + newY * newY);
+		const double df = sqrtMu / (r * r0) * chi * (z * c3 - 1.0);
+		const double dg = 1.0 - chiSquared / r * c2;
+
+		const double newVx = df * x[i] + dg * vx[i];
+		const double newVy = df * y[i] + dg * vy[i];
+		x[i] = newX;
+		y[i] = newY;
+		vx[i] = newVx;
+		vy[i] = newVy;
+	}
+}
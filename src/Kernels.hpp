@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+
+// Vectorized gravity kernels over structure-of-arrays source lists.
+// Sources closer than minDistance to the target are skipped, which removes self-interaction.
+// Integration kernels advance a run of bodies in one pass over their arrays.
+namespace kernels
+{
+// Cells in structure-of-arrays layout with their moments about the center of mass (x, y).
+// quadrupole: sum m t_i t_j as xx, xy, yy; octupole: sum m t_i t_j t_k as xxx, xxy, xyy, yyy.
+// The octupole pointers may be null, then only the monopole and quadrupole terms are used.
+struct CellList
+{
+	const double* x;
+	const double* y;
+	const double* mass;
+	const double* qxx;
+	const double* qxy;
+	const double* qyy;
+	const double* oxxx;
+	const double* oxxy;
+	const double* oxyy;
+	const double* oyyy;
+	size_t count;
+};
+
+// A run of bodies in structure-of-arrays layout, as stored by ParticleStore
+struct BodyState
+{
+	double* x;
+	double* y;
+	double* vx;
+	double* vy;
+	double* ax;
+	double* ay;
+	double* fx;
+	double* fy;
+	const double* mass;
+	size_t count;
+};
+
+// Add the acceleration G * m_j * (r_j - r) / |r_j - r|^3 of every source j at (x, y) to (ax, ay)
+void accumulateAcceleration(double x, double y,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double& ax, double& ay);
+
+// Same as above for every target in [0, targetCount), adding into targetAx/targetAy.
+// Vectorized over the targets, for many targets and few sources.
+void accumulateAccelerations(const double* targetX, const double* targetY, size_t targetCount,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double* targetAx, double* targetAy);
+
+// Add the acceleration of every cell's multipole expansion at (x, y) to (ax, ay).
+// Cells are far from the target, so there is no minimum distance.
+void accumulateCellAcceleration(double x, double y, const CellList& cells, double& ax, double& ay);
+
+// Newton's third law in one pass: add the acceleration of every source j on the target of
+// the given mass to (ax, ay), and subtract the target's pull on each source from sourceAx[j], sourceAy[j]
+void accumulateMutualAcceleration(double x, double y, double mass,
+	const double* sourceX, const double* sourceY, const double* sourceMass, size_t sourceCount,
+	double minDistance, double& ax, double& ay, double* sourceAx, double* sourceAy);
+
+// Semi-implicit Euler step in a single sweep: a = f / m, v += a dt, r += v dt, then f = 0.
+// A massless body has no force to carry its acceleration, it keeps the a it was given.
+void integrateEuler(const BodyState& bodies, double dt);
+
+// Leapfrog parts: the drift r += v dt, the kick v += a dt, and the kick right after a
+// force calculation, which first takes a = f / m (as above) and clears f
+void drift(const BodyState& bodies, double dt);
+void kick(const BodyState& bodies, double dt);
+void kickFromForces(const BodyState& bodies, double dt);
+
+// Move every body along its Kepler orbit around a fixed mass at the origin with
+// gravitational parameter mu = G M, for time dt. Positions and velocities are relative to
+// that mass. Universal variables, so elliptic, parabolic and hyperbolic orbits all work.
+void keplerDrift(double* x, double* y, double* vx, double* vy, size_t count, double mu, double dt);
+}
@@ -1,5 +1,8 @@
 #include "Objects.hpp"
 #include "Platform/Platform.hpp"
+#include "Scenario.hpp"
+#include "SimulationThread.hpp"
+#include "Viewer.hpp"
 #include "utils.hpp"
 #include <algorithm>
 #include <iostream>
@@ -7,36 +10,6 @@
 const float WINDOW_WIDTH = 800.0f;
 const float WINDOW_HEIGHT = 600.0f;
 
-ParticleSystem initializeSimulation()
-{
-	Particle sun = Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d(0.0f, 0.0f), Eigen::Vector2d(0.0f, 0.0f));
-	sun.setColor(sf::Color::Yellow);
-	sun.setMinimumRenderRadius(10);
-
-	Particle jupiter = Particle(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0f), Eigen::Vector2d(0.0f, 13070.0f));
-	jupiter.setColor(sf::Color::Red);
-
-	ParticleSystem particleSystem;
-	particleSystem.addParticle(sun);
-	particleSystem.addParticle(jupiter);
-
-	// Scatter particles along jupiter's orbit
-	int numParticles = 100;
-	for (int i = 0; i < numParticles; i++)
-	{
-		Eigen::Vector2d position = Eigen::Vector2d(constants::jupiterOrbitRadius + 1e9, 0.0f);
-		Eigen::Vector2d velocity = Eigen::Vector2d(0.0f, 13070.0f);
-		position = Eigen::Rotation2Dd(i * 2 * M_PI / numParticles + .1) * position;
-		velocity = Eigen::Rotation2Dd(i * 2 * M_PI / numParticles + .1) * velocity;
-		Particle particle = Particle(1.0f, (double)1.0f, position, velocity);
-		particle.setMinimumRenderRadius(2);
-		particle.setColor(sf::Color::White);
-		particleSystem.addParticle(particle);
-	}
-
-	return particleSystem;
-}
-
 int main()
 {
 	util::Platform platform;
@@ -77,7 +50,19 @@ int main()
 	// End of SFML setup
 
 	GUI gui;
-	ParticleSystem particleSystem = initializeSimulation();
+
+	// Timing variables
+	const int FRAME_RATE = 30;
+	const int TICK_RATE = 60;
+	const int TIME_SCALE = 60 * 60 * 24 * 365; // 50 years per second
+
+	SimulationThread simulation([] {
+		ParticleSystem particleSystem = makeJupiterScenario(ScenarioSettings());
+
+		// Time both force solvers now rather than in the middle of the first tick
+		std::cout << "Using direct summation below " << particleSystem.getDirectSumCrossover() << " particles" << std::endl;
+		return particleSystem;
+	}, TIME_SCALE, TICK_RATE);
 
 	// Create a view with the same size as the window
 	float initialViewScale = 1e10;
@@ -89,22 +74,24 @@ int main()
 	bool panning = false;
 	sf::Vector2f mousePos;
 
-	// Timing variables
-	const int FRAME_RATE = 30;
-	const float FRAME_TIME = 1.0f / FRAME_RATE;
-	const int TIME_SCALE = 60 * 60 * 24 * 365;			  // 50 years per second
-	const float INTEGRATION_TIME_STEP = 60 * 60 * 24 * 7; // 1 month
-
 	sf::Clock clock;
-	u_long elapsedTime = 0;
-	bool paused = false;
-
 	int prevElapsedYears = 0;
 
 	// Render variables
 	bool drawGravityField = false;
 	bool drawTrails = false;
-	Particle* selectedParticle = nullptr;
+
+	// The two newest snapshots, and what is drawn: one tick behind the simulation, moved
+	// between them by the time since the newest one came in
+	Snapshot previousSnapshot;
+	Snapshot latestSnapshot;
+	Snapshot displayed;
+
+	// Trails of the drawn positions by particle id, with the generation and epoch they belong to
+	std::vector<std::deque<Eigen::Vector2d>> trails;
+	std::vector<uint32_t> trailGenerations;
+	uint64_t trailEpoch = 0;
+	const size_t MAX_TRAIL_LENGTH = 200;
 
 	// Main loop
 	sf::Event event;
@@ -115,6 +102,8 @@ int main()
 
 	while (window.isOpen())
 	{
+		const float unitsPerPixel = window.mapPixelToCoords(sf::Vector2i(1, 0)).x - window.mapPixelToCoords(sf::Vector2i(0, 0)).x;
+
 		// Handle events
 		while (window.pollEvent(event))
 		{
@@ -136,9 +125,9 @@ int main()
 			if (event.type == sf::Event::MouseMoved && panning)
 			{
 				// If a particle is focused, unfocus it
-				if (selectedParticle != nullptr)
+				if (displayed.selected.id >= 0)
 				{
-					selectedParticle = nullptr;
+					simulation.send({ SimulationCommandType::Select, ParticleHandle() });
 				}
 
 				// Determine the new position in world coordinates
@@ -158,7 +147,11 @@ int main()
 			if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
 			{
 				Eigen::Vector2f mousePos = util::toEigen(window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y)));
-				selectedParticle = particleSystem.particleVisibleAt(mousePos, window);
+				const int clickedId = displayed.particleAt(mousePos.cast<double>(), unitsPerPixel);
+				ParticleHandle clicked;
+				if (clickedId >= 0)
+					clicked = { clickedId, displayed.generation[clickedId] };
+				simulation.send({ SimulationCommandType::Select, clicked });
 			}
 
 			// If + or - is pressed, zoom in or out with the mouse as the center point
@@ -188,8 +181,7 @@ int main()
 			// If right arrow is pressed, simulate one frame
 			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Right)
 			{
-				double dt = 1.0 / 30.0;
-				particleSystem.update(dt);
+				simulation.send({ SimulationCommandType::Step, ParticleHandle(), 1.0 / 30.0 });
 			}
 
 		// If G is pressed, toggle gravity field drawing
@@ -207,19 +199,60 @@ int main()
 		// If space is pressed, pause or unpause the simulation
 			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Space)
 			{
-				paused = !paused;
+				simulation.send({ SimulationCommandType::TogglePause });
 			}
 
 			// If R is pressed, reset the simulation
 			if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::R)
 			{
-				particleSystem = initializeSimulation();
-				selectedParticle = nullptr;
-				elapsedTime = 0;
+				simulation.send({ SimulationCommandType::Reset });
 				prevElapsedYears = 0;
 			}
 		}
 
+		// Take the newest snapshot, if the simulation published one since the last frame,
+		// and interpolate to now
+		if (simulation.receive())
+		{
+			std::swap(previousSnapshot, latestSnapshot);
+			latestSnapshot = simulation.getSnapshot();
+		}
+		const double snapshotInterval = std::chrono::duration<double>(latestSnapshot.published - previousSnapshot.published).count();
+		const double sinceLatest = std::chrono::duration<double>(std::chrono::steady_clock::now() - latestSnapshot.published).count();
+		const double alpha = snapshotInterval > 0.0 ? std::clamp(sinceLatest / snapshotInterval, 0.0, 1.0) : 1.0;
+		displayed.interpolate(previousSnapshot, latestSnapshot, alpha);
+
+		// Extend the trails; a trail is started over when its id goes to a new particle
+		if (displayed.epoch != trailEpoch)
+		{
+			trails.clear();
+			trailEpoch = displayed.epoch;
+		}
+		trails.resize(displayed.size());
+		trailGenerations.resize(displayed.size());
+		for (size_t id = 0; id < displayed.size(); id++)
+		{
+			if (!displayed.alive[id]) continue;
+			if (trailGenerations[id] != displayed.generation[id])
+			{
+				trails[id].clear();
+				trailGenerations[id] = displayed.generation[id];
+			}
+			trails[id].push_back(displayed.getPosition(id));
+			if (trails[id].size() > MAX_TRAIL_LENGTH)
+			{
+				trails[id].pop_front();
+			}
+		}
+
+		// If a particle is selected, center the view on it; while panning the unselect may
+		// still be on its way to the simulation
+		if (!panning && displayed.contains(displayed.selected))
+		{
+			simView.setCenter(util::toSFML(displayed.getPosition(displayed.selected.id).cast<float>()));
+			window.setView(simView);
+		}
+
 		// Calculate array of cells to draw filling the screen
 		const int cellSize = 20; // pixels
 		const int numCellsX = static_cast<int>(WINDOW_WIDTH / cellSize) + 1;
@@ -257,13 +290,13 @@ int main()
 			const sf::Vector2f cellCenter = cellPos + cellSizeWorld / 2.0f;
 
 			// If the cell is "close" to a particle, set the potential to 0
-			if (particleSystem.isNearParticle(util::toEigen(cellCenter)))
+			if (displayed.isNearParticle(util::toEigen(cellCenter)))
 			{
 				cellPotentials.push_back(0.0);
 				continue;
 			}
 
-			double cellPotential = -1 * particleSystem.calculatePotentialEnergy(util::toEigen(cellCenter));
+			double cellPotential = -1 * displayed.calculatePotentialEnergy(util::toEigen(cellCenter));
 			cellPotentials.push_back(cellPotential);
 		}
 
@@ -315,32 +348,6 @@ int main()
 		}
 
 		float dt = clock.restart().asSeconds();
-		if (dt > 2 * FRAME_TIME)
-		{
-			std::cout << "Simulation cannot keep up! dt: " << dt << std::endl;
-			std::cout << "Consider increasing integration time step, or reduce time scale." << std::endl;
-			dt = 2 * FRAME_TIME;
-		}
-
-		else if (dt < FRAME_TIME / 2)
-		{
-			std::cout << "Low dt: " << dt << std::endl;
-		}
-
-		float majorTimeStep = dt * TIME_SCALE;
-		int substeps = std::ceil(majorTimeStep / INTEGRATION_TIME_STEP);
-		float subTimeStep = majorTimeStep / substeps;
-
-		// Update the simulation
-		if (!paused)
-		{
-			for (int i = 0; i < substeps; i++)
-			{
-				elapsedTime += subTimeStep;
-				particleSystem.calculateForcesBarnesHut();
-				particleSystem.update(subTimeStep);
-			}
-		}
 
 		// Draw everything
 		window.clear();
@@ -355,14 +362,32 @@ int main()
 		}
 
 	// Draw the particles
-	particleSystem.draw(window);
+	for (size_t id = 0; id < displayed.size(); id++)
+	{
+		if (!displayed.alive[id]) continue;
+		float renderRadius = displayed.getRenderRadius(id, unitsPerPixel);
+		sf::CircleShape circle(renderRadius);
+		circle.setOrigin(renderRadius, renderRadius);
+		circle.setPosition(displayed.x[id], displayed.y[id]);
+		circle.setFillColor(sf::Color(displayed.color[id]));
+		window.draw(circle);
+	}
 
-	// Draw the trails
+	// Draw the trails, 50% transparent green
 	if (drawTrails)
 	{
-		for (auto& particle : particleSystem.getParticles())
+		for (size_t id = 0; id < displayed.size(); id++)
 		{
-			particle.drawTrail(window);
+			if (!displayed.alive[id]) continue;
+			sf::VertexArray lines(sf::LineStrip, trails[id].size());
+			int i = 0;
+			for (Eigen::Vector2d point : trails[id])
+			{
+				lines[i].position = util::toSFML(point.cast<float>());
+				lines[i].color = sf::Color(0, 255, 0, 128);
+				i++;
+			}
+			window.draw(lines);
 		}
 	}
 
@@ -371,22 +396,9 @@ int main()
 		gui.draw(window);
 		window.setView(simView);
 
-	// If a particle is selected, center the view on it
-	if (selectedParticle)
-	{
-		sf::Vector2f selectedParticlePos = util::toSFML(selectedParticle->getPosition().cast<float>());
-		simView.setCenter(selectedParticlePos);
-
-		if (drawTrails)
-		{
-			selectedParticle->updateTrail();
-			selectedParticle->drawTrail(window);
-		}
-	}
-
 		window.display();
 
-		int elapsedYears = static_cast<int>(elapsedTime / (365.25 * 24 * 60 * 60));
+		int elapsedYears = static_cast<int>(displayed.time / (365.25 * 24 * 60 * 60));
 		gui.setElapsedYears(elapsedYears);
 
 		if (elapsedYears > prevElapsedYears)
@@ -1,284 +1,903 @@
 #include "Objects.hpp"
 #include "QuadTree.hpp"
+#include "Snapshot.hpp"
 #include "utils.hpp"
+#include <mutex>
+#include <numeric>
 
 Particle::Particle(float radius, double mass, Eigen::Vector2d position, Eigen::Vector2d velocity) :
 	radius(radius),
 	mass(mass),
 	position(position),
 	velocity(velocity),
-	acceleration(Eigen::Vector2d::Zero()),
-	force(Eigen::Vector2d::Zero()),
-	color(sf::Color::White)
+	color(0xFFFFFFFF)
 {
 }
 
-float Particle::getRenderRadiusWorld(sf::RenderWindow& window)
+int Particle::getMinimumRenderRadius() const
 {
-	float renderRadius = radius;
-	float unitsPerPixel = window.mapPixelToCoords(sf::Vector2i(1, 0)).x - window.mapPixelToCoords(sf::Vector2i(0, 0)).x;
-	float minimumRenderRadius = minimumRenderRadiusPx * unitsPerPixel;
-	if (minimumRenderRadius > radius)
-	{
-		renderRadius = minimumRenderRadius;
-	}
+	return minimumRenderRadiusPx;
+}
 
-	return renderRadius;
+void Particle::setMinimumRenderRadius(int minimumRenderRadiusPx)
+{
+	this->minimumRenderRadiusPx = minimumRenderRadiusPx;
 }
 
-bool Particle::visiblyContains(Eigen::Vector2d position, sf::RenderWindow& window)
+int Particle::getId() const
 {
-	return (position - this->position).norm() < getRenderRadiusWorld(window);
+	return id;
 }
 
-void Particle::draw(sf::RenderWindow& window)
+void Particle::setId(int id)
 {
-	float renderRadius = getRenderRadiusWorld(window);
-	sf::CircleShape circle(renderRadius);
-	circle.setOrigin(renderRadius, renderRadius);
-	circle.setPosition(position.x(), position.y());
-	circle.setFillColor(color);
-	window.draw(circle);
+	this->id = id;
 }
 
-void Particle::drawTrail(sf::RenderWindow& window)
+float Particle::getRadius() const
 {
-	// 50% transparent green
-	sf::Color trailColor = sf::Color(0, 255, 0, 128);
-	sf::VertexArray lines(sf::LineStrip, trail.size());
-	int i = 0;
-	for (Eigen::Vector2d point : trail)
-	{
-		lines[i].position = util::toSFML(point.cast<float>());
-		lines[i].color = trailColor;
-		i++;
-	}
-	window.draw(lines);
+	return radius;
 }
 
-double Particle::calculatePotentialEnergy(Eigen::Vector2f position)
+double Particle::getMass() const
 {
-	double distance = (position.cast<double>() - this->position).norm();
-	return -constants::G * mass / distance;
+	return mass;
 }
 
-void Particle::applyForce(Eigen::Vector2d force)
+Eigen::Vector2d Particle::getPosition() const
 {
-	this->force += force;
+	return position;
 }
 
-void Particle::update(float dt)
+Eigen::Vector2d Particle::getVelocity() const
 {
-	// Integrates the particle's position, velocity, and acceleration using Euler's method
-	acceleration = force / mass;
-	velocity += acceleration * dt;
-	Eigen::Vector2d dr_euler = velocity * dt;
-	position += dr_euler;
+	return velocity;
+}
 
-	// Reset the force
-	force = Eigen::Vector2d::Zero();
+uint32_t Particle::getColor() const
+{
+	return color;
 }
 
-void Particle::updateTrail()
+void Particle::setColor(uint32_t color)
 {
-	trail.push_back(position);
-	if (trail.size() > MAX_TRAIL_LENGTH)
-	{
-		trail.pop_front();
-	}
+	this->color = color;
 }
 
-int Particle::getMinimumRenderRadius()
+bool Particle::isTestParticle() const
 {
-	return minimumRenderRadiusPx;
+	return testParticle;
 }
 
-void Particle::setMinimumRenderRadius(int minimumRenderRadiusPx)
+void Particle::setTestParticle(bool testParticle)
 {
-	this->minimumRenderRadiusPx = minimumRenderRadiusPx;
+	this->testParticle = testParticle;
 }
 
-float Particle::getRadius() const
+const std::shared_ptr<const Ephemeris>& Particle::getEphemeris() const
 {
-	return radius;
+	return ephemeris;
 }
 
-double Particle::getMass() const
+void Particle::setEphemeris(std::shared_ptr<const Ephemeris> ephemeris)
 {
-	return mass;
+	this->ephemeris = std::move(ephemeris);
 }
 
-Eigen::Vector2d Particle::getPosition() const
+// Particle reference
+ParticleRef::ParticleRef(ParticleSystem* system, size_t slot, bool prescribed) :
+	system(system),
+	slot(slot),
+	prescribed(prescribed)
 {
-	return position;
 }
 
-Eigen::Vector2d Particle::getVelocity() const
+ParticleStore& ParticleRef::getStore() const
 {
-	return velocity;
+	return prescribed ? system->prescribed : system->particles;
 }
 
-Eigen::Vector2d Particle::getAcceleration() const
+void ParticleRef::applyForce(Eigen::Vector2d force)
 {
-	return acceleration;
+	getStore().fx[slot] += force.x();
+	getStore().fy[slot] += force.y();
 }
 
-Eigen::Vector2d Particle::getForce() const
+
+int ParticleRef::getMinimumRenderRadius() const
 {
-	return force;
+	return system->renderAttributes[getId()].minimumRenderRadiusPx;
 }
 
-void Particle::setColor(sf::Color color)
+void ParticleRef::setMinimumRenderRadius(int minimumRenderRadiusPx)
 {
-	this->color = color;
+	system->renderAttributes[getId()].minimumRenderRadiusPx = minimumRenderRadiusPx;
+}
+
+ParticleHandle ParticleRef::getHandle() const
+{
+	return { getId(), system->generations[getId()] };
+}
+
+int ParticleRef::getId() const
+{
+	return getStore().id[slot];
+}
+
+float ParticleRef::getRadius() const
+{
+	return getStore().radius[slot];
+}
+
+double ParticleRef::getMass() const
+{
+	return getStore().mass[slot];
+}
+
+Eigen::Vector2d ParticleRef::getPosition() const
+{
+	return getStore().getPosition(slot);
+}
+
+Eigen::Vector2d ParticleRef::getVelocity() const
+{
+	return getStore().getVelocity(slot);
+}
+
+Eigen::Vector2d ParticleRef::getAcceleration() const
+{
+	return getStore().getAcceleration(slot);
+}
+
+Eigen::Vector2d ParticleRef::getForce() const
+{
+	return getStore().getForce(slot);
+}
+
+uint32_t ParticleRef::getColor() const
+{
+	return system->renderAttributes[getId()].color;
+}
+
+void ParticleRef::setColor(uint32_t color)
+{
+	system->renderAttributes[getId()].color = color;
+}
+
+// Particle view
+ParticleView::Iterator::Iterator(ParticleSystem* system, size_t slot) :
+	system(system),
+	slot(slot)
+{
+}
+
+ParticleRef& ParticleView::Iterator::operator*()
+{
+	particle = ParticleRef(system, slot);
+	return particle;
+}
+
+ParticleRef* ParticleView::Iterator::operator->()
+{
+	return &**this;
+}
+
+ParticleView::Iterator& ParticleView::Iterator::operator++()
+{
+	slot++;
+	return *this;
+}
+
+ParticleView::ParticleView(ParticleSystem* system) :
+	system(system)
+{
+}
+
+ParticleView::Iterator ParticleView::begin() const
+{
+	return Iterator(system, 0);
+}
+
+ParticleView::Iterator ParticleView::end() const
+{
+	return Iterator(system, size());
+}
+
+size_t ParticleView::size() const
+{
+	return system->getStore().size();
+}
+
+ParticleRef ParticleView::operator[](size_t slot) const
+{
+	return ParticleRef(system, slot);
 }
 
 // Particle system
-ParticleSystem::ParticleSystem()
+ParticleSystem::ParticleSystem() :
+	threadPool(std::make_shared<util::ThreadPool>())
 {
 }
 
-void ParticleSystem::addParticle(Particle particle)
+ParticleHandle ParticleSystem::addParticle(Particle particle)
 {
-	particles.push_back(particle);
+	// Ids of removed particles are reused, so that the side tables stay as long as the
+	// largest population rather than growing with every particle ever added
+	if (freeIds.empty())
+	{
+		particle.setId(nextParticleId++);
+		generations.push_back(0);
+		renderAttributes.emplace_back();
+	}
+	else
+	{
+		particle.setId(freeIds.back());
+		freeIds.pop_back();
+	}
+	renderAttributes[particle.getId()] = { particle.getColor(), particle.getMinimumRenderRadius() };
+	const ParticleHandle handle { particle.getId(), generations[particle.getId()] };
+
+	if (particle.getEphemeris())
+	{
+		prescribed.add(particle);
+		ephemerides.push_back(particle.getEphemeris());
+		updatePrescribedBodies();
+		resetIntegrators();
+		return handle;
+	}
+
+	particles.add(particle);
+	barnesHut.reset();
+	fastMultipole.reset();
+	directSum.reset();
+	resetIntegrators();
+	return handle;
 }
 
-void ParticleSystem::draw(sf::RenderWindow& window)
+void ParticleSystem::step(double dt)
 {
-	for (Particle& particle : particles)
+	const double startTime = time;
+
+	// The heliocentric integrators split off one central body, which a prescribed body
+	// cannot be, so leapfrog steps systems with prescribed bodies instead
+	IntegratorType type = integratorType;
+	if (!prescribed.empty() && (type == IntegratorType::WisdomHolman || type == IntegratorType::Hybrid))
 	{
-		particle.draw(window);
+		type = IntegratorType::Leapfrog;
 	}
+
+	switch (type)
+	{
+		case IntegratorType::Euler:
+			euler.step(*this, dt);
+			break;
+		case IntegratorType::Leapfrog:
+			leapfrog.step(*this, dt);
+			break;
+		case IntegratorType::Yoshida4:
+			yoshida4.step(*this, dt);
+			break;
+		case IntegratorType::WisdomHolman:
+			wisdomHolman.step(*this, dt);
+			break;
+		case IntegratorType::Hybrid:
+			hybrid.step(*this, dt);
+			break;
+		case IntegratorType::BlockTimesteps:
+			blockTimesteps.step(*this, dt);
+			break;
+		case IntegratorType::Respa:
+			respa.step(*this, dt);
+			break;
+	}
+
+	// The drifts add up to dt, up to rounding
+	time = startTime + dt;
+	updatePrescribedBodies();
+	removeParticles();
 }
 
-void ParticleSystem::update(float dt)
+void ParticleSystem::update(double dt)
 {
-	for (Particle& particle : particles)
+	forEachBodyBlock([&](const kernels::BodyState& bodies) {
+		kernels::integrateEuler(bodies, dt);
+	});
+	advanceTime(dt);
+	resetIntegrators();
+}
+
+void ParticleSystem::forEachBodyBlock(const std::function<void(const kernels::BodyState&)>& fn)
+{
+	// Bodies are independent, so every thread works on a contiguous run of the arrays
+	threadPool->parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		fn(particles.getBodies(begin, end));
+	}, INTEGRATION_BLOCK_SIZE);
+}
+
+void ParticleSystem::resetIntegrators()
+{
+	euler.reset();
+	leapfrog.reset();
+	yoshida4.reset();
+	wisdomHolman.reset();
+	hybrid.reset();
+	blockTimesteps.reset();
+	respa.reset();
+}
+
+
+void ParticleSystem::calculateForces(bool estimate)
+{
+	calculateForces(getSelectedSolver(), estimate);
+}
+
+ForceSolver& ParticleSystem::getSelectedSolver()
+{
+	switch (forceSolverType)
 	{
-		particle.update(dt);
-		particle.updateTrail();
+		case ForceSolverType::DirectSum:
+			return directSum;
+		case ForceSolverType::BarnesHut:
+			return barnesHut;
+		case ForceSolverType::FastMultipole:
+			return fastMultipole;
+		case ForceSolverType::Automatic:
+			break;
 	}
+
+	if (particles.size() < getDirectSumCrossover())
+		return directSum;
+	return barnesHut;
 }
 
-void ParticleSystem::calculateForcesBarnesHut()
+const std::vector<Eigen::Vector2d>& ParticleSystem::calculateActiveAccelerations(uint8_t minLevel, bool withPrescribed)
 {
-	if (particles.empty()) return;
+	calculateAccelerations(getSelectedSolver(), minLevel, withPrescribed);
+	return accelerations;
+}
 
-	// Calculate bounds for all particles with some padding
-	Eigen::Vector2d minBounds = particles[0].getPosition();
-	Eigen::Vector2d maxBounds = particles[0].getPosition();
+size_t ParticleSystem::partitionTestParticles()
+{
+	const std::vector<uint8_t>& testParticle = particles.testParticle;
+	auto isMassive = [](uint8_t test) { return test == 0; };
+	// One pass over the flags when nothing needs to move, which is nearly always
+	const auto firstTest = std::find_if_not(testParticle.begin(), testParticle.end(), isMassive);
+	if (std::none_of(firstTest, testParticle.end(), isMassive)) return firstTest - testParticle.begin();
+
+	// Only after particles were added, which already reset the solvers
+	std::vector<uint32_t> order(particles.size());
+	std::iota(order.begin(), order.end(), 0);
+	const auto massiveEnd = std::stable_partition(order.begin(), order.end(), [&](uint32_t slot) { return testParticle[slot] == 0; });
+	const size_t massiveCount = massiveEnd - order.begin();
+	particles.permute(order);
+	return massiveCount;
+}
 
-	for (const Particle& particle : particles)
+void ParticleSystem::calculateAccelerations(ForceSolver& solver, std::optional<uint8_t> minLevel, bool withPrescribed)
+{
+	auto solve = [&](ParticleStore& store, std::vector<Eigen::Vector2d>& result) {
+		if (minLevel)
+			solver.calculateActiveAccelerations(store, *minLevel, result, *threadPool);
+		else
+			solver.calculateAccelerations(store, result, *threadPool);
+	};
+
+	const size_t sourceCount = partitionTestParticles();
+	if (sourceCount == particles.size())
+	{
+		solve(particles, accelerations);
+	}
+	else
 	{
-		const Eigen::Vector2d& pos = particle.getPosition();
-		minBounds.x() = std::min(minBounds.x(), pos.x());
-		minBounds.y() = std::min(minBounds.y(), pos.y());
-		maxBounds.x() = std::max(maxBounds.x(), pos.x());
-		maxBounds.y() = std::max(maxBounds.y(), pos.y());
+		sourceAccelerations.clear();
+		sources.copyFrom(particles, sourceCount);
+		if (sourceCount > 0)
+		{
+			solve(sources, sourceAccelerations);
+		}
+
+		// A tree solver may have sorted its copy, the massive bodies follow it so that the
+		// next refit finds them in the same order
+		if (!std::equal(sources.id.begin(), sources.id.end(), particles.id.begin()))
+		{
+			std::vector<uint32_t> order(particles.size());
+			for (size_t i = 0; i < sourceCount; i++)
+			{
+				order[i] = particles.findSlot(sources.id[i]);
+			}
+			std::iota(order.begin() + sourceCount, order.end(), sourceCount);
+			particles.permute(order);
+		}
+
+		accelerations.resize(particles.size());
+		for (size_t i = 0; i < particles.size(); i++)
+		{
+			if (minLevel && particles.level[i] < *minLevel) continue;
+			accelerations[i] = i < sourceCount ? sourceAccelerations[i] : Eigen::Vector2d::Zero();
+		}
+		accumulateDirectAccelerations(sourceCount, particles.size(), minLevel, sources, sourceCount);
 	}
 
-	// Add padding (10% on each side)
-	Eigen::Vector2d size = maxBounds - minBounds;
-	double padding = std::max(size.x(), size.y()) * 0.1;
-	if (padding < 1e9) padding = 1e9; // Minimum padding
+	// The prescribed bodies pull on everything and are pulled by nothing
+	if (withPrescribed && !prescribed.empty())
+	{
+		accumulateDirectAccelerations(0, particles.size(), minLevel, prescribed, prescribed.size());
+	}
+}
 
-	minBounds.x() -= padding;
-	minBounds.y() -= padding;
-	maxBounds.x() += padding;
-	maxBounds.y() += padding;
+void ParticleSystem::accumulateDirectAccelerations(size_t begin, size_t end, std::optional<uint8_t> minLevel, const ParticleStore& sources, size_t sourceCount)
+{
+	// Targets in cache sized runs against all sources; the due ones of each run are gathered
+	// so that the kernel only sees those
+	constexpr size_t RUN_SIZE = 512;
+	threadPool->parallelFor(end - begin, [&](size_t blockBegin, size_t blockEnd) {
+		uint32_t slots[RUN_SIZE];
+		double x[RUN_SIZE];
+		double y[RUN_SIZE];
+		double ax[RUN_SIZE];
+		double ay[RUN_SIZE];
+		for (size_t runBegin = begin + blockBegin; runBegin < begin + blockEnd; runBegin += RUN_SIZE)
+		{
+			const size_t runEnd = std::min(runBegin + RUN_SIZE, begin + blockEnd);
+			size_t runSize = 0;
+			for (size_t i = runBegin; i < runEnd; i++)
+			{
+				if (minLevel && particles.level[i] < *minLevel) continue;
+				slots[runSize] = static_cast<uint32_t>(i);
+				x[runSize] = particles.x[i];
+				y[runSize] = particles.y[i];
+				runSize++;
+			}
+			if (runSize == 0) continue;
+
+			std::fill(ax, ax + runSize, 0.0);
+			std::fill(ay, ay + runSize, 0.0);
+			kernels::accumulateAccelerations(x, y, runSize,
+				sources.x.data(), sources.y.data(), sources.mass.data(), sourceCount,
+				QuadTreeNode::MIN_DISTANCE, ax, ay);
+			for (size_t i = 0; i < runSize; i++)
+			{
+				accelerations[slots[i]] += Eigen::Vector2d(ax[i], ay[i]);
+			}
+		}
+	}, RUN_SIZE);
+}
 
-	// Build the quadtree
-	QuadTree tree(minBounds, maxBounds);
-	tree.build(particles);
+void ParticleSystem::calculateForcesBarnesHut()
+{
+	calculateForces(barnesHut);
+}
 
-	// Calculate forces for each particle using the tree
-	for (Particle& particle : particles)
+void ParticleSystem::calculateForcesDirect()
+{
+	calculateForces(directSum);
+}
+
+void ParticleSystem::calculateForcesFMM()
+{
+	calculateForces(fastMultipole);
+}
+
+void ParticleSystem::calculateForces(ForceSolver& solver, bool estimate)
+{
+	if (particles.empty()) return;
+
+	calculateAccelerations(solver, std::nullopt);
+
+	threadPool->parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			// A massless test particle has no force to carry its acceleration; the kicks keep
+			// the acceleration of massless slots as it is
+			if (particles.mass[i] > 0.0)
+			{
+				particles.fx[i] += accelerations[i].x() * particles.mass[i];
+				particles.fy[i] += accelerations[i].y() * particles.mass[i];
+			}
+			else
+			{
+				particles.ax[i] = accelerations[i].x();
+				particles.ay[i] = accelerations[i].y();
+			}
+		}
+	}, INTEGRATION_BLOCK_SIZE);
+
+	if (estimate)
 	{
-		Eigen::Vector2d force = tree.calculateForce(particle);
-		particle.applyForce(force);
+		estimateTimestep(accelerations);
 	}
 }
 
-double ParticleSystem::calculatePotentialEnergy(Eigen::Vector2f position)
+const std::vector<Eigen::Vector2d>& ParticleSystem::getAccelerations() const
 {
-	double potentialEnergy = 0.0;
+	return accelerations;
+}
 
-	for (Particle& particle : particles)
+void ParticleSystem::estimateTimestep(const std::vector<Eigen::Vector2d>& totalAccelerations)
+{
+	double totalMass = 0.0;
+	Eigen::Vector2d barycenter = Eigen::Vector2d::Zero();
+	Eigen::Vector2d barycenterVelocity = Eigen::Vector2d::Zero();
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		totalMass += particles.mass[i];
+		barycenter += particles.mass[i] * particles.getPosition(i);
+		barycenterVelocity += particles.mass[i] * particles.getVelocity(i);
+	}
+	for (size_t i = 0; i < prescribed.size(); i++)
 	{
-		potentialEnergy += particle.calculatePotentialEnergy(position);
+		totalMass += prescribed.mass[i];
+		barycenter += prescribed.mass[i] * prescribed.getPosition(i);
+		barycenterVelocity += prescribed.mass[i] * prescribed.getVelocity(i);
+	}
+	if (totalMass > 0.0)
+	{
+		barycenter /= totalMass;
+		barycenterVelocity /= totalMass;
 	}
 
-	return potentialEnergy;
+	// Each block reduces its own run before combining with the others
+	std::mutex mutex;
+	timestepEstimate = TimestepEstimate();
+	threadPool->parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		TimestepEstimate blockEstimate;
+		for (size_t i = begin; i < end; i++)
+		{
+			const double distance = (particles.getPosition(i) - barycenter).norm();
+			const double acceleration = totalAccelerations[i].norm();
+			const double speed = (particles.getVelocity(i) - barycenterVelocity).norm();
+			if (acceleration > 0.0)
+				blockEstimate.freeFallTime = std::min(blockEstimate.freeFallTime, std::sqrt(distance / acceleration));
+			if (speed > 0.0)
+				blockEstimate.crossingTime = std::min(blockEstimate.crossingTime, distance / speed);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		timestepEstimate.freeFallTime = std::min(timestepEstimate.freeFallTime, blockEstimate.freeFallTime);
+		timestepEstimate.crossingTime = std::min(timestepEstimate.crossingTime, blockEstimate.crossingTime);
+	}, INTEGRATION_BLOCK_SIZE);
+}
+
+double ParticleSystem::getTime() const
+{
+	return time;
+}
+
+void ParticleSystem::advanceTime(double dt)
+{
+	time += dt;
+	updatePrescribedBodies();
+}
+
+void ParticleSystem::updatePrescribedBodies()
+{
+	for (size_t i = 0; i < prescribed.size(); i++)
+	{
+		Eigen::Vector2d position;
+		Eigen::Vector2d velocity;
+		ephemerides[i]->evaluate(time, position, velocity);
+		prescribed.x[i] = position.x();
+		prescribed.y[i] = position.y();
+		prescribed.vx[i] = velocity.x();
+		prescribed.vy[i] = velocity.y();
+	}
 }
 
-// "close" means within 10 radii of a particle
-bool ParticleSystem::isNearParticle(Eigen::Vector2f position)
+void ParticleSystem::removeParticles()
 {
-	for (Particle& particle : particles)
+	if (particles.empty()) return;
+
+	// The most massive body, integrated or prescribed, is the one particles fall into
+	const ParticleStore* centralStore = &particles;
+	size_t central = std::max_element(particles.mass.begin(), particles.mass.end()) - particles.mass.begin();
+	if (!prescribed.empty())
+	{
+		const size_t heaviest = std::max_element(prescribed.mass.begin(), prescribed.mass.end()) - prescribed.mass.begin();
+		if (prescribed.mass[heaviest] > particles.mass[central])
+		{
+			centralStore = &prescribed;
+			central = heaviest;
+		}
+	}
+	const Eigen::Vector2d centralPosition = centralStore->getPosition(central);
+	const double centralRadius = centralStore->radius[central];
+
+	// Escapes are judged against the whole system
+	const bool checkEscapes = std::isfinite(removalSettings.escapeRadius);
+	double totalMass = 0.0;
+	Eigen::Vector2d barycenter = Eigen::Vector2d::Zero();
+	Eigen::Vector2d barycenterVelocity = Eigen::Vector2d::Zero();
+	if (checkEscapes)
 	{
-		double characteristicDistance = particle.getMass() / 4e18;
-		if ((particle.getPosition() - position.cast<double>()).norm() < characteristicDistance)
+		for (const ParticleStore* store : { &particles, &prescribed })
 		{
-			return true;
+			for (size_t i = 0; i < store->size(); i++)
+			{
+				totalMass += store->mass[i];
+				barycenter += store->mass[i] * store->getPosition(i);
+				barycenterVelocity += store->mass[i] * store->getVelocity(i);
+			}
 		}
+		barycenter /= totalMass;
+		barycenterVelocity /= totalMass;
 	}
 
-	return false;
+	fates.assign(particles.size(), 0);
+	threadPool->parallelFor(particles.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			if (removalSettings.removeImpacts && !(centralStore == &particles && i == central)
+				&& (particles.getPosition(i) - centralPosition).squaredNorm() < centralRadius * centralRadius)
+			{
+				fates[i] = 1 + static_cast<uint8_t>(ParticleFate::Impact);
+				continue;
+			}
+
+			if (checkEscapes)
+			{
+				const double distance = (particles.getPosition(i) - barycenter).norm();
+				const double speed = (particles.getVelocity(i) - barycenterVelocity).norm();
+				if (distance > removalSettings.escapeRadius && 0.5 * speed * speed > constants::G * totalMass / distance)
+				{
+					fates[i] = 1 + static_cast<uint8_t>(ParticleFate::Ejection);
+					continue;
+				}
+			}
+
+			if (removalSettings.predicate && removalSettings.predicate(particles, i))
+			{
+				fates[i] = 1 + static_cast<uint8_t>(ParticleFate::Discarded);
+			}
+		}
+	}, 1024);
+
+	removedSlots.clear();
+	for (uint32_t i = 0; i < particles.size(); i++)
+	{
+		if (fates[i] == 0) continue;
+		const int id = particles.id[i];
+		removedSlots.push_back(i);
+		removedParticles.push_back({ id, generations[id], static_cast<ParticleFate>(fates[i] - 1), time,
+			particles.mass[i], particles.getPosition(i), particles.getVelocity(i) });
+		generations[id]++;
+		freeIds.push_back(id);
+	}
+	if (removedSlots.empty()) return;
+
+	particles.remove(removedSlots);
+	barnesHut.reset();
+	fastMultipole.reset();
+	directSum.reset();
+	resetIntegrators();
+}
+
+const ParticleStore& ParticleSystem::getPrescribedBodies() const
+{
+	return prescribed;
 }
 
-std::vector<Particle>& ParticleSystem::getParticles()
+ParticleStore& ParticleSystem::getStore()
 {
 	return particles;
 }
 
-Particle* ParticleSystem::particleVisibleAt(Eigen::Vector2f position, sf::RenderWindow& window)
+const ParticleStore& ParticleSystem::getStore() const
 {
-	// Iterate over all particles and return the first one that is visible at the given position
-	for (Particle& particle : particles)
+	return particles;
+}
+
+void ParticleSystem::markStoreModified()
+{
+	barnesHut.reset();
+	fastMultipole.reset();
+	directSum.reset();
+	resetIntegrators();
+}
+
+void ParticleSystem::writeSnapshot(Snapshot& snapshot) const
+{
+	snapshot.time = time;
+	snapshot.resize(generations.size());
+	std::fill(snapshot.alive.begin(), snapshot.alive.end(), 0);
+	for (const ParticleStore* store : { &particles, &prescribed })
 	{
-		if (particle.visiblyContains(position.cast<double>(), window))
+		for (size_t i = 0; i < store->size(); i++)
 		{
-			return &particle;
+			const int id = store->id[i];
+			snapshot.x[id] = store->x[i];
+			snapshot.y[id] = store->y[i];
+			snapshot.mass[id] = store->mass[i];
+			snapshot.radius[id] = store->radius[i];
+			snapshot.color[id] = renderAttributes[id].color;
+			snapshot.minimumRenderRadiusPx[id] = renderAttributes[id].minimumRenderRadiusPx;
+			snapshot.generation[id] = generations[id];
+			snapshot.alive[id] = 1;
 		}
 	}
+}
+
+ParticleView ParticleSystem::getParticles()
+{
+	return ParticleView(this);
+}
+
+ParticleRef ParticleSystem::findParticle(int id)
+{
+	uint32_t slot = particles.findSlot(id);
+	if (slot != ParticleStore::NO_SLOT)
+	{
+		return ParticleRef(this, slot);
+	}
+	slot = prescribed.findSlot(id);
+	if (slot != ParticleStore::NO_SLOT)
+	{
+		return ParticleRef(this, slot, true);
+	}
+
+	return ParticleRef();
+}
+
+ParticleRef ParticleSystem::findParticle(ParticleHandle handle)
+{
+	if (!isAlive(handle))
+	{
+		return ParticleRef();
+	}
+	return findParticle(handle.id);
+}
 
-	return nullptr;
+bool ParticleSystem::isAlive(ParticleHandle handle) const
+{
+	// A removed particle's id goes to the next particle added with a new generation
+	return handle.id >= 0 && static_cast<size_t>(handle.id) < generations.size()
+		&& generations[handle.id] == handle.generation
+		&& (particles.findSlot(handle.id) != ParticleStore::NO_SLOT || prescribed.findSlot(handle.id) != ParticleStore::NO_SLOT);
+}
+
+void ParticleSystem::setForceSolverType(ForceSolverType type)
+{
+	forceSolverType = type;
+}
+
+ForceSolverType ParticleSystem::getForceSolverType() const
+{
+	return forceSolverType;
+}
+
+size_t ParticleSystem::getDirectSumCrossover()
+{
+	return measureDirectSumCrossover(*threadPool);
+}
+
+void ParticleSystem::setBlockTimestepSettings(const BlockTimestepSettings& settings)
+{
+	blockTimesteps.setSettings(settings);
+}
+
+const BlockTimestepSettings& ParticleSystem::getBlockTimestepSettings() const
+{
+	return blockTimesteps.getSettings();
+}
+
+void ParticleSystem::setHybridSettings(const HybridSettings& settings)
+{
+	hybrid.setSettings(settings);
+}
+
+const HybridSettings& ParticleSystem::getHybridSettings() const
+{
+	return hybrid.getSettings();
+}
+
+size_t ParticleSystem::getEncounterCount() const
+{
+	return hybrid.getEncounterCount();
+}
+
+void ParticleSystem::setRespaSettings(const RespaSettings& settings)
+{
+	respa.setSettings(settings);
+}
+
+const RespaSettings& ParticleSystem::getRespaSettings() const
+{
+	return respa.getSettings();
+}
+
+double ParticleSystem::getAdaptiveTimestep() const
+{
+	const double dynamicalTime = std::min(timestepEstimate.freeFallTime, timestepEstimate.crossingTime);
+	return std::clamp(timestepSettings.eta * dynamicalTime, timestepSettings.minStep, timestepSettings.maxStep);
+}
+
+const TimestepEstimate& ParticleSystem::getTimestepEstimate() const
+{
+	return timestepEstimate;
+}
+
+void ParticleSystem::setTimestepSettings(const TimestepSettings& settings)
+{
+	timestepSettings = settings;
+}
+
+const TimestepSettings& ParticleSystem::getTimestepSettings() const
+{
+	return timestepSettings;
+}
+
+void ParticleSystem::setIntegratorType(IntegratorType type)
+{
+	integratorType = type;
+	resetIntegrators();
+	timestepEstimate = TimestepEstimate();
+}
+
+IntegratorType ParticleSystem::getIntegratorType() const
+{
+	return integratorType;
+}
+
+void ParticleSystem::setTreeSettings(const TreeSettings& settings)
+{
+	barnesHut.setSettings(settings);
+}
+
+const TreeSettings& ParticleSystem::getTreeSettings() const
+{
+	return barnesHut.getSettings();
+}
+
+const TreeStatistics& ParticleSystem::getTreeStatistics() const
+{
+	return barnesHut.getStatistics();
+}
+
+void ParticleSystem::setFMMSettings(const FMMSettings& settings)
+{
+	fastMultipole.setFMMSettings(settings);
+}
+
+const FMMSettings& ParticleSystem::getFMMSettings() const
+{
+	return fastMultipole.getFMMSettings();
+}
+
+void ParticleSystem::setThreadCount(unsigned threadCount)
+{
+	threadPool = std::make_shared<util::ThreadPool>(threadCount);
+}
+
+unsigned ParticleSystem::getThreadCount() const
+{
+	return threadPool->getThreadCount();
+}
+
+util::ThreadPool& ParticleSystem::getThreadPool()
+{
+	return *threadPool;
 }
 
 int ParticleSystem::getParticleCount()
 {
-	return particles.size();
+	return particles.size() + prescribed.size();
 }
 
 int ParticleSystem::getDestroyedParticleCount()
 {
-	return destroyedParticles.size();
+	return removedParticles.size();
 }
 
-GUI::GUI()
+void ParticleSystem::setRemovalSettings(const RemovalSettings& settings)
 {
-	font.loadFromFile("arial.ttf");
+	removalSettings = settings;
 }
 
-void GUI::draw(sf::RenderWindow& window)
+const RemovalSettings& ParticleSystem::getRemovalSettings() const
 {
-	// Draw the GUI background
-	sf::RectangleShape background(sf::Vector2f(window.getSize().x, 50));
-	background.setFillColor(backgroundColor);
-	background.setOutlineColor(strokeColor);
-	window.draw(background);
-
-	// Draw elapsed time
-	sf::Text text;
-	text.setFont(font);
-	text.setCharacterSize(fontSize);
-	text.setString("Elapsed time: " + std::to_string(elapsedYears) + " years");
-	text.setFillColor(textColor);
-	text.setPosition(10, 10);
-	window.draw(text);
+	return removalSettings;
 }
 
-void GUI::setElapsedYears(int elapsedYears)
+const std::vector<RemovedParticle>& ParticleSystem::getRemovedParticles() const
 {
-	this->elapsedYears = elapsedYears;
-}
\ No newline at end of file
+	return removedParticles;
+}
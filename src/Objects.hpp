@@ -1,40 +1,106 @@
 #pragma once
 #include "Eigen/Dense"
+#include "Ephemeris.hpp"
+#include "FMM.hpp"
+#include "Integrator.hpp"
+#include "Kernels.hpp"
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+#include <functional>
+#include <limits>
+#include <optional>
 
+// Description of a particle, used to add it to a ParticleSystem
 class Particle
 {
 
 private:
-	int MAX_TRAIL_LENGTH = 200;
-
 	int minimumRenderRadiusPx = 5;
 
+	// Assigned by ParticleSystem, stays the same when the storage is reordered
+	int id = -1;
+
 	float radius;
 	double mass;
 	Eigen::Vector2d position;
 	Eigen::Vector2d velocity;
-	Eigen::Vector2d acceleration;
-	Eigen::Vector2d force;
-	sf::Color color;
-
-	std::deque<Eigen::Vector2d> trail;
+	// RGBA, red in the highest byte
+	uint32_t color;
+	bool testParticle = false;
+	std::shared_ptr<const Ephemeris> ephemeris;
 
 public:
 	Particle(float radius, double mass, Eigen::Vector2d position, Eigen::Vector2d velocity);
 
-	void update(float dt);
-	void updateTrail();
-	void draw(sf::RenderWindow& window);
-	void drawTrail(sf::RenderWindow& window);
-	void applyForce(Eigen::Vector2d force);
-
-	int getMinimumRenderRadius();
+	int getMinimumRenderRadius() const;
 	void setMinimumRenderRadius(int radius);
 
-	float getRenderRadiusWorld(sf::RenderWindow& window);
+	int getId() const;
+	void setId(int id);
+
+	float getRadius() const;
+	double getMass() const;
+
+	Eigen::Vector2d getPosition() const;
+	Eigen::Vector2d getVelocity() const;
+
+	uint32_t getColor() const;
+	void setColor(uint32_t color);
+
+	// A test particle moves in the field of the massive bodies without adding to it, so
+	// it is left out of the force solvers and costs one kernel pass over the massive bodies
+	bool isTestParticle() const;
+	void setTestParticle(bool testParticle);
+
+	// A particle with an ephemeris follows it instead of being integrated. It pulls on the
+	// others like any massive body but is never a force solver source; its position at
+	// the time of each force calculation goes straight to the kernels.
+	const std::shared_ptr<const Ephemeris>& getEphemeris() const;
+	void setEphemeris(std::shared_ptr<const Ephemeris> ephemeris);
+};
+
+class ParticleSystem;
+struct Snapshot;
+
+// Stable name of a particle of a ParticleSystem, for code that holds on to particles across
+// steps, like the UI and analysis. Ids are reused after a particle is removed, the
+// generation tells the old particle from the new one.
+struct ParticleHandle
+{
+	int id = -1;
+	uint32_t generation = 0;
+
+	bool operator==(const ParticleHandle& other) const = default;
+};
+
+// One particle of a ParticleSystem with the interface Particle used to have, reading and
+// writing the system's arrays. Valid until the storage is reordered or compacted by the
+// next step, so keep a ParticleHandle instead; a default constructed reference is null.
+class ParticleRef
+{
+private:
+	ParticleSystem* system = nullptr;
+	size_t slot = 0;
+
+	// Slot among the bodies following an ephemeris rather than the integrated ones
+	bool prescribed = false;
 
-	bool visiblyContains(Eigen::Vector2d position, sf::RenderWindow& window);
+	ParticleStore& getStore() const;
 
+public:
+	ParticleRef() = default;
+	ParticleRef(ParticleSystem* system, size_t slot, bool prescribed = false);
+
+	explicit operator bool() const { return system != nullptr; }
+	ParticleRef* operator->() { return this; }
+
+	void applyForce(Eigen::Vector2d force);
+
+	int getMinimumRenderRadius() const;
+	void setMinimumRenderRadius(int radius);
+
+	ParticleHandle getHandle() const;
+	int getId() const;
 	float getRadius() const;
 	double getMass() const;
 
@@ -43,60 +109,283 @@ public:
 	Eigen::Vector2d getAcceleration() const;
 	Eigen::Vector2d getForce() const;
 
-	double calculatePotentialEnergy(Eigen::Vector2f position);
-	void setColor(sf::Color color);
+	uint32_t getColor() const;
+	void setColor(uint32_t color);
 };
 
-class ParticleSystem
+// Range over the particles of a ParticleSystem in storage order, yielding ParticleRef
+class ParticleView
 {
 private:
-	std::vector<Particle> particles;
-	std::vector<Particle> destroyedParticles;
+	ParticleSystem* system;
 
 public:
-	ParticleSystem();
-	void update(float dt);
-	void calculateForcesBarnesHut();
-	void draw(sf::RenderWindow& window);
+	class Iterator
+	{
+	private:
+		ParticleSystem* system;
+		size_t slot;
 
-	void addParticle(Particle particle);
+		// Held here so that dereferencing can return a reference
+		ParticleRef particle;
 
-	double calculatePotentialEnergy(Eigen::Vector2f position);
+	public:
+		Iterator(ParticleSystem* system, size_t slot);
 
-	bool isNearParticle(Eigen::Vector2f position);
+		ParticleRef& operator*();
+		ParticleRef* operator->();
+		Iterator& operator++();
+		bool operator==(const Iterator& other) const { return slot == other.slot; }
+		bool operator!=(const Iterator& other) const { return slot != other.slot; }
+	};
 
-	int getParticleCount();
-	int getDestroyedParticleCount();
+	explicit ParticleView(ParticleSystem* system);
 
-	std::vector<Particle>& getParticles();
-	Particle* particleVisibleAt(Eigen::Vector2f position, sf::RenderWindow& window);
+	Iterator begin() const;
+	Iterator end() const;
+	size_t size() const;
+	ParticleRef operator[](size_t slot) const;
+};
+
+enum class ParticleFate
+{
+	// Fell inside the radius of the most massive body
+	Impact,
+	// Left the escape radius on an unbound orbit
+	Ejection,
+	// Picked by the removal predicate
+	Discarded
+};
+
+// When particles are taken out of the simulation, checked after every step
+struct RemovalSettings
+{
+	// Remove particles inside the radius of the most massive body
+	bool removeImpacts = true;
+
+	// Remove particles this far from the barycenter with positive energy relative to it;
+	// infinity keeps every escaping particle
+	double escapeRadius = std::numeric_limits<double>::infinity();
+
+	// Remove the particle in a slot when this returns true, if set. Called from the worker
+	// threads, so it must not change shared state.
+	std::function<bool(const ParticleStore& particles, size_t slot)> predicate;
+};
+
+// What is left of a removed particle
+struct RemovedParticle
+{
+	int id;
+	uint32_t generation;
+	ParticleFate fate;
+	// Time of the step after which it was removed
+	double time;
+	double mass;
+	Eigen::Vector2d position;
+	Eigen::Vector2d velocity;
 };
 
-class GUI
+class ParticleSystem
 {
+	friend class ParticleRef;
+
 private:
-	const int fontSize = 18;
-	sf::Font font;
-	sf::Text text;
+	// Bodies per block of the parallel integration; smaller blocks cost more to hand out than to integrate
+	static constexpr size_t INTEGRATION_BLOCK_SIZE = 8192;
+
+	// Render state, only touched when drawing
+	struct RenderAttributes
+	{
+		uint32_t color = 0xFFFFFFFF;
+		int minimumRenderRadiusPx = 5;
+	};
+
+	ParticleStore particles;
+	std::vector<RemovedParticle> removedParticles;
+
+	RemovalSettings removalSettings;
+
+	// Fate of each slot found by the last removal check, 0 to keep the particle and one more
+	// than its ParticleFate otherwise, and the slots to remove
+	std::vector<uint8_t> fates;
+	std::vector<uint32_t> removedSlots;
+
+	// Side tables indexed by particle id, so reordering the store never moves them
+	std::vector<RenderAttributes> renderAttributes;
+
+	// Generation of each id, counted up when its particle is removed, and the ids free for reuse
+	std::vector<uint32_t> generations;
+	std::vector<int> freeIds;
+
+	// Keep their state between force calculations, such as the Barnes-Hut tree
+	DirectSumSolver directSum;
+	BarnesHutSolver barnesHut;
+	FMMSolver fastMultipole;
+	ForceSolverType forceSolverType = ForceSolverType::Automatic;
 
-	int objectsInView;
-	int objectsInSun;
-	int objectsInSystem;
+	EulerIntegrator euler;
+	LeapfrogIntegrator leapfrog;
+	Yoshida4Integrator yoshida4;
+	WisdomHolmanIntegrator wisdomHolman;
+	HybridIntegrator hybrid;
+	BlockTimestepIntegrator blockTimesteps;
+	RespaIntegrator respa;
+	IntegratorType integratorType = IntegratorType::Leapfrog;
 
-	int elapsedYears;
+	TimestepSettings timestepSettings;
+	TimestepEstimate timestepEstimate;
 
-	// Grey background
-	sf::Color backgroundColor = sf::Color(50, 50, 50, 100);
+	// Shared by copies of the system, so resetting the simulation keeps the workers
+	std::shared_ptr<util::ThreadPool> threadPool;
 
-	// Black stroke
-	sf::Color strokeColor = sf::Color(0, 0, 0, 255);
+	// Accelerations from the last force calculation, indexed like particles
+	std::vector<Eigen::Vector2d> accelerations;
+	int nextParticleId = 0;
 
-	// White text
-	sf::Color textColor = sf::Color(255, 255, 255, 255);
+	// Bodies following an ephemeris, at the current time, and their ephemerides by slot
+	ParticleStore prescribed;
+	std::vector<std::shared_ptr<const Ephemeris>> ephemerides;
+
+	// Time of the positions in the store
+	double time = 0.0;
+
+	// Copy of the massive bodies that the solvers work on while there are test particles,
+	// and its accelerations
+	ParticleStore sources;
+	std::vector<Eigen::Vector2d> sourceAccelerations;
+
+	// Move the test particles behind the massive bodies, keeping the order within each, and
+	// return the number of massive bodies
+	size_t partitionTestParticles();
+
+	// Accelerations of every particle into accelerations, or with a level only of the particles
+	// on that block timestep level or deeper. Test particles are summed directly against the
+	// massive bodies; the solver only sees those. The prescribed bodies pull on every particle.
+	// The direct sums leave the entries of particles that are not due alone.
+	void calculateAccelerations(ForceSolver& solver, std::optional<uint8_t> minLevel, bool withPrescribed = true);
+
+	// Add the pull of the first sourceCount bodies of sources to the accelerations of the
+	// slots [begin, end), or with a level only of those on that level or deeper
+	void accumulateDirectAccelerations(size_t begin, size_t end, std::optional<uint8_t> minLevel, const ParticleStore& sources, size_t sourceCount);
+
+	// Move the prescribed bodies to the current time
+	void updatePrescribedBodies();
+
+	// Take the particles that meet a removal criterion out of the store and record their fates
+	void removeParticles();
+
+	void calculateForces(ForceSolver& solver, bool estimate = true);
+	ForceSolver& getSelectedSolver();
+	void resetIntegrators();
 
 public:
-	GUI();
-	void draw(sf::RenderWindow& window);
+	ParticleSystem();
+	// Advance by dt with the selected integrator, calculating forces as it needs them
+	void step(double dt);
+	// Semi-implicit Euler step with the forces applied so far
+	void update(double dt);
+
+	// Time of the positions, which the prescribed bodies follow. Integrators advance it as
+	// they drift, so every force calculation sees the prescribed bodies at the same time
+	// as the integrated ones.
+	double getTime() const;
+	void advanceTime(double dt);
+
+	// Bodies following an ephemeris, at the current time
+	const ParticleStore& getPrescribedBodies() const;
+
+	// Calculate forces with the selected solver, and from them the dynamical times unless the
+	// caller estimates those itself: integrators that leave bodies out of the force calculation
+	// pass false and call estimateTimestep with the accelerations of the full system
+	void calculateForces(bool estimate = true);
+	void calculateForcesBarnesHut();
+	void calculateForcesDirect();
+	void calculateForcesFMM();
+
+	// Gravitational accelerations from the last force calculation, indexed like the store
+	const std::vector<Eigen::Vector2d>& getAccelerations() const;
+
+	// Shortest dynamical times relative to the barycenter, from the given accelerations of the
+	// particles in the store; see getAdaptiveTimestep
+	void estimateTimestep(const std::vector<Eigen::Vector2d>& totalAccelerations);
+
+	// Accelerations from the selected solver of the particles on block timestep level minLevel
+	// or deeper, indexed like the store; entries of other particles are unspecified. The pull of
+	// the prescribed bodies is left out on request, for integrators that apply it themselves.
+	const std::vector<Eigen::Vector2d>& calculateActiveAccelerations(uint8_t minLevel, bool withPrescribed = true);
+
+	// Call fn on contiguous runs of bodies, in parallel on the system's threads
+	void forEachBodyBlock(const std::function<void(const kernels::BodyState&)>& fn);
+
+	// The particle's id is assigned here, the handle stays valid for as long as it lives
+	ParticleHandle addParticle(Particle particle);
+
+	// Automatic picks direct summation below the crossover measured for this machine
+	void setForceSolverType(ForceSolverType type);
+	ForceSolverType getForceSolverType() const;
+	size_t getDirectSumCrossover();
+
+	void setIntegratorType(IntegratorType type);
+	IntegratorType getIntegratorType() const;
+
+	void setBlockTimestepSettings(const BlockTimestepSettings& settings);
+	const BlockTimestepSettings& getBlockTimestepSettings() const;
+
+	void setHybridSettings(const HybridSettings& settings);
+	const HybridSettings& getHybridSettings() const;
+	// Pairs the hybrid integrator handled as close encounters in its last step
+	size_t getEncounterCount() const;
+
+	void setRespaSettings(const RespaSettings& settings);
+	const RespaSettings& getRespaSettings() const;
+
+	// Next step for the caller's loop: eta times the shortest dynamical time, within the
+	// bounds of the settings. Integrators that do their own substeps, block timesteps and
+	// multiple time stepping, leave the estimate unknown, which gives the longest step.
+	double getAdaptiveTimestep() const;
+	const TimestepEstimate& getTimestepEstimate() const;
+	void setTimestepSettings(const TimestepSettings& settings);
+	const TimestepSettings& getTimestepSettings() const;
+
+	void setTreeSettings(const TreeSettings& settings);
+	const TreeSettings& getTreeSettings() const;
+
+	// Work done by the last Barnes-Hut force calculation
+	const TreeStatistics& getTreeStatistics() const;
+
+	void setFMMSettings(const FMMSettings& settings);
+	const FMMSettings& getFMMSettings() const;
+
+	// Number of threads used for tree construction and force evaluation, 0 uses every hardware thread
+	void setThreadCount(unsigned threadCount);
+	unsigned getThreadCount() const;
+	util::ThreadPool& getThreadPool();
+
+	int getParticleCount();
+	int getDestroyedParticleCount();
+
+	// Particles are removed after the step that brings them to their fate, so that those
+	// gone for good stop costing force calculations and integration
+	void setRemovalSettings(const RemovalSettings& settings);
+	const RemovalSettings& getRemovalSettings() const;
+	const std::vector<RemovedParticle>& getRemovedParticles() const;
+
+	// Physics state of every particle, for code that works on whole arrays
+	ParticleStore& getStore();
+	const ParticleStore& getStore() const;
+	// Call after writing positions or velocities into the store between steps, so that the
+	// solvers and integrators drop what they kept from the old state
+	void markStoreModified();
+
+	// Copy what drawing needs of every particle, integrated or prescribed, into snapshot
+	void writeSnapshot(Snapshot& snapshot) const;
+
+	ParticleView getParticles();
 
-	void setElapsedYears(int elapsedYears);
+	// Look up a particle by id, returns a null reference if there is none. Both lookups
+	// are a constant time index into the stores.
+	ParticleRef findParticle(int id);
+	// Null as well if the particle of the handle was removed, even if its id was reused
+	ParticleRef findParticle(ParticleHandle handle);
+	bool isAlive(ParticleHandle handle) const;
 };
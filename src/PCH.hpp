@@ -1,11 +1,7 @@
 #ifndef PRECOMPILED_HEADER_HPP
 #define PRECOMPILED_HEADER_HPP
 
-#ifndef _DEBUG
-	#ifndef NDEBUG
-		#define NDEBUG
-	#endif
-#endif // _DEBUG
+#include "CorePCH.hpp"
 
 // SFML
 #include <SFML/Audio.hpp>
@@ -21,48 +17,4 @@
 	#endif
 #endif // SFML SYSTEM_LINUX
 
-// Typical stdafx.h
-#include <algorithm>
-#include <cstdio>
-#include <deque>
-#include <fstream>
-#include <iostream>
-#include <list>
-#include <map>
-#include <memory>
-#include <set>
-#include <string>
-#include <vector>
-
-// Additional C/C++ libs
-// #include <atomic>
-// #include <cassert>
-#include <cmath>
-// #include <cstdlib>
-// #include <exception>
-// #include <functional>
-// #include <iomanip>
-// #include <mutex>
-// #include <random>
-// #include <sstream>
-// #include <thread>
-// #include <type_traits>
-
-// Windows
-#ifdef _WIN32
-	#ifndef UNICODE
-		#define UNICODE
-	#endif
-
-	#ifndef _UNICODE
-		#define _UNICODE
-	#endif
-
-	#define WIN32_LEAN_AND_MEAN
-	#include <windows.h>
-#endif // _WIN32
-
-// Macros
-#define UNUSED(x) static_cast<void>(x)
-
 #endif // PRECOMPILED_HEADER_HPP
@@ -0,0 +1,165 @@
+#include "ParticleStore.hpp"
+#include "Objects.hpp"
+
+namespace
+{
+template <typename T>
+void gather(T& values, T& scratch, const std::vector<uint32_t>& order)
+{
+	scratch.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		scratch[i] = values[order[i]];
+	}
+	values.swap(scratch);
+}
+
+template <typename T>
+void removeSlots(T& values, const std::vector<uint32_t>& slots)
+{
+	// From the back, so that the last particle is never one that goes as well
+	for (auto slot = slots.rbegin(); slot != slots.rend(); ++slot)
+	{
+		values[*slot] = values.back();
+		values.pop_back();
+	}
+}
+}
+
+void ParticleStore::reserve(size_t count)
+{
+	for (Array* array : { &x, &y, &vx, &vy, &ax, &ay, &fx, &fy, &mass })
+	{
+		array->reserve(count);
+	}
+	radius.reserve(count);
+	id.reserve(count);
+	level.reserve(count);
+	testParticle.reserve(count);
+}
+
+void ParticleStore::clear()
+{
+	for (Array* array : { &x, &y, &vx, &vy, &ax, &ay, &fx, &fy, &mass })
+	{
+		array->clear();
+	}
+	radius.clear();
+	id.clear();
+	level.clear();
+	testParticle.clear();
+	slotById.clear();
+}
+
+size_t ParticleStore::add(int id, float radius, double mass, const Eigen::Vector2d& position, const Eigen::Vector2d& velocity, bool testParticle)
+{
+	x.push_back(position.x());
+	y.push_back(position.y());
+	vx.push_back(velocity.x());
+	vy.push_back(velocity.y());
+	ax.push_back(0.0);
+	ay.push_back(0.0);
+	fx.push_back(0.0);
+	fy.push_back(0.0);
+	this->mass.push_back(mass);
+	this->radius.push_back(radius);
+	this->id.push_back(id);
+	level.push_back(0);
+	this->testParticle.push_back(testParticle);
+	indexSlot(this->id.size() - 1);
+	return this->id.size() - 1;
+}
+
+size_t ParticleStore::add(const Particle& particle)
+{
+	return add(particle.getId(), particle.getRadius(), particle.getMass(), particle.getPosition(), particle.getVelocity(), particle.isTestParticle());
+}
+
+void ParticleStore::copyFrom(const ParticleStore& other, size_t count)
+{
+	auto copy = [count](auto& values, const auto& otherValues) {
+		values.assign(otherValues.begin(), otherValues.begin() + count);
+	};
+	copy(x, other.x);
+	copy(y, other.y);
+	copy(vx, other.vx);
+	copy(vy, other.vy);
+	copy(ax, other.ax);
+	copy(ay, other.ay);
+	copy(fx, other.fx);
+	copy(fy, other.fy);
+	copy(mass, other.mass);
+	copy(radius, other.radius);
+	copy(id, other.id);
+	copy(level, other.level);
+	copy(testParticle, other.testParticle);
+
+	slotById.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		indexSlot(i);
+	}
+}
+
+kernels::BodyState ParticleStore::getBodies(size_t begin, size_t end)
+{
+	return { x.data() + begin, y.data() + begin, vx.data() + begin, vy.data() + begin, ax.data() + begin, ay.data() + begin,
+		fx.data() + begin, fy.data() + begin, mass.data() + begin, end - begin };
+}
+
+void ParticleStore::permute(const std::vector<uint32_t>& order)
+{
+	for (Array* array : { &x, &y, &vx, &vy, &ax, &ay, &fx, &fy, &mass })
+	{
+		gather(*array, scratch, order);
+	}
+	gather(radius, scratchRadius, order);
+	gather(id, scratchId, order);
+	gather(level, scratchLevel, order);
+	gather(testParticle, scratchTestParticle, order);
+	for (size_t i = 0; i < size(); i++)
+	{
+		indexSlot(i);
+	}
+}
+
+void ParticleStore::remove(const std::vector<uint32_t>& slots)
+{
+	for (uint32_t slot : slots)
+	{
+		if (id[slot] >= 0)
+			slotById[id[slot]] = NO_SLOT;
+	}
+
+	for (Array* array : { &x, &y, &vx, &vy, &ax, &ay, &fx, &fy, &mass })
+	{
+		removeSlots(*array, slots);
+	}
+	removeSlots(radius, slots);
+	removeSlots(id, slots);
+	removeSlots(level, slots);
+	removeSlots(testParticle, slots);
+
+	// The particles moved into the freed slots
+	for (uint32_t slot : slots)
+	{
+		if (slot < size())
+			indexSlot(slot);
+	}
+}
+
+uint32_t ParticleStore::findSlot(int id) const
+{
+	if (id < 0 || static_cast<size_t>(id) >= slotById.size())
+		return NO_SLOT;
+	return slotById[id];
+}
+
+void ParticleStore::indexSlot(size_t slot)
+{
+	const int particleId = id[slot];
+	if (particleId < 0) return;
+	if (static_cast<size_t>(particleId) >= slotById.size())
+		slotById.resize(particleId + 1, NO_SLOT);
+	slotById[particleId] = slot;
+}
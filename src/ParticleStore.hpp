@@ -0,0 +1,134 @@
+#pragma once
+#include "Eigen/Dense"
+#include "Kernels.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+class Particle; // Forward declaration
+
+namespace util
+{
+// Allocator for arrays that SIMD kernels stream through, aligned to a cache line
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind
+	{
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T* pointer, size_t)
+	{
+		::operator delete(pointer, std::align_val_t(Alignment));
+	}
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const
+	{
+		return true;
+	}
+};
+}
+
+// Physics state of all particles as a structure of arrays, indexed by slot. The force solvers
+// and the integrator only touch these arrays; render state lives in side tables of the
+// ParticleSystem, keyed by id, so it is never dragged through the cache during a step.
+// Tree solvers permute the slots into Z-order, ids stay with their particle.
+struct ParticleStore
+{
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr uint32_t NO_SLOT = UINT32_MAX;
+	using Array = std::vector<double, util::AlignedAllocator<double, ALIGNMENT>>;
+
+	Array x;
+	Array y;
+	Array vx;
+	Array vy;
+
+	// Acceleration of the last integration step
+	Array ax;
+	Array ay;
+
+	// Forces accumulated for the next integration step
+	Array fx;
+	Array fy;
+
+	Array mass;
+
+	std::vector<float> radius;
+	std::vector<int> id;
+
+	// Block timestep level, the particle steps by dt / 2^level
+	std::vector<uint8_t> level;
+
+	// Test particles feel the massive bodies but pull on nothing, not even each other
+	std::vector<uint8_t> testParticle;
+
+	size_t size() const { return id.size(); }
+	bool empty() const { return id.empty(); }
+
+	void reserve(size_t count);
+	void clear();
+
+	// Append a particle and return its slot
+	size_t add(int id, float radius, double mass, const Eigen::Vector2d& position, const Eigen::Vector2d& velocity, bool testParticle = false);
+	size_t add(const Particle& particle);
+
+	// Make this store a copy of the first count slots of other
+	void copyFrom(const ParticleStore& other, size_t count);
+
+	// Move the particle in slot order[i] to slot i
+	void permute(const std::vector<uint32_t>& order);
+
+	// Remove the particles in the given slots, sorted ascending, by moving the last live
+	// particles into them. Costs one move per removed particle; the order is not kept.
+	void remove(const std::vector<uint32_t>& slots);
+
+	// Slot of the particle with this id, or NO_SLOT if it is not in the store. The index is
+	// kept up to date by every operation that moves particles.
+	uint32_t findSlot(int id) const;
+
+	// Pointers to the slots [begin, end) for the integration kernels
+	kernels::BodyState getBodies(size_t begin, size_t end);
+
+	Eigen::Vector2d getPosition(size_t slot) const { return Eigen::Vector2d(x[slot], y[slot]); }
+	Eigen::Vector2d getVelocity(size_t slot) const { return Eigen::Vector2d(vx[slot], vy[slot]); }
+	Eigen::Vector2d getAcceleration(size_t slot) const { return Eigen::Vector2d(ax[slot], ay[slot]); }
+	Eigen::Vector2d getForce(size_t slot) const { return Eigen::Vector2d(fx[slot], fy[slot]); }
+
+	// f / m of the force applied from outside; nothing moves a massless particle that way
+	Eigen::Vector2d getExternalAcceleration(size_t slot) const
+	{
+		return mass[slot] > 0.0 ? Eigen::Vector2d(getForce(slot) / mass[slot]) : Eigen::Vector2d::Zero();
+	}
+
+private:
+	// Slot of each id, indexed by id
+	std::vector<uint32_t> slotById;
+
+	void indexSlot(size_t slot);
+
+	// Reused by permute()
+	Array scratch;
+	std::vector<float> scratchRadius;
+	std::vector<int> scratchId;
+	std::vector<uint8_t> scratchLevel;
+	std::vector<uint8_t> scratchTestParticle;
+};
@@ -1,204 +1,761 @@
 #include "QuadTree.hpp"
-#include "Objects.hpp"
+#include "Kernels.hpp"
 #include "utils.hpp"
 #include <iostream>
+#include <atomic>
 #include <cmath>
 
-// QuadTreeNode Implementation
+namespace {
+
+// Spread the bits of a 32-bit value to the even bit positions of a 64-bit value
+uint64_t spreadBits(uint32_t value) {
+    uint64_t x = value;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+// Interleave x (even bits) and y (odd bits). Each pair of bits is then a quadrant:
+// 0: NW (top-left), 1: NE (top-right), 2: SW (bottom-left), 3: SE (bottom-right)
+// Note: In screen coordinates, y increases downward
+uint64_t mortonKey(uint32_t x, uint32_t y) {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Clamp a scaled coordinate into the 32-bit grid
+uint32_t quantize(double value) {
+    if (!(value > 0.0)) return 0;
+    if (value >= 4294967295.0) return 0xFFFFFFFFu;
+    return static_cast<uint32_t>(value);
+}
+
+// Bounds of quadrant `index` of the box [min, max]
+void getChildBounds(int index, const Eigen::Vector2d& min, const Eigen::Vector2d& max,
+    Eigen::Vector2d& childMin, Eigen::Vector2d& childMax) {
+    Eigen::Vector2d center = (min + max) / 2.0;
+    childMin.x() = (index & 1) ? center.x() : min.x();
+    childMax.x() = (index & 1) ? max.x() : center.x();
+    childMin.y() = (index & 2) ? center.y() : min.y();
+    childMax.y() = (index & 2) ? max.y() : center.y();
+}
+
+}
+
+// QuadTree Implementation
+
+QuadTree::QuadTree()
+    : boundsMin(Eigen::Vector2d::Zero()), boundsMax(Eigen::Vector2d::Zero()) {
+}
 
-QuadTreeNode::QuadTreeNode(const Eigen::Vector2d& min, const Eigen::Vector2d& max)
-    : boundsMin(min), boundsMax(max), centerOfMass(Eigen::Vector2d::Zero()),
-      totalMass(0.0), isLeaf(true) {
-    for (int i = 0; i < 4; i++) {
-        children[i] = nullptr;
+QuadTree::QuadTree(const Eigen::Vector2d& min, const Eigen::Vector2d& max)
+    : boundsMin(min), boundsMax(max) {
+}
+
+void QuadTree::setSettings(const TreeSettings& settings) {
+    const bool reshape = settings.bucketSize != this->settings.bucketSize;
+    this->settings = settings;
+    this->settings.bucketSize = std::max<uint32_t>(1, settings.bucketSize);
+
+    // A different bucket size gives a different tree, so the next refit must fail
+    if (reshape) {
+        clear();
+    } else if (!nodes.empty()) {
+        findGroups();
     }
 }
 
-double QuadTreeNode::getSize() const {
-    // Return the maximum dimension (width or height)
-    Eigen::Vector2d size = boundsMax - boundsMin;
-    return std::max(size.x(), size.y());
+void QuadTree::setBounds(const Eigen::Vector2d& min, const Eigen::Vector2d& max) {
+    boundsMin = min;
+    boundsMax = max;
+}
+
+void QuadTree::build(const ParticleStore& particles) {
+    util::ThreadPool serial(1);
+    build(particles, serial);
 }
 
-int QuadTreeNode::getChildIndex(const Eigen::Vector2d& pos) const {
-    Eigen::Vector2d center = (boundsMin + boundsMax) / 2.0;
+void QuadTree::build(const ParticleStore& particles, util::ThreadPool& pool) {
+    // Reset the arena; clear() keeps the capacity of the previous build
+    nodes.clear();
+    leafNodes.clear();
+    refitsSinceBuild = 0;
 
-    // Determine quadrant:
-    // 0: NW (top-left), 1: NE (top-right), 2: SW (bottom-left), 3: SE (bottom-right)
-    // Note: In screen coordinates, y increases downward
-    bool west = pos.x() < center.x();
-    bool north = pos.y() < center.y();
+    // Particles outside the root bounds are clamped into the border cells
+    particleIndices.resize(particles.size());
+    for (uint32_t i = 0; i < particles.size(); i++) {
+        particleIndices[i] = i;
+    }
+
+    const size_t count = particleIndices.size();
+    keys.resize(count);
+
+    // Quantize positions to 32 bits per axis and interleave them into Morton keys
+    const Eigen::Vector2d extent = boundsMax - boundsMin;
+    const double scaleX = extent.x() > 0.0 ? 4294967296.0 / extent.x() : 0.0;
+    const double scaleY = extent.y() > 0.0 ? 4294967296.0 / extent.y() : 0.0;
+    pool.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Eigen::Vector2d pos = particles.getPosition(particleIndices[i]);
+            keys[i] = mortonKey(quantize((pos.x() - boundsMin.x()) * scaleX), quantize((pos.y() - boundsMin.y()) * scaleY));
+        }
+    });
+
+    sortKeys(pool);
+
+    // Copy positions and masses into Z-order
+    bodyX.resize(count);
+    bodyY.resize(count);
+    bodyMass.resize(count);
+    bodyAcceleration.resize(count);
+    pool.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const uint32_t slot = particleIndices[i];
+            bodyX[i] = particles.x[slot];
+            bodyY[i] = particles.y[slot];
+            bodyMass[i] = particles.mass[slot];
+            bodyAcceleration[i] = std::hypot(particles.ax[slot], particles.ay[slot]);
+        }
+    });
 
-    if (north && west) return 0; // NW
-    if (north && !west) return 1; // NE
-    if (!north && west) return 2; // SW
-    return 3; // SE
+    // Derive the hierarchy from the sorted keys
+    buildNode(boundsMin, boundsMax, 0, count, 0);
+
+    // Compute mass distribution
+    nodeDirty.assign(nodes.size(), 1);
+    computeMassDistribution();
+    findGroups();
 }
 
-void QuadTreeNode::subdivide() {
-    if (!isLeaf) return;
+bool QuadTree::refit(const ParticleStore& particles, util::ThreadPool& pool) {
+    const uint32_t count = particleIndices.size();
+    if (nodes.empty() || particles.size() != count || refitsSinceBuild >= REFITS_BEFORE_REBUILD) {
+        return false;
+    }
+
+    // Pull in the new positions leaf by leaf and find the particles that left their cell
+    slotLeaf.resize(count);
+    std::atomic<uint32_t> migrants(0);
+    std::atomic<bool> escaped(false);
+    pool.parallelForDynamic(leafNodes.size(), 64, [&](size_t begin, size_t end) {
+        uint32_t localMigrants = 0;
+        for (size_t l = begin; l < end; l++) {
+            const uint32_t leaf = leafNodes[l];
+            const QuadTreeNode& node = nodes[leaf];
+            bool dirty = false;
+
+            for (uint32_t i = node.particleBegin; i < node.particleBegin + node.particleCount; i++) {
+                const uint32_t slot = particleIndices[i];
+                const Eigen::Vector2d pos = particles.getPosition(slot);
+                dirty |= pos.x() != bodyX[i] || pos.y() != bodyY[i] || particles.mass[slot] != bodyMass[i];
+                bodyX[i] = pos.x();
+                bodyY[i] = pos.y();
+                bodyMass[i] = particles.mass[slot];
+                bodyAcceleration[i] = std::hypot(particles.ax[slot], particles.ay[slot]);
+
+                slotLeaf[i] = leaf;
+                if (contains(node, pos)) continue;
+
+                if (!contains(nodes[0], pos)) {
+                    escaped = true;
+                    continue;
+                }
+
+                slotLeaf[i] = findLeaf(pos);
+                localMigrants++;
+                dirty = true;
+            }
+
+            nodeDirty[leaf] = dirty;
+        }
+        migrants += localMigrants;
+    });
 
-    Eigen::Vector2d center = (boundsMin + boundsMax) / 2.0;
+    if (escaped || migrants > REFIT_MAX_MIGRATION_FRACTION * count) {
+        return false;
+    }
 
-    // Create four children
-    // NW (0)
-    children[0] = std::make_unique<QuadTreeNode>(
-        Eigen::Vector2d(boundsMin.x(), boundsMin.y()),
-        Eigen::Vector2d(center.x(), center.y())
-    );
+    if (migrants > 0) {
+        migrateParticles();
 
-    // NE (1)
-    children[1] = std::make_unique<QuadTreeNode>(
-        Eigen::Vector2d(center.x(), boundsMin.y()),
-        Eigen::Vector2d(boundsMax.x(), center.y())
-    );
+        // Leaves that took in more particles than they may hold degrade the tree
+        uint32_t overfull = 0;
+        for (uint32_t leaf : leafNodes) {
+            const QuadTreeNode& node = nodes[leaf];
+            if (node.particleCount > settings.bucketSize && depthOf(leaf) < QuadTreeNode::MAX_DEPTH) {
+                overfull++;
+            }
+        }
+        if (overfull > REFIT_MAX_OVERFULL_FRACTION * leafNodes.size()) {
+            return false;
+        }
+    }
 
-    // SW (2)
-    children[2] = std::make_unique<QuadTreeNode>(
-        Eigen::Vector2d(boundsMin.x(), center.y()),
-        Eigen::Vector2d(center.x(), boundsMax.y())
-    );
+    computeMassDistribution();
+    if (migrants > 0) {
+        findGroups();
+    }
+    refitsSinceBuild++;
+    return true;
+}
 
-    // SE (3)
-    children[3] = std::make_unique<QuadTreeNode>(
-        Eigen::Vector2d(center.x(), center.y()),
-        Eigen::Vector2d(boundsMax.x(), boundsMax.y())
-    );
+bool QuadTree::contains(const QuadTreeNode& node, const Eigen::Vector2d& pos) const {
+    return pos.x() >= node.boundsMin.x() && pos.x() <= node.boundsMax.x()
+        && pos.y() >= node.boundsMin.y() && pos.y() <= node.boundsMax.y();
+}
 
-    // Redistribute particles to children
-    for (Particle* particle : particles) {
-        int childIdx = getChildIndex(particle->getPosition());
-        children[childIdx]->insert(particle);
+uint32_t QuadTree::findLeaf(const Eigen::Vector2d& pos) const {
+    uint32_t n = 0;
+    while (!nodes[n].isLeaf()) {
+        const QuadTreeNode& node = nodes[n];
+        const Eigen::Vector2d center = (node.boundsMin + node.boundsMax) / 2.0;
+        int quadrant = (pos.y() < center.y() ? 0 : 2) + (pos.x() < center.x() ? 0 : 1);
+
+        // Step over the preceding siblings
+        n = node.firstChild;
+        for (int q = 0; q < quadrant; q++) {
+            n = nodes[n].next;
+        }
     }
+    return n;
+}
 
-    particles.clear();
-    isLeaf = false;
+int QuadTree::depthOf(uint32_t n) const {
+    // Cells halve at every level, so the depth follows from the size ratio
+    return static_cast<int>(std::lround(std::log2(nodes[0].size / nodes[n].size)));
 }
 
-void QuadTreeNode::insert(Particle* particle) {
-    // Check if particle is within bounds (with some tolerance)
-    const Eigen::Vector2d& pos = particle->getPosition();
-    const double EPSILON = 1e-10;
+void QuadTree::migrateParticles() {
+    const uint32_t count = particleIndices.size();
 
-    if (pos.x() < boundsMin.x() - EPSILON || pos.x() > boundsMax.x() + EPSILON ||
-        pos.y() < boundsMin.y() - EPSILON || pos.y() > boundsMax.y() + EPSILON) {
-        // Particle is out of bounds - this shouldn't happen if bounds are set correctly
-        return;
+    // Count the new members of every leaf
+    nodeCursor.assign(nodes.size(), 0);
+    for (uint32_t i = 0; i < count; i++) {
+        nodeCursor[slotLeaf[i]]++;
     }
 
-    if (isLeaf) {
-        // Add particle to this leaf
-        particles.push_back(particle);
+    // Leaves appear in pre-order, which is also the order of their ranges
+    uint32_t offset = 0;
+    for (uint32_t leaf : leafNodes) {
+        QuadTreeNode& node = nodes[leaf];
+        if (node.particleCount != nodeCursor[leaf]) {
+            nodeDirty[leaf] = 1;
+        }
+        node.particleBegin = offset;
+        node.particleCount = nodeCursor[leaf];
+        nodeCursor[leaf] = offset;
+        offset += node.particleCount;
+    }
 
-        // If we exceed capacity, subdivide
-        if (particles.size() > MAX_PARTICLES_PER_NODE) {
-            subdivide();
+    // Stable scatter of the slots into their leaves' new ranges
+    scratchIndices.resize(count);
+    scratchX.resize(count);
+    scratchY.resize(count);
+    scratchMass.resize(count);
+    scratchAcceleration.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t destination = nodeCursor[slotLeaf[i]]++;
+        scratchIndices[destination] = particleIndices[i];
+        scratchX[destination] = bodyX[i];
+        scratchY[destination] = bodyY[i];
+        scratchMass[destination] = bodyMass[i];
+        scratchAcceleration[destination] = bodyAcceleration[i];
+    }
+    particleIndices.swap(scratchIndices);
+    bodyX.swap(scratchX);
+    bodyY.swap(scratchY);
+    bodyMass.swap(scratchMass);
+    bodyAcceleration.swap(scratchAcceleration);
+
+    // Internal ranges span their children
+    for (size_t n = nodes.size(); n-- > 0;) {
+        QuadTreeNode& node = nodes[n];
+        if (node.isLeaf()) continue;
+
+        node.particleBegin = nodes[node.firstChild].particleBegin;
+        node.particleCount = 0;
+        for (uint32_t c = node.firstChild; c < node.next; c = nodes[c].next) {
+            node.particleCount += nodes[c].particleCount;
         }
-    } else {
-        // Insert into appropriate child
-        int childIdx = getChildIndex(pos);
-        children[childIdx]->insert(particle);
     }
 }
 
-void QuadTreeNode::computeMassDistribution() {
-    if (isLeaf) {
-        // Compute center of mass for particles in this leaf
-        totalMass = 0.0;
-        centerOfMass = Eigen::Vector2d::Zero();
+void QuadTree::clear() {
+    nodes.clear();
+    leafNodes.clear();
+    particleIndices.clear();
+}
+
+void QuadTree::setSortedOrder() {
+    for (uint32_t i = 0; i < particleIndices.size(); i++) {
+        particleIndices[i] = i;
+    }
+}
+
+void QuadTree::sortKeys(util::ThreadPool& pool) {
+    const size_t count = keys.size();
+    scratchKeys.resize(count);
+    scratchIndices.resize(count);
+
+    // LSD radix sort, 8 bits per pass. Each thread histograms and scatters its own
+    // contiguous block, which keeps the sort stable.
+    const size_t blocks = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), count / RADIX_BLOCK_SIZE));
+    histograms.assign(blocks * 256, 0);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::fill(histograms.begin(), histograms.end(), 0);
 
-        for (Particle* particle : particles) {
-            double mass = particle->getMass();
-            totalMass += mass;
-            centerOfMass += particle->getPosition() * mass;
+        pool.parallelFor(blocks, [&](size_t blockBegin, size_t blockEnd) {
+            for (size_t block = blockBegin; block < blockEnd; block++) {
+                uint32_t* histogram = &histograms[block * 256];
+                for (size_t i = count * block / blocks; i < count * (block + 1) / blocks; i++) {
+                    histogram[(keys[i] >> shift) & 0xFF]++;
+                }
+            }
+        }, 1);
+
+        // Skip the pass when every key shares this digit
+        bool trivial = false;
+        for (int digit = 0; digit < 256 && !trivial; digit++) {
+            uint32_t total = 0;
+            for (size_t block = 0; block < blocks; block++) {
+                total += histograms[block * 256 + digit];
+            }
+            trivial = total == count;
+        }
+        if (trivial) continue;
+
+        // Exclusive prefix sum, digit-major so equal digits keep block order
+        uint32_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (size_t block = 0; block < blocks; block++) {
+                uint32_t bucket = histograms[block * 256 + digit];
+                histograms[block * 256 + digit] = offset;
+                offset += bucket;
+            }
         }
 
-        if (totalMass > 0.0) {
-            centerOfMass /= totalMass;
+        pool.parallelFor(blocks, [&](size_t blockBegin, size_t blockEnd) {
+            for (size_t block = blockBegin; block < blockEnd; block++) {
+                uint32_t* cursor = &histograms[block * 256];
+                for (size_t i = count * block / blocks; i < count * (block + 1) / blocks; i++) {
+                    uint32_t destination = cursor[(keys[i] >> shift) & 0xFF]++;
+                    scratchKeys[destination] = keys[i];
+                    scratchIndices[destination] = particleIndices[i];
+                }
+            }
+        }, 1);
+
+        keys.swap(scratchKeys);
+        particleIndices.swap(scratchIndices);
+    }
+}
+
+uint32_t QuadTree::buildNode(const Eigen::Vector2d& min, const Eigen::Vector2d& max,
+    uint32_t begin, uint32_t count, int depth) {
+    const uint32_t index = nodes.size();
+
+    QuadTreeNode node;
+    node.boundsMin = min;
+    node.boundsMax = max;
+    node.centerOfMass = Eigen::Vector2d::Zero();
+    node.totalMass = 0.0;
+    std::fill(std::begin(node.quadrupole), std::end(node.quadrupole), 0.0);
+    std::fill(std::begin(node.octupole), std::end(node.octupole), 0.0);
+    node.size = std::max(max.x() - min.x(), max.y() - min.y());
+    node.firstChild = QuadTreeNode::NONE;
+    node.next = index + 1;
+    node.particleBegin = begin;
+    node.particleCount = count;
+    nodes.push_back(node);
+
+    if (count <= settings.bucketSize || depth >= QuadTreeNode::MAX_DEPTH) {
+        leafNodes.push_back(index);
+        return index;
+    }
+
+    // The two key bits below this depth's prefix select the quadrant, and the
+    // keys are sorted, so each quadrant is a contiguous run found by bisection
+    const int shift = 62 - 2 * depth;
+    const auto first = keys.begin() + begin;
+    const auto last = first + count;
+    uint32_t quadrantBegin[5];
+    quadrantBegin[0] = begin;
+    quadrantBegin[4] = begin + count;
+    for (int q = 1; q < 4; q++) {
+        auto boundary = std::partition_point(first, last, [&](uint64_t key) {
+            return static_cast<int>((key >> shift) & 3) < q;
+        });
+        quadrantBegin[q] = boundary - keys.begin();
+    }
+
+    // Children follow their parent directly. Empty quadrants still get a leaf,
+    // so that a refit always has a cell to migrate particles into.
+    nodes[index].firstChild = index + 1;
+    for (int q = 0; q < 4; q++) {
+        uint32_t quadrantCount = quadrantBegin[q + 1] - quadrantBegin[q];
+
+        Eigen::Vector2d childMin, childMax;
+        getChildBounds(q, min, max, childMin, childMax);
+        buildNode(childMin, childMax, quadrantBegin[q], quadrantCount, depth + 1);
+    }
+
+    nodes[index].next = nodes.size();
+    return index;
+}
+
+void QuadTree::computeMassDistribution() {
+    // Children always follow their parent, so a reverse sweep visits them first.
+    // Only nodes on the path above a dirty leaf are recomputed.
+    for (size_t n = nodes.size(); n-- > 0;) {
+        QuadTreeNode& node = nodes[n];
+        if (!node.isLeaf()) {
+            for (uint32_t c = node.firstChild; c < node.next && !nodeDirty[n]; c = nodes[c].next) {
+                nodeDirty[n] = nodeDirty[c];
+            }
         }
-    } else {
-        // Recursively compute for children
-        totalMass = 0.0;
-        centerOfMass = Eigen::Vector2d::Zero();
-
-        for (int i = 0; i < 4; i++) {
-            if (children[i]) {
-                children[i]->computeMassDistribution();
-                double childMass = children[i]->totalMass;
+        if (!nodeDirty[n]) continue;
+
+        double totalMass = 0.0;
+        Eigen::Vector2d centerOfMass = Eigen::Vector2d::Zero();
+        double quadrupole[3] = { 0.0, 0.0, 0.0 };
+        double octupole[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        if (node.isLeaf()) {
+            // Compute center of mass for particles in this leaf
+            for (uint32_t i = node.particleBegin; i < node.particleBegin + node.particleCount; i++) {
+                totalMass += bodyMass[i];
+                centerOfMass += Eigen::Vector2d(bodyX[i], bodyY[i]) * bodyMass[i];
+            }
+            if (totalMass > 0.0) {
+                centerOfMass /= totalMass;
+            }
+
+            // Then the moments about it
+            for (uint32_t i = node.particleBegin; i < node.particleBegin + node.particleCount; i++) {
+                const double tx = bodyX[i] - centerOfMass.x();
+                const double ty = bodyY[i] - centerOfMass.y();
+                const double m = bodyMass[i];
+                quadrupole[0] += m * tx * tx;
+                quadrupole[1] += m * tx * ty;
+                quadrupole[2] += m * ty * ty;
+                octupole[0] += m * tx * tx * tx;
+                octupole[1] += m * tx * tx * ty;
+                octupole[2] += m * tx * ty * ty;
+                octupole[3] += m * ty * ty * ty;
+            }
+        } else {
+            // Accumulate the already computed children
+            for (uint32_t c = node.firstChild; c < node.next; c = nodes[c].next) {
+                double childMass = nodes[c].totalMass;
                 if (childMass > 0.0) {
                     totalMass += childMass;
-                    centerOfMass += children[i]->centerOfMass * childMass;
+                    centerOfMass += nodes[c].centerOfMass * childMass;
                 }
             }
-        }
+            if (totalMass > 0.0) {
+                centerOfMass /= totalMass;
+            }
 
-        if (totalMass > 0.0) {
-            centerOfMass /= totalMass;
+            // Shift the children's moments to the new center (parallel-axis theorem).
+            // Their first moments vanish about their own centers of mass.
+            for (uint32_t c = node.firstChild; c < node.next; c = nodes[c].next) {
+                const QuadTreeNode& child = nodes[c];
+                if (child.totalMass == 0.0) continue;
+
+                const double dx = child.centerOfMass.x() - centerOfMass.x();
+                const double dy = child.centerOfMass.y() - centerOfMass.y();
+                const double m = child.totalMass;
+                const double* q = child.quadrupole;
+                quadrupole[0] += q[0] + m * dx * dx;
+                quadrupole[1] += q[1] + m * dx * dy;
+                quadrupole[2] += q[2] + m * dy * dy;
+                octupole[0] += child.octupole[0] + 3.0 * q[0] * dx + m * dx * dx * dx;
+                octupole[1] += child.octupole[1] + q[0] * dy + 2.0 * q[1] * dx + m * dx * dx * dy;
+                octupole[2] += child.octupole[2] + q[2] * dx + 2.0 * q[1] * dy + m * dx * dy * dy;
+                octupole[3] += child.octupole[3] + 3.0 * q[2] * dy + m * dy * dy * dy;
+            }
         }
+
+        node.totalMass = totalMass;
+        node.centerOfMass = centerOfMass;
+        std::copy(std::begin(quadrupole), std::end(quadrupole), node.quadrupole);
+        std::copy(std::begin(octupole), std::end(octupole), node.octupole);
     }
+
+    std::fill(nodeDirty.begin(), nodeDirty.end(), 0);
 }
 
-Eigen::Vector2d QuadTreeNode::calculateForce(const Particle& particle) const {
-    // If this node has no mass, no force
-    if (totalMass == 0.0) {
-        return Eigen::Vector2d::Zero();
+Eigen::Vector2d QuadTree::calculateForce(const Eigen::Vector2d& position, double mass) const {
+    TreeStatistics walkStatistics;
+    return walk(position, 0.0, walkStatistics) * mass;
+}
+
+bool QuadTree::acceptNode(const QuadTreeNode& node, const Eigen::Vector2d& boxMin, const Eigen::Vector2d& boxMax,
+    double distance, double acceleration) const {
+    const double ratio = node.size / distance;
+
+    if (settings.openingCriterion == OpeningCriterion::Relative && acceleration > 0.0) {
+        // Targets within RELATIVE_GUARD sizes of the node's center always open it, since the
+        // error estimate assumes the target is outside the node's mass distribution
+        const Eigen::Vector2d center = (node.boundsMin + node.boundsMax) / 2.0;
+        const double reach = RELATIVE_GUARD * node.size;
+        if (boxMax.x() > center.x() - reach && boxMin.x() < center.x() + reach
+            && boxMax.y() > center.y() - reach && boxMin.y() < center.y() + reach) {
+            return false;
+        }
+
+        // The first neglected term of the expansion is about G M / d^2 (s / d)^(order + 1)
+        const int exponent = settings.multipoleOrder == MultipoleOrder::Monopole ? 2
+            : settings.multipoleOrder == MultipoleOrder::Quadrupole ? 3 : 4;
+        const double error = constants::G * node.totalMass / (distance * distance) * std::pow(ratio, exponent);
+        return error <= settings.errorTolerance * acceleration;
     }
 
-    Eigen::Vector2d particlePos = particle.getPosition();
-    Eigen::Vector2d direction = centerOfMass - particlePos;
-    double distance = direction.norm();
+    // Barnes-Hut criterion: s/d < theta, except for nodes holding the target itself. Above
+    // theta = 1/sqrt(2) a node can pass the test from inside, and its expansion would then
+    // include the target's own mass.
+    if (ratio >= settings.theta) return false;
+    return boxMax.x() < node.boundsMin.x() || boxMin.x() > node.boundsMax.x()
+        || boxMax.y() < node.boundsMin.y() || boxMin.y() > node.boundsMax.y();
+}
+
+Eigen::Vector2d QuadTree::walk(const Eigen::Vector2d& position, double previousAcceleration, TreeStatistics& walkStatistics) const {
+    double totalX = 0.0;
+    double totalY = 0.0;
+
+    // Stackless walk: opening a node moves to its first child, accepting or
+    // skipping it jumps past its subtree, so memory is read front to back
+    uint32_t n = 0;
+    const uint32_t end = nodes.size();
+    while (n < end) {
+        const QuadTreeNode& node = nodes[n];
+
+        // If this node has no mass, no force
+        if (node.totalMass == 0.0) {
+            n = node.next;
+            continue;
+        }
 
-    // Avoid self-interaction and division by zero
-    const double MIN_DISTANCE = 1e3; // Minimum distance to avoid singularity
-    if (distance < MIN_DISTANCE) {
-        return Eigen::Vector2d::Zero();
+        const double distance = (node.centerOfMass - position).norm();
+
+        if (acceptNode(node, position, position, distance, previousAcceleration)) {
+            // We're far enough away, use the node's expansion about its center of mass
+            const bool octupole = settings.multipoleOrder == MultipoleOrder::Octupole;
+            const kernels::CellList cell = {
+                &node.centerOfMass.x(), &node.centerOfMass.y(), &node.totalMass,
+                &node.quadrupole[0], &node.quadrupole[1], &node.quadrupole[2],
+                octupole ? &node.octupole[0] : nullptr, &node.octupole[1], &node.octupole[2], &node.octupole[3],
+                1
+            };
+            if (settings.multipoleOrder == MultipoleOrder::Monopole) {
+                kernels::accumulateAcceleration(position.x(), position.y(), cell.x, cell.y, cell.mass, 1, 0.0, totalX, totalY);
+            } else {
+                kernels::accumulateCellAcceleration(position.x(), position.y(), cell, totalX, totalY);
+            }
+            walkStatistics.cellInteractions++;
+            n = node.next;
+        } else if (node.isLeaf()) {
+            // Sum the leaf's bucket directly, its bodies are contiguous in the sorted arrays.
+            // The kernel skips bodies within MIN_DISTANCE, which avoids self-interaction.
+            kernels::accumulateAcceleration(position.x(), position.y(), &bodyX[node.particleBegin], &bodyY[node.particleBegin],
+                &bodyMass[node.particleBegin], node.particleCount, QuadTreeNode::MIN_DISTANCE, totalX, totalY);
+            walkStatistics.bodyInteractions += node.particleCount;
+            n = node.next;
+        } else {
+            // We're too close - need to check children
+            walkStatistics.nodesOpened++;
+            n = node.firstChild;
+        }
     }
 
-    // Barnes-Hut criterion: s/d < theta
-    double s = getSize();
-    double ratio = s / distance;
+    return Eigen::Vector2d(totalX, totalY);
+}
 
-    if (isLeaf || ratio < THETA) {
-        // Either this is a leaf with single particle, or we're far enough away
-        // Treat as single body at center of mass
-        double forceMagnitude = constants::G * totalMass * particle.getMass() / (distance * distance);
-        return forceMagnitude * direction.normalized();
-    } else {
-        // We're too close - need to check children
-        Eigen::Vector2d totalForce = Eigen::Vector2d::Zero();
-        for (int i = 0; i < 4; i++) {
-            if (children[i]) {
-                totalForce += children[i]->calculateForce(particle);
+void QuadTree::findGroups() {
+    groupNodes.clear();
+
+    uint32_t n = 0;
+    const uint32_t end = nodes.size();
+    while (n < end) {
+        const QuadTreeNode& node = nodes[n];
+        if (node.particleCount <= settings.groupSize || node.isLeaf()) {
+            if (node.particleCount > 0) {
+                groupNodes.push_back(n);
             }
+            n = node.next;
+        } else {
+            n = node.firstChild;
         }
-        return totalForce;
     }
 }
 
-// QuadTree Implementation
+void QuadTree::calculateAccelerations(std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) {
+    accelerations.resize(particleIndices.size());
+
+    // Each chunk counts on its own and adds its counts once
+    std::atomic<uint64_t> cellInteractions(0);
+    std::atomic<uint64_t> bodyInteractions(0);
+    std::atomic<uint64_t> nodesOpened(0);
+    auto addStatistics = [&](const TreeStatistics& chunkStatistics) {
+        cellInteractions += chunkStatistics.cellInteractions;
+        bodyInteractions += chunkStatistics.bodyInteractions;
+        nodesOpened += chunkStatistics.nodesOpened;
+    };
+
+    if (settings.traversal == TreeTraversal::PerParticle) {
+        pool.parallelForDynamic(particleIndices.size(), WALK_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            TreeStatistics chunkStatistics;
+            for (size_t i = begin; i < end; i++) {
+                accelerations[particleIndices[i]] = walk(Eigen::Vector2d(bodyX[i], bodyY[i]), bodyAcceleration[i], chunkStatistics);
+            }
+            addStatistics(chunkStatistics);
+        });
+    } else {
+        pool.parallelForDynamic(groupNodes.size(), 4, [&](size_t begin, size_t end) {
+            TreeStatistics chunkStatistics;
+            InteractionList list;
+            for (size_t g = begin; g < end; g++) {
+                calculateGroupAccelerations(groupNodes[g], list, accelerations, chunkStatistics);
+            }
+            addStatistics(chunkStatistics);
+        });
+    }
 
-QuadTree::QuadTree(const Eigen::Vector2d& min, const Eigen::Vector2d& max)
-    : boundsMin(min), boundsMax(max) {
-    root = std::make_unique<QuadTreeNode>(min, max);
+    statistics.cellInteractions = cellInteractions;
+    statistics.bodyInteractions = bodyInteractions;
+    statistics.nodesOpened = nodesOpened;
+}
+
+void QuadTree::calculateAccelerations(const ParticleStore& particles, const std::vector<uint32_t>& targets,
+    std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool) {
+    accelerations.resize(particles.size());
+
+    std::atomic<uint64_t> cellInteractions(0);
+    std::atomic<uint64_t> bodyInteractions(0);
+    std::atomic<uint64_t> nodesOpened(0);
+    pool.parallelForDynamic(targets.size(), WALK_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        TreeStatistics chunkStatistics;
+        for (size_t t = begin; t < end; t++) {
+            const uint32_t slot = targets[t];
+            const double previousAcceleration = std::hypot(particles.ax[slot], particles.ay[slot]);
+            accelerations[slot] = walk(particles.getPosition(slot), previousAcceleration, chunkStatistics);
+        }
+        cellInteractions += chunkStatistics.cellInteractions;
+        bodyInteractions += chunkStatistics.bodyInteractions;
+        nodesOpened += chunkStatistics.nodesOpened;
+    });
+
+    statistics.cellInteractions = cellInteractions;
+    statistics.bodyInteractions = bodyInteractions;
+    statistics.nodesOpened = nodesOpened;
 }
 
-void QuadTree::build(std::vector<Particle>& particles) {
-    // Clear and rebuild the tree
-    root = std::make_unique<QuadTreeNode>(boundsMin, boundsMax);
+void QuadTree::InteractionList::clear() {
+    x.clear();
+    y.clear();
+    mass.clear();
+    cellX.clear();
+    cellY.clear();
+    cellMass.clear();
+    for (std::vector<double>& moment : quadrupole) moment.clear();
+    for (std::vector<double>& moment : octupole) moment.clear();
+}
 
-    // Insert all particles
-    for (Particle& particle : particles) {
-        root->insert(&particle);
+void QuadTree::appendCell(const QuadTreeNode& node, InteractionList& list) const {
+    if (settings.multipoleOrder == MultipoleOrder::Monopole) {
+        list.x.push_back(node.centerOfMass.x());
+        list.y.push_back(node.centerOfMass.y());
+        list.mass.push_back(node.totalMass);
+        return;
     }
 
-    // Compute mass distribution
-    root->computeMassDistribution();
+    list.cellX.push_back(node.centerOfMass.x());
+    list.cellY.push_back(node.centerOfMass.y());
+    list.cellMass.push_back(node.totalMass);
+    for (int k = 0; k < 3; k++) list.quadrupole[k].push_back(node.quadrupole[k]);
+    if (settings.multipoleOrder == MultipoleOrder::Octupole) {
+        for (int k = 0; k < 4; k++) list.octupole[k].push_back(node.octupole[k]);
+    }
 }
 
-Eigen::Vector2d QuadTree::calculateForce(const Particle& particle) const {
-    if (!root) {
-        return Eigen::Vector2d::Zero();
+void QuadTree::calculateGroupAccelerations(uint32_t group, InteractionList& list, std::vector<Eigen::Vector2d>& accelerations,
+    TreeStatistics& walkStatistics) const {
+    const QuadTreeNode& groupNode = nodes[group];
+    const uint32_t groupBegin = groupNode.particleBegin;
+    const uint32_t groupEnd = groupBegin + groupNode.particleCount;
+
+    // Bounding box of the group's particles, which is tighter than its cell,
+    // and the weakest previous acceleration in the group
+    Eigen::Vector2d boxMin(bodyX[groupBegin], bodyY[groupBegin]);
+    Eigen::Vector2d boxMax = boxMin;
+    double previousAcceleration = bodyAcceleration[groupBegin];
+    for (uint32_t i = groupBegin; i < groupEnd; i++) {
+        boxMin = boxMin.cwiseMin(Eigen::Vector2d(bodyX[i], bodyY[i]));
+        boxMax = boxMax.cwiseMax(Eigen::Vector2d(bodyX[i], bodyY[i]));
+        previousAcceleration = std::min(previousAcceleration, bodyAcceleration[i]);
     }
-    return root->calculateForce(particle);
-}
 
+    // One walk for the whole group. A node is accepted if it passes the opening test
+    // for the closest point of the box, and thus for every particle in the group.
+    list.clear();
+
+    // Counted here rather than from the list, which holds monopole cells among the bodies
+    uint64_t cellCount = 0;
+    uint64_t bodyCount = 0;
+
+    uint32_t n = 0;
+    const uint32_t end = nodes.size();
+    while (n < end) {
+        const QuadTreeNode& node = nodes[n];
+
+        if (node.totalMass == 0.0) {
+            n = node.next;
+            continue;
+        }
+
+        const Eigen::Vector2d gap = (boxMin - node.centerOfMass).cwiseMax(node.centerOfMass - boxMax).cwiseMax(0.0);
+        const double distance = gap.norm();
+
+        if (acceptNode(node, boxMin, boxMax, distance, previousAcceleration)) {
+            appendCell(node, list);
+            cellCount++;
+            n = node.next;
+        } else if (node.isLeaf()) {
+            // Opened buckets are copied whole, they are contiguous in the sorted arrays
+            const uint32_t leafBegin = node.particleBegin;
+            const uint32_t leafEnd = leafBegin + node.particleCount;
+            list.x.insert(list.x.end(), bodyX.begin() + leafBegin, bodyX.begin() + leafEnd);
+            list.y.insert(list.y.end(), bodyY.begin() + leafBegin, bodyY.begin() + leafEnd);
+            list.mass.insert(list.mass.end(), bodyMass.begin() + leafBegin, bodyMass.begin() + leafEnd);
+            bodyCount += node.particleCount;
+            n = node.next;
+        } else {
+            walkStatistics.nodesOpened++;
+            n = node.firstChild;
+        }
+    }
+
+    const uint32_t groupCount = groupEnd - groupBegin;
+    walkStatistics.cellInteractions += cellCount * groupCount;
+    walkStatistics.bodyInteractions += bodyCount * groupCount;
+
+    const bool octupole = settings.multipoleOrder == MultipoleOrder::Octupole;
+    const kernels::CellList cells = {
+        list.cellX.data(), list.cellY.data(), list.cellMass.data(),
+        list.quadrupole[0].data(), list.quadrupole[1].data(), list.quadrupole[2].data(),
+        octupole ? list.octupole[0].data() : nullptr, list.octupole[1].data(), list.octupole[2].data(), list.octupole[3].data(),
+        list.cellX.size()
+    };
+
+    for (uint32_t i = groupBegin; i < groupEnd; i++) {
+        double ax = 0.0;
+        double ay = 0.0;
+        kernels::accumulateAcceleration(bodyX[i], bodyY[i], list.x.data(), list.y.data(), list.mass.data(), list.x.size(),
+            QuadTreeNode::MIN_DISTANCE, ax, ay);
+        kernels::accumulateCellAcceleration(bodyX[i], bodyY[i], cells, ax, ay);
+        accelerations[particleIndices[i]] = Eigen::Vector2d(ax, ay);
+    }
+}
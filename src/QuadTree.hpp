@@ -1,21 +1,35 @@
 #pragma once
 #include "Eigen/Dense"
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+#include <cstdint>
 #include <vector>
-#include <memory>
 
-class Particle; // Forward declaration
 
-class QuadTreeNode {
-public:
+// A node of the flat quadtree.
+// Nodes live in one array in depth-first (pre-order) layout, so the subtree
+// of a node occupies the index range [self, next) and its first child, if
+// any, is stored directly after it.
+struct QuadTreeNode {
     // Barnes-Hut threshold parameter
     // If s/d < theta, treat node as single body
     // Typical values: 0.5 (accurate) to 1.0 (fast)
     static constexpr double THETA = 0.5;
 
-    // Maximum particles per leaf node before subdivision
-    static constexpr int MAX_PARTICLES_PER_NODE = 1;
+    // Default maximum particles per leaf node before subdivision. Leaves are summed
+    // directly with the SIMD kernel, so a bucket of a few vector widths is cheaper
+    // than the deeper tree that single-particle leaves need.
+    static constexpr uint32_t MAX_PARTICLES_PER_NODE = 16;
+
+    // Leaves at this depth are never subdivided; matches the 32-bit per axis Morton keys
+    static constexpr int MAX_DEPTH = 32;
+
+    // Minimum distance to avoid self-interaction and the singularity
+    static constexpr double MIN_DISTANCE = 1e3;
+
+    // Marks a missing child index
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
 
-private:
     // Spatial bounds [min, max]
     Eigen::Vector2d boundsMin;
     Eigen::Vector2d boundsMax;
@@ -24,56 +38,268 @@ private:
     Eigen::Vector2d centerOfMass;
     double totalMass;
 
-    // Particles in this node (only used if isLeaf)
-    std::vector<Particle*> particles;
+    // Moments about the center of mass: sum of m t_i t_j as xx, xy, yy,
+    // and sum of m t_i t_j t_k as xxx, xxy, xyy, yyy
+    double quadrupole[3];
+    double octupole[4];
 
-    // Four children: [NW, NE, SW, SE]
-    std::unique_ptr<QuadTreeNode> children[4];
+    // Width of the node (maximum of width and height)
+    double size;
 
-    bool isLeaf;
+    // Index of the first child, or NONE for leaves
+    uint32_t firstChild;
 
-    // Helper to get child index for a position
-    int getChildIndex(const Eigen::Vector2d& pos) const;
+    // Index of the first node after this subtree
+    uint32_t next;
 
-    // Subdivide this node into 4 children
-    void subdivide();
+    // Range of this subtree's particles in the tree's sorted particle arrays.
+    // Internal nodes always have four children, empty quadrants are empty leaves.
+    uint32_t particleBegin;
+    uint32_t particleCount;
 
-public:
-    QuadTreeNode(const Eigen::Vector2d& min, const Eigen::Vector2d& max);
+    bool isLeaf() const { return firstChild == NONE; }
 
-    // Insert a particle into the tree
-    void insert(Particle* particle);
+    // Get size (width of node)
+    double getSize() const { return size; }
+};
 
-    // Compute center of mass for this node and all children
-    void computeMassDistribution();
+// How the force walk visits the tree
+enum class TreeTraversal {
+    // One walk per particle
+    PerParticle,
 
-    // Calculate force on a particle using Barnes-Hut approximation
-    Eigen::Vector2d calculateForce(const Particle& particle) const;
+    // One walk per group of nearby particles. The walk opens nodes against the group's
+    // bounding box, which is slightly conservative, and the resulting interaction list
+    // is evaluated for the whole group with a SIMD kernel.
+    Group
+};
 
-    // Get bounds
-    Eigen::Vector2d getBoundsMin() const { return boundsMin; }
-    Eigen::Vector2d getBoundsMax() const { return boundsMax; }
+// Highest moment used for accepted nodes
+enum class MultipoleOrder {
+    Monopole,
+    Quadrupole,
+    Octupole
+};
 
-    // Get size (width of node)
-    double getSize() const;
+// When the walk may use a node's expansion instead of opening it
+enum class OpeningCriterion {
+    // size / distance < theta
+    Geometric,
+
+    // Estimated error of the expansion below errorTolerance times the particle's acceleration in
+    // the previous step, as in Gadget. Particles without a previous acceleration use the geometric test.
+    Relative
+};
+
+struct TreeSettings {
+    // Barnes-Hut opening angle. Quadrupoles at 0.8 are about as accurate as monopoles at
+    // QuadTreeNode::THETA, and open far fewer nodes.
+    double theta = 0.8;
+
+    MultipoleOrder multipoleOrder = MultipoleOrder::Quadrupole;
+
+    OpeningCriterion openingCriterion = OpeningCriterion::Geometric;
+
+    // Allowed force error of one node relative to the total, for the relative criterion
+    double errorTolerance = 0.0025;
+
+    TreeTraversal traversal = TreeTraversal::Group;
+
+    // Largest number of particles sharing one group walk
+    uint32_t groupSize = 32;
+
+    // Largest number of particles in a leaf, typically 8 to 64. Changing it discards the
+    // current tree, it takes effect at the next build.
+    uint32_t bucketSize = QuadTreeNode::MAX_PARTICLES_PER_NODE;
+};
+
+// Work done by the last force walk, summed over all particles
+struct TreeStatistics {
+    // Nodes used through their expansion
+    uint64_t cellInteractions = 0;
+
+    // Particles of opened leaves
+    uint64_t bodyInteractions = 0;
+
+    // Internal nodes opened; a group walk counts once for all of its particles
+    uint64_t nodesOpened = 0;
 };
 
 class QuadTree {
 private:
-    std::unique_ptr<QuadTreeNode> root;
+    TreeSettings settings;
+    TreeStatistics statistics;
+
+    // All nodes in pre-order; the root is nodes[0]
+    std::vector<QuadTreeNode> nodes;
+
+    // Particle indices sorted in Morton (Z-curve) order, so every node owns a contiguous range
+    std::vector<uint32_t> particleIndices;
+
+    // Morton keys matching particleIndices, only valid during a build
+    std::vector<uint64_t> keys;
+
+    // Leaf node indices in pre-order
+    std::vector<uint32_t> leafNodes;
+
+    // Per-node flag: the mass distribution must be recomputed
+    std::vector<uint8_t> nodeDirty;
+
+    // Refit state: destination leaf per sorted slot, and per-node scatter cursors
+    std::vector<uint32_t> slotLeaf;
+    std::vector<uint32_t> nodeCursor;
+    std::vector<double> scratchX;
+    std::vector<double> scratchY;
+    std::vector<double> scratchMass;
+    std::vector<double> scratchAcceleration;
+
+    int refitsSinceBuild = 0;
+
+    // Nodes whose particles share one walk in group traversal
+    std::vector<uint32_t> groupNodes;
+
+    // Scratch of one group walk, in structure-of-arrays layout for the kernels
+    struct InteractionList {
+        // Particles of opened leaves, and accepted nodes if only monopoles are used
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> mass;
+
+        // Accepted nodes with their higher moments
+        std::vector<double> cellX;
+        std::vector<double> cellY;
+        std::vector<double> cellMass;
+        std::vector<double> quadrupole[3];
+        std::vector<double> octupole[4];
+
+        void clear();
+    };
+
+    // Positions and masses copied in sorted order, so that leaf ranges are contiguous in memory
+    std::vector<double> bodyX;
+    std::vector<double> bodyY;
+    std::vector<double> bodyMass;
+
+    // Magnitude of each particle's acceleration in the previous step, in sorted order
+    std::vector<double> bodyAcceleration;
+
+    // Scratch buffers for the radix sort, kept to avoid reallocation
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchIndices;
+    std::vector<uint32_t> histograms;
+
+    // Minimum number of keys per radix sort block
+    static constexpr size_t RADIX_BLOCK_SIZE = 4096;
+
     Eigen::Vector2d boundsMin;
     Eigen::Vector2d boundsMax;
 
+    // Sort keys and particleIndices by key
+    void sortKeys(util::ThreadPool& pool);
+
+    // Recursively split the sorted range [begin, begin + count) into a subtree, returns the node index
+    uint32_t buildNode(const Eigen::Vector2d& min, const Eigen::Vector2d& max,
+        uint32_t begin, uint32_t count, int depth);
+
+    // Compute center of mass for dirty nodes, children before parents
+    void computeMassDistribution();
+
+    bool contains(const QuadTreeNode& node, const Eigen::Vector2d& pos) const;
+
+    // Leaf whose cell contains pos
+    uint32_t findLeaf(const Eigen::Vector2d& pos) const;
+
+    int depthOf(uint32_t node) const;
+
+    // Move every slot into the leaf recorded in slotLeaf, keeping the tree's shape
+    void migrateParticles();
+
+    // Whether a target inside the box [boxMin, boxMax], at distance from the node's center of mass,
+    // may use the node's expansion. acceleration is the smallest previous acceleration in the box, 0 if unknown.
+    bool acceptNode(const QuadTreeNode& node, const Eigen::Vector2d& boxMin, const Eigen::Vector2d& boxMax,
+        double distance, double acceleration) const;
+
+    // Walk the tree for one target and return its acceleration
+    Eigen::Vector2d walk(const Eigen::Vector2d& position, double previousAcceleration, TreeStatistics& walkStatistics) const;
+
+    // Collect the largest nodes holding at most settings.groupSize particles
+    void findGroups();
+
+    // Walk the tree for one group and evaluate the interaction list for its particles
+    void calculateGroupAccelerations(uint32_t group, InteractionList& list, std::vector<Eigen::Vector2d>& accelerations,
+        TreeStatistics& walkStatistics) const;
+
+    // Add a node's expansion, up to the order in the settings, to the list
+    void appendCell(const QuadTreeNode& node, InteractionList& list) const;
+
 public:
+    // A refit gives up and asks for a rebuild when more than this fraction of particles left their cell
+    static constexpr double REFIT_MAX_MIGRATION_FRACTION = 0.05;
+
+    // ... or when more than this fraction of leaves hold more than settings.bucketSize
+    static constexpr double REFIT_MAX_OVERFULL_FRACTION = 0.1;
+
+    // ... or after this many refits in a row, to restore a clean Z-order
+    static constexpr int REFITS_BEFORE_REBUILD = 32;
+
+    // Particles per work item in the parallel per-particle walk. Small enough that dense
+    // clumps, which cost far more per particle, are spread over all threads.
+    static constexpr size_t WALK_CHUNK_SIZE = 64;
+
+    // The relative criterion opens every node whose center is within this many node sizes
+    // of the target in both axes
+    static constexpr double RELATIVE_GUARD = 0.6;
+
+    QuadTree();
     QuadTree(const Eigen::Vector2d& min, const Eigen::Vector2d& max);
 
-    // Build tree from particles
-    void build(std::vector<Particle>& particles);
+    // Set the root bounds used by the next build
+    void setBounds(const Eigen::Vector2d& min, const Eigen::Vector2d& max);
+
+    // Build tree from particles, reusing the storage of the previous build
+    void build(const ParticleStore& particles);
+    void build(const ParticleStore& particles, util::ThreadPool& pool);
+
+    // Update the tree of the previous build for moved particles: particles that left their
+    // cell migrate to the leaf now containing them and dirty nodes get their mass
+    // distribution recomputed. Returns false, leaving the tree unusable, when the particle
+    // count changed, a particle left the root bounds, or the tree degraded too far;
+    // the caller must then build() again.
+    bool refit(const ParticleStore& particles, util::ThreadPool& pool);
+
+    // Drop the tree so the next refit fails
+    void clear();
+
+    // Tell the tree the particle storage was permuted into its sorted order
+    void setSortedOrder();
+
+    void setSettings(const TreeSettings& settings);
+    const TreeSettings& getSettings() const { return settings; }
 
     // Calculate force on a particle using the tree
-    Eigen::Vector2d calculateForce(const Particle& particle) const;
+    Eigen::Vector2d calculateForce(const Eigen::Vector2d& position, double mass) const;
+
+    // Calculate the acceleration of every particle in the tree, indexed like the particles
+    // passed to build(), using the traversal selected in the settings
+    void calculateAccelerations(std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool);
+
+    // Calculate the acceleration of the particles in the given slots only, with one walk
+    // each, for particles the tree was built or refitted from; other entries are left alone
+    void calculateAccelerations(const ParticleStore& particles, const std::vector<uint32_t>& targets,
+        std::vector<Eigen::Vector2d>& accelerations, util::ThreadPool& pool);
+
+    // Counts of the last calculateAccelerations()
+    const TreeStatistics& getStatistics() const { return statistics; }
 
     // Get root node (for debugging/visualization)
-    const QuadTreeNode* getRoot() const { return root.get(); }
-};
+    const QuadTreeNode* getRoot() const { return nodes.empty() ? nullptr : &nodes[0]; }
 
+    const std::vector<QuadTreeNode>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getParticleIndices() const { return particleIndices; }
+    const std::vector<uint32_t>& getLeafNodes() const { return leafNodes; }
+
+    // Positions and masses in sorted order; node particle ranges index these
+    const std::vector<double>& getBodyX() const { return bodyX; }
+    const std::vector<double>& getBodyY() const { return bodyY; }
+    const std::vector<double>& getBodyMass() const { return bodyMass; }
+};
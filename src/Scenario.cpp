@@ -0,0 +1,51 @@
+#include "Scenario.hpp"
+#include "utils.hpp"
+#include <random>
+
+ParticleSystem makeJupiterScenario(const ScenarioSettings& settings)
+{
+	Particle sun(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero());
+	sun.setColor(0xFFFF00FF);
+	sun.setMinimumRenderRadius(10);
+
+	Particle jupiter(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0), Eigen::Vector2d(0.0, 13070.0));
+	jupiter.setColor(0xFF0000FF);
+
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(sun);
+	particleSystem.addParticle(jupiter);
+
+	std::mt19937 rng(settings.seed);
+	std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+	std::uniform_real_distribution<double> offset(-settings.spread, settings.spread);
+	for (size_t i = 0; i < settings.asteroids; i++)
+	{
+		Eigen::Vector2d position;
+		Eigen::Vector2d velocity;
+		if (settings.layout == AsteroidLayout::Ring)
+		{
+			const Eigen::Rotation2Dd rotation(i * 2 * M_PI / settings.asteroids + .1);
+			position = rotation * Eigen::Vector2d(constants::jupiterOrbitRadius + 1e9, 0.0);
+			velocity = rotation * Eigen::Vector2d(0.0, 13070.0);
+		}
+		else
+		{
+			const double radius = constants::jupiterOrbitRadius + offset(rng);
+			const Eigen::Rotation2Dd rotation(angle(rng));
+			position = rotation * Eigen::Vector2d(radius, 0.0);
+			velocity = rotation * Eigen::Vector2d(0.0, std::sqrt(constants::G * constants::solarMass / radius));
+		}
+
+		Particle asteroid(1.0f, 1.0, position, velocity);
+		asteroid.setTestParticle(true);
+		asteroid.setMinimumRenderRadius(2);
+		particleSystem.addParticle(asteroid);
+	}
+
+	// Asteroids flung out of the system are not coming back
+	RemovalSettings removal;
+	removal.escapeRadius = 20 * constants::jupiterOrbitRadius;
+	particleSystem.setRemovalSettings(removal);
+
+	return particleSystem;
+}
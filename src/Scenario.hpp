@@ -0,0 +1,29 @@
+#pragma once
+#include "Objects.hpp"
+
+enum class AsteroidLayout
+{
+	// Evenly spaced on a circle just outside Jupiter's orbit, moving at Jupiter's speed
+	Ring,
+	// Random phases and distances from the Sun, on circular orbits
+	Random
+};
+
+struct ScenarioSettings
+{
+	// Test particles scattered along Jupiter's orbit
+	size_t asteroids = 100;
+
+	AsteroidLayout layout = AsteroidLayout::Ring;
+
+	// Seed of the random layout
+	unsigned seed = 1;
+
+	// Largest distance of an asteroid from Jupiter's orbit in metres, in the random layout
+	double spread = 5e10;
+};
+
+// The Sun and Jupiter with asteroids near Jupiter's orbit, which are removed if they fall
+// into the Sun or go beyond 20 times Jupiter's orbit. The app shows the ring, the headless
+// runner uses the random layout; solver, integrator and threads are left to the caller.
+ParticleSystem makeJupiterScenario(const ScenarioSettings& settings);
@@ -0,0 +1,195 @@
+#include "SimulationApi.h"
+#include "Objects.hpp"
+#include "Scenario.hpp"
+#include <memory>
+
+struct psim_system
+{
+	ParticleSystem particleSystem;
+};
+
+// The C enums mirror the C++ ones, so they convert by value
+static_assert(PSIM_SOLVER_AUTOMATIC == static_cast<int>(ForceSolverType::Automatic));
+static_assert(PSIM_SOLVER_DIRECT_SUM == static_cast<int>(ForceSolverType::DirectSum));
+static_assert(PSIM_SOLVER_BARNES_HUT == static_cast<int>(ForceSolverType::BarnesHut));
+static_assert(PSIM_SOLVER_FAST_MULTIPOLE == static_cast<int>(ForceSolverType::FastMultipole));
+static_assert(PSIM_INTEGRATOR_EULER == static_cast<int>(IntegratorType::Euler));
+static_assert(PSIM_INTEGRATOR_LEAPFROG == static_cast<int>(IntegratorType::Leapfrog));
+static_assert(PSIM_INTEGRATOR_YOSHIDA4 == static_cast<int>(IntegratorType::Yoshida4));
+static_assert(PSIM_INTEGRATOR_WISDOM_HOLMAN == static_cast<int>(IntegratorType::WisdomHolman));
+static_assert(PSIM_INTEGRATOR_HYBRID == static_cast<int>(IntegratorType::Hybrid));
+static_assert(PSIM_INTEGRATOR_BLOCK_TIMESTEPS == static_cast<int>(IntegratorType::BlockTimesteps));
+static_assert(PSIM_INTEGRATOR_RESPA == static_cast<int>(IntegratorType::Respa));
+
+// Exceptions must not unwind into C callers, so every entry point runs its body through here
+// and returns its documented failure value instead, like for an out of memory error
+template <typename Result, typename Body>
+static Result guarded(Result failure, Body&& body)
+{
+	try
+	{
+		return body();
+	}
+	catch (...)
+	{
+		return failure;
+	}
+}
+
+psim_system* psim_create(unsigned thread_count)
+{
+	return guarded<psim_system*>(nullptr, [&] {
+		auto system = std::make_unique<psim_system>();
+		system->particleSystem.setThreadCount(thread_count);
+		return system.release();
+	});
+}
+
+psim_system* psim_create_jupiter_scenario(unsigned thread_count, size_t asteroids, int random_layout, unsigned seed)
+{
+	return guarded<psim_system*>(nullptr, [&] {
+		ScenarioSettings settings;
+		settings.asteroids = asteroids;
+		settings.layout = random_layout != 0 ? AsteroidLayout::Random : AsteroidLayout::Ring;
+		settings.seed = seed;
+		auto system = std::make_unique<psim_system>(psim_system { makeJupiterScenario(settings) });
+		system->particleSystem.setThreadCount(thread_count);
+		return system.release();
+	});
+}
+
+// Destructors do not throw, so this needs no guard
+void psim_destroy(psim_system* system)
+{
+	delete system;
+}
+
+int psim_add_particle(psim_system* system, double mass, double radius, double x, double y, double vx, double vy, int test_particle)
+{
+	for (double value : { mass, radius, x, y, vx, vy })
+	{
+		if (!std::isfinite(value)) return -1;
+	}
+	if (mass < 0.0 || radius < 0.0) return -1;
+
+	return guarded(-1, [&] {
+		Particle particle(static_cast<float>(radius), mass, Eigen::Vector2d(x, y), Eigen::Vector2d(vx, vy));
+		particle.setTestParticle(test_particle != 0);
+		return system->particleSystem.addParticle(particle).id;
+	});
+}
+
+int psim_set_solver(psim_system* system, int solver)
+{
+	if (solver < PSIM_SOLVER_AUTOMATIC || solver > PSIM_SOLVER_FAST_MULTIPOLE) return 0;
+	return guarded(0, [&] {
+		system->particleSystem.setForceSolverType(static_cast<ForceSolverType>(solver));
+		return 1;
+	});
+}
+
+int psim_set_integrator(psim_system* system, int integrator)
+{
+	if (integrator < PSIM_INTEGRATOR_EULER || integrator > PSIM_INTEGRATOR_RESPA) return 0;
+	return guarded(0, [&] {
+		system->particleSystem.setIntegratorType(static_cast<IntegratorType>(integrator));
+		return 1;
+	});
+}
+
+int psim_set_escape_radius(psim_system* system, double radius)
+{
+	return guarded(0, [&] {
+		RemovalSettings settings = system->particleSystem.getRemovalSettings();
+		settings.escapeRadius = radius > 0.0 ? radius : std::numeric_limits<double>::infinity();
+		system->particleSystem.setRemovalSettings(settings);
+		return 1;
+	});
+}
+
+int psim_step(psim_system* system, double dt)
+{
+	if (!std::isfinite(dt) || dt <= 0.0) return 0;
+	return guarded(0, [&] {
+		system->particleSystem.step(dt);
+		return 1;
+	});
+}
+
+size_t psim_advance(psim_system* system, double duration, double max_dt)
+{
+	if (!std::isfinite(duration) || !std::isfinite(max_dt)) return 0;
+
+	size_t steps = 0;
+	guarded(0, [&] {
+		ParticleSystem& particleSystem = system->particleSystem;
+		const double end = particleSystem.getTime() + duration;
+		while (particleSystem.getTime() < end)
+		{
+			const double start = particleSystem.getTime();
+			const double dt = max_dt > 0.0 ? max_dt : particleSystem.getAdaptiveTimestep();
+			particleSystem.step(std::min(dt, end - start));
+			// A step too short to change the time in floating point would repeat forever
+			if (particleSystem.getTime() <= start) break;
+			steps++;
+		}
+		return 1;
+	});
+	return steps;
+}
+
+double psim_get_time(const psim_system* system)
+{
+	return guarded(0.0, [&] { return system->particleSystem.getTime(); });
+}
+
+size_t psim_get_particle_count(const psim_system* system)
+{
+	return guarded<size_t>(0, [&] {
+		return system->particleSystem.getStore().size() + system->particleSystem.getPrescribedBodies().size();
+	});
+}
+
+size_t psim_get_removed_count(const psim_system* system)
+{
+	return guarded<size_t>(0, [&] { return system->particleSystem.getRemovedParticles().size(); });
+}
+
+long psim_find_slot(const psim_system* system, int id)
+{
+	return guarded(-1L, [&] {
+		const uint32_t slot = system->particleSystem.getStore().findSlot(id);
+		return slot == ParticleStore::NO_SLOT ? -1L : static_cast<long>(slot);
+	});
+}
+
+int psim_get_state(psim_system* system, int id, double position[2], double velocity[2])
+{
+	return guarded(0, [&] {
+		ParticleRef particle = system->particleSystem.findParticle(id);
+		if (!particle) return 0;
+
+		position[0] = particle.getPosition().x();
+		position[1] = particle.getPosition().y();
+		velocity[0] = particle.getVelocity().x();
+		velocity[1] = particle.getVelocity().y();
+		return 1;
+	});
+}
+
+psim_buffers psim_get_buffers(psim_system* system)
+{
+	return guarded(psim_buffers {}, [&] {
+		ParticleStore& particles = system->particleSystem.getStore();
+		return psim_buffers { particles.size(), particles.id.data(), particles.x.data(), particles.y.data(),
+			particles.vx.data(), particles.vy.data(), particles.mass.data() };
+	});
+}
+
+int psim_buffers_modified(psim_system* system)
+{
+	return guarded(0, [&] {
+		system->particleSystem.markStoreModified();
+		return 1;
+	});
+}
@@ -0,0 +1,108 @@
+#ifndef SIMULATION_API_H
+#define SIMULATION_API_H
+
+#include <stddef.h>
+
+/*
+ * C interface to the simulation core, for other languages and tools. Particles are named by the
+ * id psim_add_particle returns. Buffer slots are not stable: a step may reorder the particles
+ * or remove some, so look slots up again after every step.
+ *
+ * No C++ exception leaves these functions. When one fails, for instance out of memory, it
+ * returns NULL, -1 or 0 as for bad input, and empty buffers.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct psim_system psim_system;
+
+typedef enum psim_solver
+{
+	PSIM_SOLVER_AUTOMATIC,
+	PSIM_SOLVER_DIRECT_SUM,
+	PSIM_SOLVER_BARNES_HUT,
+	PSIM_SOLVER_FAST_MULTIPOLE
+} psim_solver;
+
+typedef enum psim_integrator
+{
+	PSIM_INTEGRATOR_EULER,
+	PSIM_INTEGRATOR_LEAPFROG,
+	PSIM_INTEGRATOR_YOSHIDA4,
+	PSIM_INTEGRATOR_WISDOM_HOLMAN,
+	PSIM_INTEGRATOR_HYBRID,
+	PSIM_INTEGRATOR_BLOCK_TIMESTEPS,
+	PSIM_INTEGRATOR_RESPA
+} psim_integrator;
+
+/*
+ * The simulation's own arrays of the integrated particles, indexed by slot, without a copy.
+ * Valid until the next call that steps, adds or removes particles. Positions and velocities
+ * may be written between steps; call psim_buffers_modified after writing them.
+ */
+typedef struct psim_buffers
+{
+	size_t count;
+	const int* id;
+	double* x;
+	double* y;
+	double* vx;
+	double* vy;
+	const double* mass;
+} psim_buffers;
+
+/* A thread count of 0 uses every hardware thread; returns NULL on failure */
+psim_system* psim_create(unsigned thread_count);
+
+/* The Sun, Jupiter and asteroids along Jupiter's orbit. With random_layout 0 they form the
+   evenly spaced ring of the app and seed is unused; otherwise they get the random phases and
+   distances of the headless runner, drawn from seed. */
+psim_system* psim_create_jupiter_scenario(unsigned thread_count, size_t asteroids, int random_layout, unsigned seed);
+
+void psim_destroy(psim_system* system);
+
+/* Returns the id of the new particle, or -1 if the mass or radius is negative or a value is
+   not finite. A test particle feels the others but pulls on nothing, and may be massless. */
+int psim_add_particle(psim_system* system, double mass, double radius, double x, double y, double vx, double vy, int test_particle);
+
+/* Take one of the psim_solver or psim_integrator values; return 0 and change nothing for
+   any other value, 1 otherwise */
+int psim_set_solver(psim_system* system, int solver);
+int psim_set_integrator(psim_system* system, int integrator);
+
+/* Remove particles that leave this distance from the barycenter on unbound orbits, 0 for never.
+   Returns 0 on failure, 1 otherwise. */
+int psim_set_escape_radius(psim_system* system, double radius);
+
+/* Returns 0 without stepping if dt is not finite and positive, and 0 if the step failed, which
+   leaves the particles in an unspecified state; 1 otherwise */
+int psim_step(psim_system* system, double dt);
+
+/* Advance by duration in steps of at most max_dt, or of the adaptive step if max_dt is 0.
+   Returns the number of steps taken: 0 if duration or max_dt is not finite, and fewer if a
+   step fails or is too short to advance the time. */
+size_t psim_advance(psim_system* system, double duration, double max_dt);
+
+double psim_get_time(const psim_system* system);
+size_t psim_get_particle_count(const psim_system* system);
+size_t psim_get_removed_count(const psim_system* system);
+
+/* Slot of the particle in the buffers, or -1 if it was removed or follows an ephemeris */
+long psim_find_slot(const psim_system* system, int id);
+
+/* Position and velocity of a particle as x, y pairs; returns 0 if there is no such particle */
+int psim_get_state(psim_system* system, int id, double position[2], double velocity[2]);
+
+psim_buffers psim_get_buffers(psim_system* system);
+
+/* Tell the system its buffers were written, so the next step starts from the new state
+   instead of the accelerations kept from the old one. Returns 0 on failure, 1 otherwise. */
+int psim_buffers_modified(psim_system* system);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMULATION_API_H */
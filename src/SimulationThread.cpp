@@ -0,0 +1,95 @@
+#include "SimulationThread.hpp"
+
+SimulationThread::SimulationThread(std::function<ParticleSystem()> makeSystem, double timeScale, double ticksPerSecond) :
+	makeSystem(std::move(makeSystem)),
+	timeScale(timeScale),
+	tickInterval(1.0 / ticksPerSecond),
+	thread(&SimulationThread::run, this)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+	running.store(false, std::memory_order_release);
+	thread.join();
+}
+
+bool SimulationThread::send(const SimulationCommand& command)
+{
+	return commands.push(command);
+}
+
+bool SimulationThread::receive()
+{
+	return snapshots.update();
+}
+
+const Snapshot& SimulationThread::getSnapshot() const
+{
+	return snapshots.getFront();
+}
+
+void SimulationThread::run()
+{
+	using Clock = std::chrono::steady_clock;
+
+	ParticleSystem particleSystem = makeSystem();
+	uint64_t epoch = 0;
+	bool paused = false;
+	ParticleHandle selected;
+
+	Clock::time_point lastTick = Clock::now();
+	Clock::time_point nextTick = lastTick;
+	while (running.load(std::memory_order_acquire))
+	{
+		SimulationCommand command;
+		while (commands.pop(command))
+		{
+			switch (command.type)
+			{
+				case SimulationCommandType::TogglePause:
+					paused = !paused;
+					break;
+				case SimulationCommandType::Reset:
+					particleSystem = makeSystem();
+					selected = ParticleHandle();
+					epoch++;
+					break;
+				case SimulationCommandType::Select:
+					selected = command.particle;
+					break;
+				case SimulationCommandType::Step:
+					particleSystem.step(command.dt);
+					break;
+			}
+		}
+
+		// Substeps follow the dynamical times of the particles, the last one is cut short
+		// to end on the tick
+		const Clock::time_point now = Clock::now();
+		const double elapsed = std::min(std::chrono::duration<double>(now - lastTick).count(), 2 * tickInterval.count());
+		lastTick = now;
+		if (!paused)
+		{
+			double remainingTime = elapsed * timeScale;
+			while (remainingTime > 0.0)
+			{
+				double subTimeStep = std::min(particleSystem.getAdaptiveTimestep(), remainingTime);
+				particleSystem.step(subTimeStep);
+				remainingTime -= subTimeStep;
+			}
+		}
+
+		Snapshot& snapshot = snapshots.getBack();
+		particleSystem.writeSnapshot(snapshot);
+		snapshot.published = Clock::now();
+		snapshot.epoch = epoch;
+		snapshot.paused = paused;
+		snapshot.selected = particleSystem.isAlive(selected) ? selected : ParticleHandle();
+		snapshots.publish();
+
+		// A tick that ran over starts the next one right away instead of catching up
+		nextTick = std::max(nextTick + std::chrono::duration_cast<Clock::duration>(tickInterval), Clock::now());
+		std::this_thread::sleep_until(nextTick);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "Objects.hpp"
+#include "Snapshot.hpp"
+#include "SpscQueue.hpp"
+#include "TripleBuffer.hpp"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+enum class SimulationCommandType
+{
+	TogglePause,
+	// Start over from a fresh system of the factory
+	Reset,
+	// Follow a particle, or nothing with a null handle
+	Select,
+	// Advance by dt once, whether paused or not
+	Step
+};
+
+struct SimulationCommand
+{
+	SimulationCommandType type;
+	ParticleHandle particle {};
+	double dt = 0.0;
+};
+
+// Runs a ParticleSystem on a thread of its own, so that drawing never waits for a step and
+// stepping never waits for the display. The thread keeps the simulation at timeScale times
+// wall clock time, publishes a Snapshot after every tick through a triple buffer, and takes
+// commands through a queue; neither side ever blocks the other.
+class SimulationThread
+{
+private:
+	std::function<ParticleSystem()> makeSystem;
+	double timeScale;
+	std::chrono::duration<double> tickInterval;
+
+	util::TripleBuffer<Snapshot> snapshots;
+	util::SpscQueue<SimulationCommand, 64> commands;
+	std::atomic<bool> running = true;
+
+	// Started last, once everything it uses is constructed
+	std::thread thread;
+
+	void run();
+
+public:
+	// makeSystem builds the system at the start and on every reset, on the simulation thread.
+	// A tick advances the simulation by timeScale times the wall clock time since the last,
+	// at most two tick intervals' worth, so a simulation that cannot keep up slows down.
+	SimulationThread(std::function<ParticleSystem()> makeSystem, double timeScale, double ticksPerSecond);
+	~SimulationThread();
+
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	// From one thread only. Returns false if the queue is full.
+	bool send(const SimulationCommand& command);
+
+	// From one thread only. Takes the newest snapshot if one was published since the last
+	// call and returns whether there was one.
+	bool receive();
+	const Snapshot& getSnapshot() const;
+};
@@ -0,0 +1,80 @@
+#include "Snapshot.hpp"
+#include "utils.hpp"
+
+void Snapshot::resize(size_t count)
+{
+	x.resize(count);
+	y.resize(count);
+	mass.resize(count);
+	radius.resize(count);
+	color.resize(count);
+	minimumRenderRadiusPx.resize(count);
+	generation.resize(count);
+	alive.resize(count);
+}
+
+bool Snapshot::contains(ParticleHandle handle) const
+{
+	return handle.id >= 0 && static_cast<size_t>(handle.id) < size() && alive[handle.id]
+		&& generation[handle.id] == handle.generation;
+}
+
+float Snapshot::getRenderRadius(int id, float unitsPerPixel) const
+{
+	return std::max(radius[id], minimumRenderRadiusPx[id] * unitsPerPixel);
+}
+
+int Snapshot::particleAt(const Eigen::Vector2d& position, float unitsPerPixel) const
+{
+	for (size_t id = 0; id < size(); id++)
+	{
+		if (alive[id] && (position - getPosition(id)).norm() < static_cast<double>(getRenderRadius(id, unitsPerPixel)))
+		{
+			return static_cast<int>(id);
+		}
+	}
+
+	return -1;
+}
+
+double Snapshot::calculatePotentialEnergy(Eigen::Vector2f position) const
+{
+	double potentialEnergy = 0.0;
+	for (size_t id = 0; id < size(); id++)
+	{
+		if (!alive[id]) continue;
+		double distance = (position.cast<double>() - getPosition(id)).norm();
+		potentialEnergy += -constants::G * mass[id] / distance;
+	}
+
+	return potentialEnergy;
+}
+
+bool Snapshot::isNearParticle(Eigen::Vector2f position) const
+{
+	for (size_t id = 0; id < size(); id++)
+	{
+		double characteristicDistance = mass[id] / 4e18;
+		if (alive[id] && (getPosition(id) - position.cast<double>()).norm() < characteristicDistance)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Snapshot::interpolate(const Snapshot& previous, const Snapshot& latest, double alpha)
+{
+	*this = latest;
+	if (previous.epoch != latest.epoch) return;
+
+	time = previous.time + alpha * (latest.time - previous.time);
+	const size_t count = std::min(previous.size(), latest.size());
+	for (size_t id = 0; id < count; id++)
+	{
+		if (!previous.alive[id] || !alive[id] || previous.generation[id] != generation[id]) continue;
+		x[id] = previous.x[id] + alpha * (latest.x[id] - previous.x[id]);
+		y[id] = previous.y[id] + alpha * (latest.y[id] - previous.y[id]);
+	}
+}
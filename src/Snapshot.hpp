@@ -0,0 +1,59 @@
+#pragma once
+#include "Eigen/Dense"
+#include "Objects.hpp"
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// What the renderer needs of every particle at one moment, copied out of a ParticleSystem so
+// that drawing never touches the live simulation. Indexed by particle id rather than slot,
+// so two snapshots line up however the store was reordered in between.
+struct Snapshot
+{
+	// Simulation time of the positions
+	double time = 0.0;
+
+	// When the simulation thread published it
+	std::chrono::steady_clock::time_point published;
+
+	// Counted up by every reset; snapshots of different epochs are never interpolated
+	uint64_t epoch = 0;
+
+	bool paused = false;
+
+	// Particle selected through the command queue, null if there is none or it was removed
+	ParticleHandle selected;
+
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> mass;
+	std::vector<float> radius;
+	// RGBA, red in the highest byte
+	std::vector<uint32_t> color;
+	std::vector<int> minimumRenderRadiusPx;
+	std::vector<uint32_t> generation;
+
+	// Whether a particle has the id at all
+	std::vector<uint8_t> alive;
+
+	// Number of ids, alive or not
+	size_t size() const { return alive.size(); }
+	void resize(size_t count);
+
+	Eigen::Vector2d getPosition(int id) const { return Eigen::Vector2d(x[id], y[id]); }
+	bool contains(ParticleHandle handle) const;
+
+	// Radius a particle is drawn with in world units, at least its minimum size in pixels
+	float getRenderRadius(int id, float unitsPerPixel) const;
+
+	// Id of a particle drawn over position, -1 if there is none
+	int particleAt(const Eigen::Vector2d& position, float unitsPerPixel) const;
+
+	double calculatePotentialEnergy(Eigen::Vector2f position) const;
+	// "close" means within 10 radii of a particle
+	bool isNearParticle(Eigen::Vector2f position) const;
+
+	// Become the state alpha of the way from previous to latest. Particles that are not in
+	// both, and every particle across a reset, are taken from latest as they are.
+	void interpolate(const Snapshot& previous, const Snapshot& latest, double alpha);
+};
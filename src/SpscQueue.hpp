@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace util
+{
+// Bounded queue from one producer thread to one consumer thread, without locks. Holds up to
+// Capacity - 1 items; push fails instead of waiting when it is full.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+private:
+	std::array<T, Capacity> items;
+
+	// Next slot to pop, written by the consumer, and next slot to push, written by the
+	// producer, on separate cache lines so the two sides do not contend
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+
+public:
+	bool push(const T& item)
+	{
+		const size_t slot = tail.load(std::memory_order_relaxed);
+		const size_t next = (slot + 1) % Capacity;
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+
+		items[slot] = item;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		const size_t slot = head.load(std::memory_order_relaxed);
+		if (slot == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = items[slot];
+		head.store((slot + 1) % Capacity, std::memory_order_release);
+		return true;
+	}
+};
+}
@@ -0,0 +1,117 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+
+util::ThreadPool::ThreadPool(unsigned threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// The caller acts as thread 0
+	for (unsigned i = 1; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+util::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+unsigned util::ThreadPool::getThreadCount() const
+{
+	return workers.size() + 1;
+}
+
+void util::ThreadPool::runBlock(unsigned block) const
+{
+	if (block >= taskBlocks)
+		return;
+
+	size_t begin = taskCount * block / taskBlocks;
+	size_t end = taskCount * (block + 1) / taskBlocks;
+	(*task)(begin, end);
+}
+
+void util::ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn, size_t minBlockSize)
+{
+	if (count == 0)
+		return;
+
+	size_t blocks = std::min<size_t>(getThreadCount(), (count + minBlockSize - 1) / std::max<size_t>(minBlockSize, 1));
+	if (blocks <= 1)
+	{
+		fn(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &fn;
+		taskCount = count;
+		taskBlocks = blocks;
+		pendingWorkers = workers.size();
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	runBlock(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pendingWorkers == 0; });
+	task = nullptr;
+}
+
+void util::ThreadPool::parallelForDynamic(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn)
+{
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	if (count <= chunkSize || getThreadCount() == 1)
+	{
+		fn(0, count);
+		return;
+	}
+
+	std::atomic<size_t> nextChunk(0);
+	parallelFor(getThreadCount(), [&](size_t, size_t) {
+		size_t begin;
+		while ((begin = nextChunk.fetch_add(chunkSize)) < count)
+		{
+			fn(begin, std::min(begin + chunkSize, count));
+		}
+	}, 1);
+}
+
+void util::ThreadPool::workerLoop(unsigned index)
+{
+	unsigned seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = generation;
+		}
+
+		runBlock(index);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingWorkers--;
+		}
+		doneCondition.notify_one();
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+// A fixed set of worker threads for data-parallel loops.
+// The calling thread takes part in every loop, so a pool of one thread runs everything inline.
+class ThreadPool
+{
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+
+	// Current loop, published to the workers under the mutex
+	const std::function<void(size_t, size_t)>* task = nullptr;
+	size_t taskCount = 0;
+	unsigned taskBlocks = 0;
+	unsigned generation = 0;
+	unsigned pendingWorkers = 0;
+	bool stopping = false;
+
+	void workerLoop(unsigned index);
+	void runBlock(unsigned block) const;
+
+public:
+	// A thread count of 0 uses every hardware thread
+	explicit ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads taking part in a loop, including the caller
+	unsigned getThreadCount() const;
+
+	// Split [0, count) into at most one contiguous block per thread, each at least minBlockSize long,
+	// and call fn(begin, end) for every block. Returns once all blocks are done.
+	void parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn, size_t minBlockSize = 1024);
+
+	// Hand out [0, count) in chunks of chunkSize to whichever thread is free next.
+	// Use this when the cost per element varies a lot, so no thread is left with all the slow work.
+	void parallelForDynamic(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn);
+};
+}
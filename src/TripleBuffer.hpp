@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace util
+{
+// Hands the latest value from one writer thread to one reader thread without either waiting.
+// The writer fills the back buffer and publishes it, the reader takes the newest published
+// buffer as its front. Values published while the reader was busy are skipped.
+template <typename T>
+class TripleBuffer
+{
+private:
+	// Set on the middle index while it holds a value the reader has not taken yet
+	static constexpr uint8_t NEW_BIT = 4;
+
+	std::array<T, 3> buffers;
+
+	// Owned by the writer and the reader respectively
+	uint8_t back = 0;
+	uint8_t front = 1;
+
+	// The buffer between the two, traded by atomic exchange
+	std::atomic<uint8_t> middle = 2;
+
+public:
+	// Writer side: the buffer to fill, left as it was two publishes ago
+	T& getBack()
+	{
+		return buffers[back];
+	}
+
+	void publish()
+	{
+		back = middle.exchange(back | NEW_BIT, std::memory_order_acq_rel) & ~NEW_BIT;
+	}
+
+	// Reader side: take the newest published buffer as the front, if there is one since the last call
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & NEW_BIT))
+			return false;
+
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~NEW_BIT;
+		return true;
+	}
+
+	const T& getFront() const
+	{
+		return buffers[front];
+	}
+};
+}
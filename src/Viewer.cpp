@@ -1,4 +1,4 @@
-#include "utils.hpp"
+#include "Viewer.hpp"
 
 Eigen::Vector2f util::toEigen(sf::Vector2f vector)
 {
@@ -31,4 +31,32 @@ template <typename T>
 Eigen::Vector2<T> util::toEigen(sf::Vector2<T> vector)
 {
 	return Eigen::Vector2<T>(vector.x, vector.y);
-}
\ No newline at end of file
+}
+
+GUI::GUI()
+{
+	font.loadFromFile("arial.ttf");
+}
+
+void GUI::draw(sf::RenderWindow& window)
+{
+	// Draw the GUI background
+	sf::RectangleShape background(sf::Vector2f(window.getSize().x, 50));
+	background.setFillColor(backgroundColor);
+	background.setOutlineColor(strokeColor);
+	window.draw(background);
+
+	// Draw elapsed time
+	sf::Text text;
+	text.setFont(font);
+	text.setCharacterSize(fontSize);
+	text.setString("Elapsed time: " + std::to_string(elapsedYears) + " years");
+	text.setFillColor(textColor);
+	text.setPosition(10, 10);
+	window.draw(text);
+}
+
+void GUI::setElapsedYears(int elapsedYears)
+{
+	this->elapsedYears = elapsedYears;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "Eigen/Dense"
+
+// Drawing and conversions for the SFML app, kept out of the simulation core
+
+namespace util
+{
+Eigen::Vector2f toEigen(sf::Vector2f vector);
+sf::Vector2f toSFML(Eigen::Vector2f vector);
+
+sf::Color blueToRed(double value);
+
+// A template function to convert eigen vectors to sfml vectors
+template <typename T>
+sf::Vector2<T> toSFML(Eigen::Vector2<T> vector);
+
+// A template function to convert sfml vectors to eigen vectors
+template <typename T>
+Eigen::Vector2<T> toEigen(sf::Vector2<T> vector);
+}
+
+class GUI
+{
+private:
+	const int fontSize = 18;
+	sf::Font font;
+	sf::Text text;
+
+	int objectsInView;
+	int objectsInSun;
+	int objectsInSystem;
+
+	int elapsedYears;
+
+	// Grey background
+	sf::Color backgroundColor = sf::Color(50, 50, 50, 100);
+
+	// Black stroke
+	sf::Color strokeColor = sf::Color(0, 0, 0, 255);
+
+	// White text
+	sf::Color textColor = sf::Color(255, 255, 255, 255);
+
+public:
+	GUI();
+	void draw(sf::RenderWindow& window);
+
+	void setElapsedYears(int elapsedYears);
+};
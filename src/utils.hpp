@@ -20,19 +20,3 @@ const double jupiterMass = 1.8982e27;
 const double jupiterRadius = 6.9911e7;
 const double jupiterOrbitRadius = 7.785472e11;
 }
-
-namespace util
-{
-Eigen::Vector2f toEigen(sf::Vector2f vector);
-sf::Vector2f toSFML(Eigen::Vector2f vector);
-
-sf::Color blueToRed(double value);
-
-// A template function to convert eigen vectors to sfml vectors
-template <typename T>
-sf::Vector2<T> toSFML(Eigen::Vector2<T> vector);
-
-// A template function to convert sfml vectors to eigen vectors
-template <typename T>
-Eigen::Vector2<T> toEigen(sf::Vector2<T> vector);
-}
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include <catch2/catch.hpp>
+
+#include "FMM.hpp"
+#include "ForceSolver.hpp"
+#include "utils.hpp"
+
+#include <random>
+
+namespace
+{
+ParticleStore makeDisc(int count, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> radius(1e10, 1e12);
+	std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+	std::uniform_real_distribution<double> mass(1e18, 1e24);
+
+	ParticleStore particles;
+	particles.add(0, constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero());
+	for (int i = 1; i < count; i++)
+	{
+		Eigen::Vector2d position = Eigen::Rotation2Dd(angle(rng)) * Eigen::Vector2d(radius(rng), 0.0);
+		particles.add(i, 1.0f, mass(rng), position, Eigen::Vector2d::Zero());
+	}
+	return particles;
+}
+
+Eigen::Vector2d directAcceleration(const ParticleStore& particles, size_t target)
+{
+	Eigen::Vector2d acceleration = Eigen::Vector2d::Zero();
+	for (size_t j = 0; j < particles.size(); j++)
+	{
+		Eigen::Vector2d direction = particles.getPosition(j) - particles.getPosition(target);
+		double distance = direction.norm();
+		if (distance < QuadTreeNode::MIN_DISTANCE)
+			continue;
+		acceleration += constants::G * particles.mass[j] / (distance * distance * distance) * direction;
+	}
+	return acceleration;
+}
+}
+
+TEST_CASE("Tiled direct summation matches the pairwise sum", "[solver]")
+{
+	// Not a multiple of the tile size, so the last tile is partial
+	const int count = 2 * DirectSumSolver::TILE_SIZE + 37;
+	ParticleStore particles = makeDisc(count, 1);
+
+	for (unsigned threads : { 1u, 3u })
+	{
+		util::ThreadPool pool(threads);
+		DirectSumSolver solver;
+		std::vector<Eigen::Vector2d> accelerations;
+		solver.calculateAccelerations(particles, accelerations, pool);
+
+		REQUIRE(accelerations.size() == particles.size());
+		for (size_t i = 0; i < particles.size(); i++)
+		{
+			Eigen::Vector2d exact = directAcceleration(particles, i);
+			REQUIRE((accelerations[i] - exact).norm() <= 1e-9 * exact.norm());
+		}
+	}
+}
+
+TEST_CASE("Tiled direct summation gives the same result every run", "[solver]")
+{
+	ParticleStore particles = makeDisc(8 * DirectSumSolver::TILE_SIZE + 37, 5);
+	util::ThreadPool pool(4);
+
+	DirectSumSolver solver;
+	std::vector<Eigen::Vector2d> first;
+	solver.calculateAccelerations(particles, first, pool);
+	for (int run = 0; run < 5; run++)
+	{
+		DirectSumSolver repeat;
+		std::vector<Eigen::Vector2d> accelerations;
+		repeat.calculateAccelerations(particles, accelerations, pool);
+		REQUIRE(accelerations == first);
+	}
+}
+
+TEST_CASE("Barnes-Hut agrees with the direct sum reference", "[solver]")
+{
+	ParticleStore particles = makeDisc(4000, 2);
+	util::ThreadPool pool(2);
+
+	DirectSumSolver directSum;
+	std::vector<Eigen::Vector2d> exact;
+	directSum.calculateAccelerations(particles, exact, pool);
+
+	// The Barnes-Hut solver reorders the particles, so match them up by id
+	ParticleStore sorted = particles;
+
+	BarnesHutSolver barnesHut;
+	std::vector<Eigen::Vector2d> approx;
+	barnesHut.calculateAccelerations(sorted, approx, pool);
+
+	double errorSquared = 0.0;
+	double accelerationSquared = 0.0;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const Eigen::Vector2d& reference = exact[sorted.id[i]];
+		errorSquared += (approx[i] - reference).squaredNorm();
+		accelerationSquared += reference.squaredNorm();
+	}
+	REQUIRE(std::sqrt(errorSquared / accelerationSquared) < 0.01);
+}
+
+TEST_CASE("Direct sum crossover is measured once", "[solver]")
+{
+	util::ThreadPool pool(1);
+	size_t crossover = measureDirectSumCrossover(pool);
+	REQUIRE(crossover >= 32);
+	REQUIRE(crossover <= 16384);
+	REQUIRE(measureDirectSumCrossover(pool) == crossover);
+}
+
+TEST_CASE("FMM error falls with the expansion order", "[solver]")
+{
+	ParticleStore particles = makeDisc(6000, 3);
+
+	util::ThreadPool pool(3);
+	DirectSumSolver directSum;
+	std::vector<Eigen::Vector2d> exact;
+	directSum.calculateAccelerations(particles, exact, pool);
+
+	double previousError = 1.0;
+	for (int order : { 2, 4, 8 })
+	{
+		FMMSettings settings;
+		settings.order = order;
+		FMMSolver fastMultipole;
+		fastMultipole.setFMMSettings(settings);
+
+		std::vector<Eigen::Vector2d> approx;
+		ParticleStore sorted = particles;
+		fastMultipole.calculateAccelerations(sorted, approx, pool);
+
+		double errorSquared = 0.0;
+		double accelerationSquared = 0.0;
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			const Eigen::Vector2d& reference = exact[sorted.id[i]];
+			errorSquared += (approx[i] - reference).squaredNorm();
+			accelerationSquared += reference.squaredNorm();
+		}
+		double error = std::sqrt(errorSquared / accelerationSquared);
+		REQUIRE(error < previousError);
+		previousError = error;
+	}
+	REQUIRE(previousError < 1e-5);
+}
+
+TEST_CASE("FMM results do not depend on the thread count", "[solver]")
+{
+	ParticleStore particles = makeDisc(20000, 4);
+
+	std::vector<Eigen::Vector2d> serial;
+	ParticleStore serialParticles = particles;
+	util::ThreadPool serialPool(1);
+	FMMSolver serialSolver;
+	serialSolver.calculateAccelerations(serialParticles, serial, serialPool);
+
+	std::vector<Eigen::Vector2d> parallel;
+	ParticleStore parallelParticles = particles;
+	util::ThreadPool parallelPool(4);
+	FMMSolver parallelSolver;
+	parallelSolver.calculateAccelerations(parallelParticles, parallel, parallelPool);
+
+	// Same interactions, summed in a different order
+	for (size_t i = 0; i < serial.size(); i++)
+	{
+		REQUIRE(serialParticles.id[i] == parallelParticles.id[i]);
+		REQUIRE((serial[i] - parallel[i]).norm() <= 1e-9 * serial[i].norm());
+	}
+
+	// With the same thread count the order is the same too
+	for (int run = 0; run < 3; run++)
+	{
+		std::vector<Eigen::Vector2d> repeat;
+		ParticleStore repeatParticles = particles;
+		FMMSolver repeatSolver;
+		repeatSolver.calculateAccelerations(repeatParticles, repeat, parallelPool);
+		REQUIRE(repeat == parallel);
+	}
+}
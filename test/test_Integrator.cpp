@@ -0,0 +1,606 @@
+#include <catch2/catch.hpp>
+
+#include "Kernels.hpp"
+#include "Objects.hpp"
+#include "utils.hpp"
+
+#include <random>
+
+namespace
+{
+// The Sun and an eccentric Jupiter
+ParticleSystem makeBinary(IntegratorType type)
+{
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	particleSystem.addParticle(Particle(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0), Eigen::Vector2d(0.0, 12000.0)));
+	particleSystem.setForceSolverType(ForceSolverType::DirectSum);
+	particleSystem.setIntegratorType(type);
+	particleSystem.setThreadCount(1);
+	return particleSystem;
+}
+
+double totalEnergy(const ParticleSystem& particleSystem)
+{
+	const ParticleStore& particles = particleSystem.getStore();
+	double energy = 0.0;
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		energy += 0.5 * particles.mass[i] * particles.getVelocity(i).squaredNorm();
+		for (size_t j = i + 1; j < particles.size(); j++)
+		{
+			energy -= constants::G * particles.mass[i] * particles.mass[j] / (particles.getPosition(i) - particles.getPosition(j)).norm();
+		}
+	}
+	return energy;
+}
+
+// The Sun, Jupiter and Saturn on circular orbits
+ParticleSystem makeGiants(IntegratorType type)
+{
+	const double saturnMass = 5.683e26;
+	const double saturnOrbitRadius = 1.4335e12;
+
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	for (auto [mass, radius] : { std::pair(constants::jupiterMass, constants::jupiterOrbitRadius), std::pair(saturnMass, saturnOrbitRadius) })
+	{
+		double speed = std::sqrt(constants::G * constants::solarMass / radius);
+		particleSystem.addParticle(Particle(1.0f, mass, Eigen::Vector2d(radius, 0.0), Eigen::Vector2d(0.0, speed)));
+	}
+	particleSystem.setForceSolverType(ForceSolverType::DirectSum);
+	particleSystem.setIntegratorType(type);
+	particleSystem.setThreadCount(1);
+	return particleSystem;
+}
+
+// Largest relative energy error over the given number of steps
+double worstEnergyError(ParticleSystem particleSystem, int steps, double dt)
+{
+	const double initial = totalEnergy(particleSystem);
+	double worst = 0.0;
+	for (int i = 0; i < steps; i++)
+	{
+		particleSystem.step(dt);
+		worst = std::max(worst, std::abs(totalEnergy(particleSystem) / initial - 1.0));
+	}
+	return worst;
+}
+
+// Ten orbits with steps of 30 days
+double worstEnergyError(IntegratorType type)
+{
+	return worstEnergyError(makeBinary(type), 1500, 30 * 24 * 3600.0);
+}
+}
+
+TEST_CASE("Symplectic integrators bound the energy error", "[integrator]")
+{
+	double euler = worstEnergyError(IntegratorType::Euler);
+	double leapfrog = worstEnergyError(IntegratorType::Leapfrog);
+	double yoshida = worstEnergyError(IntegratorType::Yoshida4);
+	REQUIRE(leapfrog < 1e-3);
+	REQUIRE(leapfrog < 0.1 * euler);
+	REQUIRE(yoshida < 0.01 * leapfrog);
+}
+
+TEST_CASE("Kepler drift follows elliptic and hyperbolic orbits", "[integrator]")
+{
+	const double mu = constants::G * constants::solarMass;
+	const double radius = constants::jupiterOrbitRadius;
+	const double speed = std::sqrt(mu / radius);
+	const double period = 2 * M_PI * radius / speed;
+
+	// A quarter of a circular orbit, then the rest of it
+	double x = radius, y = 0.0, vx = 0.0, vy = speed;
+	kernels::keplerDrift(&x, &y, &vx, &vy, 1, mu, 0.25 * period);
+	REQUIRE(std::abs(x) < 1e-9 * radius);
+	REQUIRE(y == Approx(radius).epsilon(1e-12));
+	REQUIRE(vx == Approx(-speed).epsilon(1e-12));
+	kernels::keplerDrift(&x, &y, &vx, &vy, 1, mu, 0.75 * period);
+	REQUIRE(x == Approx(radius).epsilon(1e-12));
+	REQUIRE(std::abs(y) < 1e-9 * radius);
+
+	// Energy and angular momentum are conserved on an eccentric and on a hyperbolic orbit
+	for (double factor : { 0.7, 1.8 })
+	{
+		double x = radius, y = 0.0, vx = 0.1 * speed, vy = factor * speed;
+		const double energy = 0.5 * (vx * vx + vy * vy) - mu / std::hypot(x, y);
+		const double angularMomentum = x * vy - y * vx;
+		kernels::keplerDrift(&x, &y, &vx, &vy, 1, mu, 0.3 * period);
+		REQUIRE(0.5 * (vx * vx + vy * vy) - mu / std::hypot(x, y) == Approx(energy).epsilon(1e-10));
+		REQUIRE(x * vy - y * vx == Approx(angularMomentum).epsilon(1e-10));
+	}
+}
+
+TEST_CASE("Wisdom-Holman stays accurate at a large fraction of the orbital period", "[integrator]")
+{
+	// A twentieth of Jupiter's period, for fifty orbits
+	const double dt = 4332.6 / 20 * 24 * 3600.0;
+	double wisdomHolman = worstEnergyError(makeGiants(IntegratorType::WisdomHolman), 1000, dt);
+	double leapfrog = worstEnergyError(makeGiants(IntegratorType::Leapfrog), 1000, dt);
+	REQUIRE(wisdomHolman < 1e-5);
+	REQUIRE(wisdomHolman < 0.01 * leapfrog);
+
+	// Momentum is conserved exactly, up to rounding
+	auto momentum = [](const ParticleSystem& particleSystem) {
+		const ParticleStore& particles = particleSystem.getStore();
+		Eigen::Vector2d sum = Eigen::Vector2d::Zero();
+		for (size_t i = 0; i < particles.size(); i++)
+			sum += particles.mass[i] * particles.getVelocity(i);
+		return sum;
+	};
+	ParticleSystem particleSystem = makeGiants(IntegratorType::WisdomHolman);
+	const Eigen::Vector2d initial = momentum(particleSystem);
+	for (int i = 0; i < 100; i++)
+		particleSystem.step(dt);
+	REQUIRE((momentum(particleSystem) - initial).norm() < 1e-12 * initial.norm());
+}
+
+TEST_CASE("Block timesteps follow a fast inner orbit at a fraction of the kicks", "[integrator]")
+{
+	// A belt on slow orbits and one particle on a 12 day orbit close to the Sun
+	auto makeSystem = [](IntegratorType type) {
+		std::mt19937 rng(9);
+		std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+		std::uniform_real_distribution<double> beltRadius(3e11, 4e11);
+
+		ParticleSystem particleSystem = makeBinary(type);
+		for (int i = 0; i < 200; i++)
+		{
+			Eigen::Rotation2Dd rotation(angle(rng));
+			double radius = beltRadius(rng);
+			double speed = std::sqrt(constants::G * constants::solarMass / radius);
+			particleSystem.addParticle(Particle(1.0f, 1e15, rotation * Eigen::Vector2d(radius, 0.0), rotation * Eigen::Vector2d(0.0, speed)));
+		}
+
+		const double innerRadius = 1.5e10;
+		const double innerSpeed = std::sqrt(constants::G * constants::solarMass / innerRadius);
+		particleSystem.addParticle(Particle(1.0f, 1e15, Eigen::Vector2d(-innerRadius, 0.0), Eigen::Vector2d(0.0, -innerSpeed)));
+		return particleSystem;
+	};
+
+	const double dt = 0.25 * 365.25 * 24 * 3600.0;
+	const int steps = 8;
+	BlockTimestepSettings settings;
+	settings.maxLevel = 10;
+	ParticleSystem block = makeSystem(IntegratorType::BlockTimesteps);
+	block.setBlockTimestepSettings(settings);
+
+	// A uniform leapfrog step with more kicks than the block steps take, and the leapfrog on
+	// the shortest step as the reference
+	const int uniformLevel = settings.maxLevel - 3;
+	ParticleSystem uniform = makeSystem(IntegratorType::Leapfrog);
+	ParticleSystem reference = makeSystem(IntegratorType::Leapfrog);
+
+	double kicks = 0.0;
+	for (int step = 0; step < steps; step++)
+	{
+		block.step(dt);
+		for (uint8_t level : block.getStore().level)
+			kicks += std::ldexp(1.0, level);
+		for (int i = 0; i < (1 << uniformLevel); i++)
+			uniform.step(std::ldexp(dt, -uniformLevel));
+		for (int i = 0; i < (1 << settings.maxLevel); i++)
+			reference.step(std::ldexp(dt, -settings.maxLevel));
+	}
+
+	auto worstError = [&](ParticleSystem& particleSystem) {
+		double worst = 0.0;
+		for (ParticleRef& particle : particleSystem.getParticles())
+		{
+			Eigen::Vector2d exact = reference.findParticle(particle.getId()).getPosition();
+			worst = std::max(worst, (particle.getPosition() - exact).norm() / exact.norm());
+		}
+		return worst;
+	};
+
+	const double shortestKicks = steps * block.getParticleCount() * std::ldexp(1.0, settings.maxLevel);
+	REQUIRE(kicks < std::ldexp(shortestKicks, uniformLevel - settings.maxLevel));
+	REQUIRE(worstError(block) < 0.1 * worstError(uniform));
+}
+
+namespace
+{
+// A loose cluster of asteroids on a three month orbit, with Jupiter further out
+ParticleSystem makeCluster(IntegratorType type)
+{
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<double> offset(-1e10, 1e10);
+
+	ParticleSystem particleSystem = makeBinary(type);
+	const double orbitRadius = 6e10;
+	const double speed = std::sqrt(constants::G * constants::solarMass / orbitRadius);
+	for (int i = 0; i < 20; i++)
+	{
+		Eigen::Vector2d position(orbitRadius + offset(rng), offset(rng));
+		particleSystem.addParticle(Particle(1.0f, 1e20, position, Eigen::Vector2d(0.0, speed)));
+	}
+	return particleSystem;
+}
+
+// Largest distance between the same particle in two systems, relative to its distance from the origin
+double worstPositionError(ParticleSystem& particleSystem, ParticleSystem& reference)
+{
+	double worst = 0.0;
+	for (ParticleRef& particle : particleSystem.getParticles())
+	{
+		Eigen::Vector2d exact = reference.findParticle(particle.getId()).getPosition();
+		worst = std::max(worst, (particle.getPosition() - exact).norm() / exact.norm());
+	}
+	return worst;
+}
+}
+
+TEST_CASE("Multiple time stepping resolves the dominant bodies at the fine step", "[integrator]")
+{
+	const double dt = 24 * 3600.0;
+	const int ratio = 8;
+	const int steps = 400;
+
+	// The same number of swarm force calculations as the multiple time stepping
+	ParticleSystem respa = makeCluster(IntegratorType::Respa);
+	ParticleSystem coarse = makeCluster(IntegratorType::Leapfrog);
+	ParticleSystem reference = makeCluster(IntegratorType::Leapfrog);
+	RespaSettings settings;
+	settings.levels = { RespaLevel{ ratio, 0.0 } };
+	respa.setRespaSettings(settings);
+
+	const double initial = totalEnergy(respa);
+	double worstEnergy = 0.0;
+	for (int step = 0; step < steps; step++)
+	{
+		respa.step(dt);
+		reference.step(dt);
+		if (step % ratio == ratio - 1)
+		{
+			coarse.step(ratio * dt);
+			worstEnergy = std::max(worstEnergy, std::abs(totalEnergy(respa) / initial - 1.0));
+		}
+	}
+
+	REQUIRE(worstEnergy < 1e-4);
+	REQUIRE(worstPositionError(respa, reference) < 0.1 * worstPositionError(coarse, reference));
+}
+
+TEST_CASE("Multiple time stepping levels split the swarm by mass", "[integrator]")
+{
+	const double dt = 24 * 3600.0;
+	const int steps = 64;
+
+	// Half of the swarm is light, the heavy half dominates its self-gravity
+	auto makeSystem = [](std::vector<RespaLevel> levels) {
+		ParticleSystem particleSystem = makeCluster(IntegratorType::Respa);
+		ParticleStore& particles = particleSystem.getStore();
+		for (size_t i = 0; i < particles.size(); i++)
+		{
+			if (particles.id[i] % 2 == 0 && particles.id[i] > 1)
+				particles.mass[i] = 1e18;
+		}
+		RespaSettings settings;
+		settings.levels = levels;
+		particleSystem.setRespaSettings(settings);
+		return particleSystem;
+	};
+	ParticleSystem reference = makeSystem({ RespaLevel{ 1, 0.0 } });
+	ParticleSystem single = makeSystem({ RespaLevel{ 8, 0.0 } });
+	ParticleSystem split = makeSystem({ RespaLevel{ 2, 1e19 }, RespaLevel{ 4, 0.0 } });
+
+	// Levels that kick at every step give the same result as a single one
+	ParticleSystem unsplit = makeSystem({ RespaLevel{ 1, 1e19 }, RespaLevel{ 1, 0.0 } });
+
+	for (int step = 0; step < steps; step++)
+	{
+		reference.step(dt);
+		single.step(dt);
+		split.step(dt);
+		unsplit.step(dt);
+	}
+	REQUIRE(worstPositionError(unsplit, reference) < 1e-12);
+	REQUIRE(worstPositionError(split, reference) < 0.5 * worstPositionError(single, reference));
+}
+
+TEST_CASE("Dynamical times come out of the force calculation", "[integrator]")
+{
+	// On a circular orbit both times are the orbital period over 2 pi
+	const double speed = std::sqrt(constants::G * (constants::solarMass + constants::jupiterMass) / constants::jupiterOrbitRadius);
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	particleSystem.addParticle(Particle(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0), Eigen::Vector2d(0.0, speed)));
+	particleSystem.setForceSolverType(ForceSolverType::DirectSum);
+	REQUIRE(std::isinf(particleSystem.getTimestepEstimate().freeFallTime));
+	REQUIRE(particleSystem.getAdaptiveTimestep() == particleSystem.getTimestepSettings().maxStep);
+
+	particleSystem.calculateForces();
+	const double orbitalTime = constants::jupiterOrbitRadius / speed;
+	REQUIRE(particleSystem.getTimestepEstimate().freeFallTime == Approx(orbitalTime).epsilon(1e-6));
+	REQUIRE(particleSystem.getTimestepEstimate().crossingTime == Approx(orbitalTime).epsilon(1e-6));
+
+	TimestepSettings settings;
+	settings.eta = 0.01;
+	settings.maxStep = 1e9;
+	particleSystem.setTimestepSettings(settings);
+	REQUIRE(particleSystem.getAdaptiveTimestep() == Approx(0.01 * orbitalTime));
+}
+
+TEST_CASE("Wisdom-Holman steps estimate the dynamical times of the whole system", "[integrator]")
+{
+	// The force calculation of these integrators leaves out the Sun, yet the estimate must not
+	const double speed = std::sqrt(constants::G * (constants::solarMass + constants::jupiterMass) / constants::jupiterOrbitRadius);
+	const double orbitalTime = constants::jupiterOrbitRadius / speed;
+	for (IntegratorType type : { IntegratorType::Leapfrog, IntegratorType::WisdomHolman, IntegratorType::Hybrid })
+	{
+		ParticleSystem particleSystem = makeBinary(type);
+		particleSystem.getStore().vy[1] = speed;
+		particleSystem.step(24 * 3600.0);
+
+		INFO("Integrator " << static_cast<int>(type));
+		REQUIRE(particleSystem.getTimestepEstimate().freeFallTime == Approx(orbitalTime).epsilon(1e-6));
+		REQUIRE(particleSystem.getTimestepEstimate().crossingTime == Approx(orbitalTime).epsilon(1e-6));
+	}
+}
+
+TEST_CASE("Adaptive steps follow an eccentric orbit through pericenter", "[integrator]")
+{
+	// Eccentricity 0.8, so the dynamical time at pericenter is some 30 times shorter than at apocenter
+	auto makeEccentric = [] {
+		ParticleSystem particleSystem = makeBinary(IntegratorType::Leapfrog);
+		particleSystem.getStore().vy[1] = 5800.0;
+		TimestepSettings settings;
+		settings.eta = 0.02;
+		// Also the first step, which comes before any force calculation
+		settings.minStep = 0.0;
+		settings.maxStep = 1e6;
+		particleSystem.setTimestepSettings(settings);
+		return particleSystem;
+	};
+
+	const double duration = 30 * 365.25 * 24 * 3600.0;
+	ParticleSystem adaptive = makeEccentric();
+	const double initial = totalEnergy(adaptive);
+	double worstAdaptive = 0.0;
+	int steps = 0;
+	for (double time = 0.0; time < duration; steps++)
+	{
+		const double dt = adaptive.getAdaptiveTimestep();
+		adaptive.step(dt);
+		time += dt;
+		worstAdaptive = std::max(worstAdaptive, std::abs(totalEnergy(adaptive) / initial - 1.0));
+	}
+
+	// The same number of steps of equal length
+	const double worstFixed = worstEnergyError(makeEccentric(), steps, duration / steps);
+	REQUIRE(worstAdaptive < 0.1 * worstFixed);
+}
+
+TEST_CASE("Changeover function goes smoothly from 0 to 1", "[integrator]")
+{
+	REQUIRE(HybridIntegrator::changeover(0.0, 1.0) == 0.0);
+	REQUIRE(HybridIntegrator::changeover(0.1, 1.0) == 0.0);
+	REQUIRE(HybridIntegrator::changeover(0.55, 1.0) == Approx(0.5));
+	REQUIRE(HybridIntegrator::changeover(1.0, 1.0) == 1.0);
+	REQUIRE(HybridIntegrator::changeover(2.0, 1.0) == 1.0);
+}
+
+TEST_CASE("Hybrid steps are Wisdom-Holman steps without encounters", "[integrator]")
+{
+	// The belt stays far outside Jupiter's changeover radius
+	auto makeSystem = [](IntegratorType type) {
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+		ParticleSystem particleSystem = makeGiants(type);
+		for (int i = 0; i < 50; i++)
+		{
+			Eigen::Rotation2Dd rotation(angle(rng));
+			double speed = std::sqrt(constants::G * constants::solarMass / 3e11);
+			particleSystem.addParticle(Particle(1.0f, 1e15, rotation * Eigen::Vector2d(3e11, 0.0), rotation * Eigen::Vector2d(0.0, speed)));
+		}
+		return particleSystem;
+	};
+
+	const double dt = 30 * 24 * 3600.0;
+	ParticleSystem hybrid = makeSystem(IntegratorType::Hybrid);
+	ParticleSystem wisdomHolman = makeSystem(IntegratorType::WisdomHolman);
+	for (int i = 0; i < 20; i++)
+	{
+		hybrid.step(dt);
+		wisdomHolman.step(dt);
+		REQUIRE(hybrid.getEncounterCount() == 0);
+	}
+	for (ParticleRef& particle : hybrid.getParticles())
+	{
+		REQUIRE(particle.getPosition() == wisdomHolman.findParticle(particle.getId()).getPosition());
+	}
+}
+
+TEST_CASE("Hybrid steps follow a close flyby of Jupiter", "[integrator]")
+{
+	// Passes Jupiter at 3 km/s with an impact parameter of 5e9 m, and swings by at under 1e9 m
+	auto makeFlyby = [](IntegratorType type) {
+		ParticleSystem particleSystem = makeBinary(type);
+		particleSystem.addParticle(Particle(1.0f, 1e15, Eigen::Vector2d(constants::jupiterOrbitRadius + 5e9, -3e10), Eigen::Vector2d(0.0, 15000.0)));
+		return particleSystem;
+	};
+
+	const double duration = 365.25 * 24 * 3600.0;
+	const int steps = 40;
+	ParticleSystem hybrid = makeFlyby(IntegratorType::Hybrid);
+	ParticleSystem wisdomHolman = makeFlyby(IntegratorType::WisdomHolman);
+	ParticleSystem reference = makeFlyby(IntegratorType::Yoshida4);
+
+	const double initial = totalEnergy(hybrid);
+	double worstEnergy = 0.0;
+	size_t encounters = 0;
+	for (int i = 0; i < steps; i++)
+	{
+		hybrid.step(duration / steps);
+		wisdomHolman.step(duration / steps);
+		encounters += hybrid.getEncounterCount();
+		worstEnergy = std::max(worstEnergy, std::abs(totalEnergy(hybrid) / initial - 1.0));
+	}
+	const int referenceSteps = 50000;
+	for (int i = 0; i < referenceSteps; i++)
+	{
+		reference.step(duration / referenceSteps);
+	}
+
+	auto error = [&](ParticleSystem& particleSystem) {
+		return (particleSystem.findParticle(2).getPosition() - reference.findParticle(2).getPosition()).norm();
+	};
+	REQUIRE(encounters > 0);
+	REQUIRE(worstEnergy < 1e-9);
+	REQUIRE(error(hybrid) < 1e-3 * error(wisdomHolman));
+}
+
+TEST_CASE("Kepler ephemerides follow the integrated orbit", "[integrator]")
+{
+	const double mu = constants::G * constants::solarMass;
+	const KeplerEphemeris circular(mu, constants::earthOrbitRadius, 0.0, 1.0, 2.0);
+	Eigen::Vector2d position;
+	Eigen::Vector2d velocity;
+	circular.evaluate(1e7, position, velocity);
+	REQUIRE(position.norm() == Approx(constants::earthOrbitRadius));
+	REQUIRE(velocity.norm() == Approx(std::sqrt(mu / constants::earthOrbitRadius)));
+	REQUIRE(std::abs(position.dot(velocity)) < 1e-9 * position.norm() * velocity.norm());
+
+	// An eccentric orbit against a test particle integrated from the same start, through pericenter
+	const KeplerEphemeris eccentric(mu, constants::earthOrbitRadius, 0.6, 0.5, -1.0);
+	Eigen::Vector2d start;
+	Eigen::Vector2d startVelocity;
+	eccentric.evaluate(0.0, start, startVelocity);
+
+	// A Sun held at the origin by an ephemeris scaled to nothing, so that both orbit a fixed center
+	ParticleSystem particleSystem;
+	Particle sun(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero());
+	sun.setEphemeris(std::make_shared<KeplerEphemeris>(mu, 1.0, 0.0, 0.0, 0.0, 0.0));
+	particleSystem.addParticle(sun);
+	Particle planet(1.0f, 1.0, start, startVelocity);
+	planet.setTestParticle(true);
+	particleSystem.addParticle(planet);
+	particleSystem.setIntegratorType(IntegratorType::Yoshida4);
+	particleSystem.setThreadCount(1);
+
+	const double duration = 0.5 * eccentric.getPeriod();
+	const int steps = 20000;
+	for (int i = 0; i < steps; i++)
+	{
+		particleSystem.step(duration / steps);
+	}
+
+	eccentric.evaluate(particleSystem.getTime(), position, velocity);
+	REQUIRE(particleSystem.getTime() == Approx(duration));
+	REQUIRE((particleSystem.findParticle(1).getPosition() - position).norm() < 1e-7 * constants::earthOrbitRadius);
+	REQUIRE((particleSystem.findParticle(1).getVelocity() - velocity).norm() < 1e-7 * velocity.norm());
+}
+
+TEST_CASE("Test particles around prescribed bodies follow those around integrated ones", "[integrator]")
+{
+	// The Sun and Jupiter on their circular mutual orbit, either integrated or prescribed
+	auto [sunEphemeris, jupiterEphemeris] = makeBinaryEphemerides(constants::solarMass, constants::jupiterMass, constants::jupiterOrbitRadius);
+	auto makeSystem = [&](bool prescribed) {
+		ParticleSystem particleSystem;
+		Eigen::Vector2d position;
+		Eigen::Vector2d velocity;
+		sunEphemeris->evaluate(0.0, position, velocity);
+		Particle sun(constants::solarRadius, constants::solarMass, position, velocity);
+		jupiterEphemeris->evaluate(0.0, position, velocity);
+		Particle jupiter(constants::jupiterRadius, constants::jupiterMass, position, velocity);
+		if (prescribed)
+		{
+			sun.setEphemeris(sunEphemeris);
+			jupiter.setEphemeris(jupiterEphemeris);
+		}
+		particleSystem.addParticle(sun);
+		particleSystem.addParticle(jupiter);
+
+		// Asteroids between the Sun and Jupiter
+		std::mt19937 rng(4);
+		std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+		std::uniform_real_distribution<double> radius(2e11, 5e11);
+		for (int i = 0; i < 20; i++)
+		{
+			const double r = radius(rng);
+			const Eigen::Rotation2Dd rotation(angle(rng));
+			Particle asteroid(1.0f, 1.0, rotation * Eigen::Vector2d(r, 0.0),
+				rotation * Eigen::Vector2d(0.0, std::sqrt(constants::G * constants::solarMass / r)));
+			asteroid.setTestParticle(true);
+			particleSystem.addParticle(asteroid);
+		}
+		particleSystem.setIntegratorType(IntegratorType::Leapfrog);
+		particleSystem.setThreadCount(1);
+		return particleSystem;
+	};
+
+	ParticleSystem prescribed = makeSystem(true);
+	ParticleSystem integrated = makeSystem(false);
+	REQUIRE(prescribed.getStore().size() == 20);
+	REQUIRE(prescribed.getPrescribedBodies().size() == 2);
+	REQUIRE(prescribed.getParticleCount() == 22);
+
+	const double day = 24 * 3600.0;
+	for (int i = 0; i < 365; i++)
+	{
+		prescribed.step(day);
+		integrated.step(day);
+	}
+
+	Eigen::Vector2d position;
+	Eigen::Vector2d velocity;
+	jupiterEphemeris->evaluate(365 * day, position, velocity);
+	REQUIRE(prescribed.findParticle(1).getPosition() == position);
+	REQUIRE((integrated.findParticle(1).getPosition() - position).norm() < 1e-6 * constants::jupiterOrbitRadius);
+
+	// Jupiter moves the asteroids by tens of thousands of kilometres in a year
+	double worstError = 0.0;
+	for (int id = 2; id < 22; id++)
+	{
+		worstError = std::max(worstError, (prescribed.findParticle(id).getPosition() - integrated.findParticle(id).getPosition()).norm());
+	}
+	REQUIRE(worstError < 1e5);
+}
+
+TEST_CASE("Massless test particles follow Kepler orbits under every integrator", "[integrator]")
+{
+	const double au = 1.496e11;
+	const double mu = constants::G * constants::solarMass;
+	const double day = 24 * 3600.0;
+	const int steps = 365;
+
+	// A circular and an eccentric orbit, and where Kepler puts them after the run
+	const std::array<std::array<double, 4>, 2> starts = { {
+		{ au, 0.0, 0.0, std::sqrt(mu / au) },
+		{ 0.0, 2 * au, -0.8 * std::sqrt(mu / (2 * au)), 0.0 }
+	} };
+	std::array<std::array<double, 4>, 2> expected = starts;
+	for (auto& [x, y, vx, vy] : expected)
+		kernels::keplerDrift(&x, &y, &vx, &vy, 1, mu, steps * day);
+
+	for (IntegratorType type : { IntegratorType::Euler, IntegratorType::Leapfrog, IntegratorType::Yoshida4,
+			 IntegratorType::WisdomHolman, IntegratorType::Hybrid, IntegratorType::BlockTimesteps, IntegratorType::Respa })
+	{
+		ParticleSystem particleSystem;
+		particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+		for (const auto& [x, y, vx, vy] : starts)
+		{
+			Particle tracer(1.0f, 0.0, Eigen::Vector2d(x, y), Eigen::Vector2d(vx, vy));
+			tracer.setTestParticle(true);
+			particleSystem.addParticle(tracer);
+		}
+		particleSystem.setIntegratorType(type);
+		particleSystem.setThreadCount(1);
+
+		for (int i = 0; i < steps; i++)
+			particleSystem.step(day);
+
+		// Semi-implicit Euler is only first order
+		const double tolerance = type == IntegratorType::Euler ? 5e-2 : 1e-3;
+		for (int id = 1; id <= 2; id++)
+		{
+			INFO("Integrator " << static_cast<int>(type) << ", tracer " << id);
+			const Eigen::Vector2d position = particleSystem.findParticle(id).getPosition();
+			REQUIRE(position.allFinite());
+			const Eigen::Vector2d kepler(expected[id - 1][0], expected[id - 1][1]);
+			CHECK((position - kepler).norm() < tolerance * kepler.norm());
+		}
+	}
+}
@@ -0,0 +1,331 @@
+#include <catch2/catch.hpp>
+
+#include "Objects.hpp"
+#include "utils.hpp"
+
+#include <random>
+
+namespace
+{
+ParticleSystem makeSwarm(int count, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::normal_distribution<double> offset(0.0, 5e10);
+	std::uniform_real_distribution<double> angle(0.0, 2 * M_PI);
+
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+
+	// A ring with one dense clump, so the cost per particle is uneven
+	for (int i = 0; i < count; i++)
+	{
+		Eigen::Vector2d position = Eigen::Rotation2Dd(angle(rng)) * Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0);
+		if (i % 4 == 0)
+			position = Eigen::Vector2d(constants::jupiterOrbitRadius + offset(rng) * 0.01, offset(rng) * 0.01);
+		particleSystem.addParticle(Particle(1.0f, 1e18, position, Eigen::Vector2d::Zero()));
+	}
+	return particleSystem;
+}
+}
+
+TEST_CASE("Parallel Barnes-Hut forces match the serial forces", "[particlesystem]")
+{
+	ParticleSystem serial = makeSwarm(5000, 1);
+	serial.setThreadCount(1);
+	serial.calculateForcesBarnesHut();
+
+	ParticleSystem parallel = makeSwarm(5000, 1);
+	parallel.setThreadCount(4);
+	parallel.calculateForcesBarnesHut();
+
+	REQUIRE(parallel.getThreadCount() == 4);
+	REQUIRE(serial.getParticleCount() == parallel.getParticleCount());
+	for (size_t i = 0; i < serial.getParticles().size(); i++)
+	{
+		REQUIRE(serial.getParticles()[i].getForce() == parallel.getParticles()[i].getForce());
+	}
+}
+
+TEST_CASE("Batch integration matches the per-particle Euler step", "[particlesystem]")
+{
+	// Not a multiple of the SIMD width, and enough bodies for several blocks
+	ParticleSystem particleSystem = makeSwarm(20001, 3);
+	particleSystem.setThreadCount(3);
+	particleSystem.calculateForcesDirect();
+
+	const float dt = 3600.0f;
+	const ParticleStore before = particleSystem.getStore();
+	particleSystem.update(dt);
+
+	const ParticleStore& after = particleSystem.getStore();
+	for (size_t i = 0; i < before.size(); i++)
+	{
+		Eigen::Vector2d acceleration = before.getForce(i) / before.mass[i];
+		Eigen::Vector2d velocity = before.getVelocity(i) + acceleration * dt;
+		Eigen::Vector2d position = before.getPosition(i) + velocity * dt;
+		REQUIRE((after.getAcceleration(i) - acceleration).norm() <= 1e-12 * acceleration.norm());
+		REQUIRE((after.getVelocity(i) - velocity).norm() <= 1e-12 * velocity.norm());
+		REQUIRE((after.getPosition(i) - position).norm() <= 1e-12 * position.norm());
+		REQUIRE(after.getForce(i) == Eigen::Vector2d::Zero());
+	}
+}
+
+TEST_CASE("Relative opening criterion saves interactions at bounded error", "[particlesystem]")
+{
+	// One step gives every particle a previous acceleration
+	ParticleSystem particleSystem = makeSwarm(5000, 2);
+	particleSystem.calculateForcesDirect();
+	particleSystem.update(1.0f);
+
+	ParticleSystem reference = particleSystem;
+	reference.calculateForcesDirect();
+
+	// Monopole cells go into the same list as bodies, and must still count as cells
+	for (MultipoleOrder order : { MultipoleOrder::Monopole, MultipoleOrder::Quadrupole })
+	{
+		auto forceError = [&](OpeningCriterion criterion, TreeStatistics& statistics) {
+			ParticleSystem tree = particleSystem;
+			TreeSettings settings;
+			settings.multipoleOrder = order;
+			settings.openingCriterion = criterion;
+			tree.setTreeSettings(settings);
+			tree.calculateForcesBarnesHut();
+			statistics = tree.getTreeStatistics();
+
+			// Worst error relative to each particle's own force, which is what the relative criterion bounds
+			double worst = 0.0;
+			for (ParticleRef& particle : tree.getParticles())
+			{
+				Eigen::Vector2d exact = reference.findParticle(particle.getId())->getForce();
+				worst = std::max(worst, (particle.getForce() - exact).norm() / exact.norm());
+			}
+			return worst;
+		};
+
+		INFO("Multipole order " << static_cast<int>(order));
+		TreeStatistics geometric;
+		TreeStatistics relative;
+		double geometricError = forceError(OpeningCriterion::Geometric, geometric);
+		double relativeError = forceError(OpeningCriterion::Relative, relative);
+		REQUIRE(relativeError < 0.01);
+		REQUIRE(relativeError <= geometricError);
+		REQUIRE(geometric.cellInteractions > 0);
+		REQUIRE(relative.cellInteractions > 0);
+		REQUIRE(relative.cellInteractions + relative.bodyInteractions < geometric.cellInteractions + geometric.bodyInteractions);
+	}
+}
+
+TEST_CASE("Test particles feel the massive bodies and are left out of the tree", "[particlesystem]")
+{
+	// A few massive bodies mixed in among the test particles
+	std::mt19937 rng(4);
+	std::uniform_real_distribution<double> coordinate(-1e12, 1e12);
+	ParticleSystem particleSystem;
+	ParticleSystem massiveOnly;
+	for (int i = 0; i < 3001; i++)
+	{
+		Particle particle(1.0f, i % 1000 == 0 ? 1e27 : 1.0, Eigen::Vector2d(coordinate(rng), coordinate(rng)), Eigen::Vector2d::Zero());
+		particle.setTestParticle(i % 1000 != 0);
+		particleSystem.addParticle(particle);
+		if (!particle.isTestParticle())
+			massiveOnly.addParticle(particle);
+	}
+	particleSystem.setThreadCount(3);
+	particleSystem.calculateForcesBarnesHut();
+	massiveOnly.calculateForcesBarnesHut();
+
+	// Only the massive bodies went into the tree, and their forces ignore the test particles
+	REQUIRE(particleSystem.getTreeStatistics().bodyInteractions == massiveOnly.getTreeStatistics().bodyInteractions);
+	for (ParticleRef& particle : massiveOnly.getParticles())
+	{
+		// Every thousandth particle was massive
+		REQUIRE(particleSystem.findParticle(1000 * particle.getId())->getForce() == particle.getForce());
+	}
+
+	// Test particles get the exact pull of the massive bodies
+	const ParticleStore& massive = massiveOnly.getStore();
+	for (ParticleRef& particle : particleSystem.getParticles())
+	{
+		if (particle.getMass() > 1.0) continue;
+		Eigen::Vector2d acceleration = Eigen::Vector2d::Zero();
+		for (size_t j = 0; j < massive.size(); j++)
+		{
+			Eigen::Vector2d separation = massive.getPosition(j) - particle.getPosition();
+			acceleration += constants::G * massive.mass[j] / std::pow(separation.norm(), 3) * separation;
+		}
+		REQUIRE((particle.getForce() - acceleration).norm() <= 1e-12 * acceleration.norm());
+	}
+}
+
+TEST_CASE("Test particles off the active block timestep level are not re-evaluated", "[particlesystem]")
+{
+	// The Sun integrated, Jupiter prescribed, asteroids on alternating levels
+	auto [sunEphemeris, jupiterEphemeris] = makeBinaryEphemerides(constants::solarMass, constants::jupiterMass, constants::jupiterOrbitRadius);
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	Particle jupiter(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero());
+	jupiter.setEphemeris(jupiterEphemeris);
+	particleSystem.addParticle(jupiter);
+	for (int i = 0; i < 1000; i++)
+	{
+		Particle asteroid(1.0f, 1.0, Eigen::Rotation2Dd(0.01 * i) * Eigen::Vector2d(3e11, 0.0), Eigen::Vector2d::Zero());
+		asteroid.setTestParticle(true);
+		particleSystem.addParticle(asteroid);
+	}
+	particleSystem.setForceSolverType(ForceSolverType::DirectSum);
+	particleSystem.setThreadCount(2);
+
+	ParticleStore& particles = particleSystem.getStore();
+	for (size_t i = 0; i < particles.size(); i++)
+		particles.level[i] = i % 2 == 0 ? 3 : 0;
+	const std::vector<Eigen::Vector2d> before = particleSystem.calculateActiveAccelerations(0);
+
+	// Everything moves, so any entry that was evaluated again changes
+	for (size_t i = 0; i < particles.size(); i++)
+		particles.x[i] += 1e10;
+	const std::vector<Eigen::Vector2d> active = particleSystem.calculateActiveAccelerations(2);
+	const std::vector<Eigen::Vector2d> after = particleSystem.calculateActiveAccelerations(0);
+
+	size_t dueCount = 0;
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		if (!particles.testParticle[i]) continue;
+		if (particles.level[i] >= 2)
+		{
+			dueCount++;
+			REQUIRE(active[i] == after[i]);
+		}
+		else
+		{
+			REQUIRE(active[i] == before[i]);
+			REQUIRE(active[i] != after[i]);
+		}
+	}
+	REQUIRE(dueCount == 500);
+}
+
+TEST_CASE("Particles that hit the Sun or escape are removed with their fates", "[particlesystem]")
+{
+	auto makeSystem = [](bool remove) {
+		ParticleSystem particleSystem;
+		particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+		auto addAsteroid = [&](const Eigen::Vector2d& position, const Eigen::Vector2d& velocity) {
+			Particle asteroid(1.0f, 1.0, position, velocity);
+			asteroid.setTestParticle(true);
+			particleSystem.addParticle(asteroid);
+		};
+
+		// Falls into the Sun from rest, and leaves at three times the escape speed
+		addAsteroid(Eigen::Vector2d(2e9, 0.0), Eigen::Vector2d::Zero());
+		addAsteroid(Eigen::Vector2d(0.0, 1e12), Eigen::Vector2d(0.0, 5e4));
+		for (int i = 0; i < 10; i++)
+		{
+			const Eigen::Rotation2Dd rotation(i * 0.6);
+			addAsteroid(rotation * Eigen::Vector2d(constants::earthOrbitRadius, 0.0), rotation * Eigen::Vector2d(0.0, 29780.0));
+		}
+
+		RemovalSettings settings;
+		settings.removeImpacts = remove;
+		if (remove)
+		{
+			settings.escapeRadius = 1.0001e12;
+			settings.predicate = [](const ParticleStore& particles, size_t slot) { return particles.id[slot] == 5 || particles.id[slot] == 9; };
+		}
+		particleSystem.setRemovalSettings(settings);
+		particleSystem.setThreadCount(2);
+		return particleSystem;
+	};
+
+	ParticleSystem particleSystem = makeSystem(true);
+	ParticleSystem reference = makeSystem(false);
+	for (int i = 0; i < 200; i++)
+	{
+		particleSystem.step(60.0);
+		reference.step(60.0);
+	}
+
+	const std::vector<RemovedParticle>& removed = particleSystem.getRemovedParticles();
+	REQUIRE(removed.size() == 4);
+	REQUIRE(particleSystem.getDestroyedParticleCount() == 4);
+	REQUIRE(particleSystem.getParticleCount() == 9);
+	REQUIRE(particleSystem.getStore().size() == 9);
+
+	// The predicate picks its particles after the first step, the others go when they get there
+	REQUIRE(removed[0].id == 5);
+	REQUIRE(removed[0].fate == ParticleFate::Discarded);
+	REQUIRE(removed[0].time == 60.0);
+	REQUIRE(removed[1].id == 9);
+	REQUIRE(removed[1].fate == ParticleFate::Discarded);
+	for (const RemovedParticle& particle : removed)
+	{
+		if (particle.id == 1)
+		{
+			REQUIRE(particle.fate == ParticleFate::Impact);
+			REQUIRE(particle.position.norm() < constants::solarRadius);
+		}
+		if (particle.id == 2)
+		{
+			REQUIRE(particle.fate == ParticleFate::Ejection);
+			REQUIRE(particle.position.norm() > 1.0001e12);
+		}
+		REQUIRE(!particleSystem.findParticle(particle.id));
+	}
+
+	// Test particles do not feel each other, so the survivors move as if nothing was removed
+	for (ParticleRef& particle : particleSystem.getParticles())
+	{
+		REQUIRE(particle.getPosition() == reference.findParticle(particle.getId()).getPosition());
+		REQUIRE(particle.getVelocity() == reference.findParticle(particle.getId()).getVelocity());
+	}
+}
+
+TEST_CASE("Handles follow their particles through reordering and go stale on removal", "[particlesystem]")
+{
+	ParticleSystem particleSystem = makeSwarm(2000, 5);
+	particleSystem.setForceSolverType(ForceSolverType::BarnesHut);
+	std::vector<ParticleHandle> handles;
+	std::vector<Eigen::Vector2d> positions;
+	for (ParticleRef& particle : particleSystem.getParticles())
+	{
+		handles.push_back(particle.getHandle());
+		positions.push_back(particle.getPosition());
+	}
+
+	// The tree sorts the store into Z-order
+	particleSystem.calculateForces();
+	REQUIRE(particleSystem.getParticles()[1].getId() != 1);
+	for (size_t i = 0; i < handles.size(); i++)
+	{
+		ParticleRef particle = particleSystem.findParticle(handles[i]);
+		REQUIRE(particle.getId() == handles[i].id);
+		REQUIRE(particle.getPosition() == positions[i]);
+	}
+
+	// Every third particle goes, the others keep their handles
+	RemovalSettings settings;
+	settings.removeImpacts = false;
+	settings.predicate = [](const ParticleStore& particles, size_t slot) { return particles.id[slot] % 3 == 2; };
+	particleSystem.setRemovalSettings(settings);
+	particleSystem.step(3600.0);
+	particleSystem.setRemovalSettings(RemovalSettings());
+	REQUIRE(particleSystem.getParticleCount() == 1334);
+	for (const ParticleHandle& handle : handles)
+	{
+		REQUIRE(particleSystem.isAlive(handle) == (handle.id % 3 != 2));
+		REQUIRE(bool(particleSystem.findParticle(handle)) == (handle.id % 3 != 2));
+	}
+
+	const ParticleStore& store = particleSystem.getStore();
+	for (size_t i = 0; i < store.size(); i++)
+	{
+		REQUIRE(store.findSlot(store.id[i]) == i);
+	}
+
+	// A new particle takes a free id, which the old handle does not reach
+	const ParticleHandle added = particleSystem.addParticle(Particle(1.0f, 1e18, Eigen::Vector2d(1e11, 0.0), Eigen::Vector2d::Zero()));
+	REQUIRE(added.id % 3 == 2);
+	REQUIRE(added.generation == 1);
+	REQUIRE(!particleSystem.findParticle(handles[added.id]));
+	REQUIRE(particleSystem.findParticle(added).getPosition() == Eigen::Vector2d(1e11, 0.0));
+	REQUIRE(particleSystem.findParticle(added.id).getHandle() == added);
+}
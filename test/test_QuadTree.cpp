@@ -0,0 +1,280 @@
+#include <catch2/catch.hpp>
+
+#include "QuadTree.hpp"
+#include "utils.hpp"
+
+#include <random>
+
+namespace
+{
+ParticleStore makeCluster(int count, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> position(-1e11, 1e11);
+	std::uniform_real_distribution<double> mass(1e20, 1e24);
+
+	ParticleStore particles;
+	for (int i = 0; i < count; i++)
+	{
+		particles.add(i, 1.0f, mass(rng), Eigen::Vector2d(position(rng), position(rng)), Eigen::Vector2d::Zero());
+	}
+	return particles;
+}
+
+Eigen::Vector2d directForce(const ParticleStore& particles, size_t target)
+{
+	Eigen::Vector2d force = Eigen::Vector2d::Zero();
+	for (size_t j = 0; j < particles.size(); j++)
+	{
+		Eigen::Vector2d direction = particles.getPosition(j) - particles.getPosition(target);
+		double distance = direction.norm();
+		if (distance < QuadTreeNode::MIN_DISTANCE)
+			continue;
+		force += constants::G * particles.mass[j] * particles.mass[target] / (distance * distance * distance) * direction;
+	}
+	return force;
+}
+
+Eigen::Vector2d treeForce(const QuadTree& tree, const ParticleStore& particles, size_t target)
+{
+	return tree.calculateForce(particles.getPosition(target), particles.mass[target]);
+}
+}
+
+TEST_CASE("QuadTree nodes are laid out depth-first", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(500, 1);
+
+	QuadTree tree(Eigen::Vector2d(-2e11, -2e11), Eigen::Vector2d(2e11, 2e11));
+	tree.build(particles);
+
+	const std::vector<QuadTreeNode>& nodes = tree.getNodes();
+	REQUIRE(!nodes.empty());
+	REQUIRE(nodes[0].next == nodes.size());
+	REQUIRE(nodes[0].particleCount == particles.size());
+
+	double totalMass = 0.0;
+	for (double mass : particles.mass)
+		totalMass += mass;
+	REQUIRE(nodes[0].totalMass == Approx(totalMass));
+
+	for (uint32_t n = 0; n < nodes.size(); n++)
+	{
+		const QuadTreeNode& node = nodes[n];
+		REQUIRE(node.next > n);
+		if (node.isLeaf())
+			continue;
+
+		// Children follow the parent and tile its particle range
+		REQUIRE(node.firstChild == n + 1);
+		uint32_t expectedBegin = node.particleBegin;
+		uint32_t c = node.firstChild;
+		for (; c < node.next; c = nodes[c].next)
+		{
+			REQUIRE(nodes[c].particleBegin == expectedBegin);
+			expectedBegin += nodes[c].particleCount;
+		}
+		REQUIRE(c == node.next);
+		REQUIRE(expectedBegin == node.particleBegin + node.particleCount);
+	}
+}
+
+TEST_CASE("QuadTree force approximates the direct sum", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(300, 2);
+
+	QuadTree tree(Eigen::Vector2d(-2e11, -2e11), Eigen::Vector2d(2e11, 2e11));
+	tree.build(particles);
+
+	// Build twice so the second build runs on the reused arena
+	tree.build(particles);
+
+	// Individual particles can sit where the net force nearly cancels, so compare the RMS error
+	double errorSquared = 0.0;
+	double forceSquared = 0.0;
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		Eigen::Vector2d exact = directForce(particles, i);
+		Eigen::Vector2d approx = treeForce(tree, particles, i);
+		errorSquared += (approx - exact).squaredNorm();
+		forceSquared += exact.squaredNorm();
+	}
+	REQUIRE(std::sqrt(errorSquared / forceSquared) < 0.01);
+}
+
+TEST_CASE("QuadTree parallel build matches the serial build", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(20000, 3);
+	const Eigen::Vector2d min(-2e11, -2e11);
+	const Eigen::Vector2d max(2e11, 2e11);
+
+	QuadTree serialTree(min, max);
+	serialTree.build(particles);
+
+	util::ThreadPool pool(4);
+	QuadTree parallelTree(min, max);
+	parallelTree.build(particles, pool);
+
+	REQUIRE(serialTree.getParticleIndices() == parallelTree.getParticleIndices());
+	REQUIRE(serialTree.getNodes().size() == parallelTree.getNodes().size());
+	for (size_t n = 0; n < serialTree.getNodes().size(); n++)
+	{
+		REQUIRE(serialTree.getNodes()[n].next == parallelTree.getNodes()[n].next);
+		REQUIRE(serialTree.getNodes()[n].totalMass == parallelTree.getNodes()[n].totalMass);
+	}
+}
+
+TEST_CASE("QuadTree refit tracks small motions and rejects escapes", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(2000, 4);
+	const Eigen::Vector2d min(-2e11, -2e11);
+	const Eigen::Vector2d max(2e11, 2e11);
+
+	util::ThreadPool pool(2);
+	QuadTree tree(min, max);
+	tree.build(particles, pool);
+
+	// Nudge every particle slightly; a few cross into neighbouring cells
+	ParticleStore moved = particles;
+	std::mt19937 rng(5);
+	std::normal_distribution<double> nudge(0.0, 2e7);
+	for (size_t i = 0; i < moved.size(); i++)
+	{
+		moved.x[i] += nudge(rng);
+		moved.y[i] += nudge(rng);
+	}
+	REQUIRE(tree.refit(moved, pool));
+
+	QuadTree rebuilt(min, max);
+	rebuilt.build(moved, pool);
+	REQUIRE(tree.getRoot()->totalMass == Approx(rebuilt.getRoot()->totalMass));
+	for (size_t i = 0; i < moved.size(); i += 50)
+	{
+		Eigen::Vector2d refitForce = treeForce(tree, moved, i);
+		Eigen::Vector2d rebuiltForce = treeForce(rebuilt, moved, i);
+		REQUIRE((refitForce - rebuiltForce).norm() <= 0.05 * rebuiltForce.norm());
+	}
+
+	// A particle outside the root bounds forces a rebuild
+	moved.x[0] = 3e11;
+	moved.y[0] = 0.0;
+	REQUIRE(!tree.refit(moved, pool));
+}
+
+TEST_CASE("QuadTree group traversal approximates the direct sum", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(3000, 6);
+
+	util::ThreadPool pool(2);
+	QuadTree tree(Eigen::Vector2d(-2e11, -2e11), Eigen::Vector2d(2e11, 2e11));
+	tree.build(particles, pool);
+
+	for (TreeTraversal traversal : { TreeTraversal::PerParticle, TreeTraversal::Group })
+	{
+		TreeSettings settings;
+		settings.traversal = traversal;
+		tree.setSettings(settings);
+
+		std::vector<Eigen::Vector2d> accelerations;
+		tree.calculateAccelerations(accelerations, pool);
+		REQUIRE(accelerations.size() == particles.size());
+
+		double errorSquared = 0.0;
+		double forceSquared = 0.0;
+		for (size_t i = 0; i < particles.size(); i += 10)
+		{
+			Eigen::Vector2d exact = directForce(particles, i);
+			errorSquared += (accelerations[i] * particles.mass[i] - exact).squaredNorm();
+			forceSquared += exact.squaredNorm();
+		}
+		REQUIRE(std::sqrt(errorSquared / forceSquared) < 0.01);
+	}
+}
+
+TEST_CASE("QuadTree leaf buckets hold at most the configured size", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(3000, 7);
+
+	util::ThreadPool pool(2);
+	QuadTree tree(Eigen::Vector2d(-2e11, -2e11), Eigen::Vector2d(2e11, 2e11));
+
+	size_t previousNodeCount = 0;
+	for (uint32_t bucketSize : { 1u, 8u, 64u })
+	{
+		TreeSettings settings;
+		settings.bucketSize = bucketSize;
+		tree.setSettings(settings);
+		REQUIRE(tree.getNodes().empty());
+		tree.build(particles, pool);
+
+		for (const QuadTreeNode& node : tree.getNodes())
+		{
+			if (node.isLeaf())
+				REQUIRE(node.particleCount <= bucketSize);
+			else
+				REQUIRE(node.particleCount > bucketSize);
+		}
+
+		// Larger buckets give shallower trees
+		if (previousNodeCount > 0)
+			REQUIRE(tree.getNodes().size() < previousNodeCount);
+		previousNodeCount = tree.getNodes().size();
+
+		std::vector<Eigen::Vector2d> accelerations;
+		tree.calculateAccelerations(accelerations, pool);
+
+		double errorSquared = 0.0;
+		double forceSquared = 0.0;
+		for (size_t i = 0; i < particles.size(); i += 10)
+		{
+			Eigen::Vector2d exact = directForce(particles, i);
+			Eigen::Vector2d single = treeForce(tree, particles, i);
+			errorSquared += (accelerations[i] * particles.mass[i] - exact).squaredNorm();
+			errorSquared += (single - exact).squaredNorm();
+			forceSquared += 2.0 * exact.squaredNorm();
+		}
+		REQUIRE(std::sqrt(errorSquared / forceSquared) < 0.01);
+	}
+}
+
+TEST_CASE("QuadTree higher multipole moments reduce the force error", "[quadtree]")
+{
+	ParticleStore particles = makeCluster(4000, 8);
+
+	util::ThreadPool pool(2);
+	QuadTree tree(Eigen::Vector2d(-2e11, -2e11), Eigen::Vector2d(2e11, 2e11));
+	tree.build(particles, pool);
+
+	auto forceError = [&](MultipoleOrder order, TreeTraversal traversal, double theta) {
+		TreeSettings settings;
+		settings.multipoleOrder = order;
+		settings.traversal = traversal;
+		settings.theta = theta;
+		tree.setSettings(settings);
+
+		std::vector<Eigen::Vector2d> accelerations;
+		tree.calculateAccelerations(accelerations, pool);
+
+		double errorSquared = 0.0;
+		double forceSquared = 0.0;
+		for (size_t i = 0; i < particles.size(); i += 10)
+		{
+			Eigen::Vector2d exact = directForce(particles, i);
+			errorSquared += (accelerations[i] * particles.mass[i] - exact).squaredNorm();
+			forceSquared += exact.squaredNorm();
+		}
+		return std::sqrt(errorSquared / forceSquared);
+	};
+
+	for (TreeTraversal traversal : { TreeTraversal::PerParticle, TreeTraversal::Group })
+	{
+		double monopole = forceError(MultipoleOrder::Monopole, traversal, 0.8);
+		double quadrupole = forceError(MultipoleOrder::Quadrupole, traversal, 0.8);
+		double octupole = forceError(MultipoleOrder::Octupole, traversal, 0.8);
+		REQUIRE(quadrupole < monopole);
+		REQUIRE(octupole < quadrupole);
+
+		// Quadrupoles at a wide opening angle are as accurate as monopoles at the default one
+		REQUIRE(quadrupole < forceError(MultipoleOrder::Monopole, traversal, QuadTreeNode::THETA));
+	}
+}
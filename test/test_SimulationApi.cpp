@@ -0,0 +1,235 @@
+#include <catch2/catch.hpp>
+
+#include "Objects.hpp"
+#include "Scenario.hpp"
+#include "SimulationApi.h"
+#include "utils.hpp"
+
+TEST_CASE("The C interface steps like the particle system it wraps", "[simulationapi]")
+{
+	ParticleSystem reference;
+	reference.setThreadCount(1);
+	reference.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	reference.addParticle(Particle(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0), Eigen::Vector2d(0.0, 13070.0)));
+
+	psim_system* system = psim_create(1);
+	const int sun = psim_add_particle(system, constants::solarMass, constants::solarRadius, 0.0, 0.0, 0.0, 0.0, 0);
+	const int jupiter = psim_add_particle(system, constants::jupiterMass, constants::jupiterRadius, constants::jupiterOrbitRadius, 0.0, 0.0, 13070.0, 0);
+	REQUIRE(sun == 0);
+	REQUIRE(jupiter == 1);
+	REQUIRE(psim_get_particle_count(system) == 2);
+
+	const double dt = 24 * 60 * 60;
+	for (int i = 0; i < 100; i++)
+	{
+		reference.step(dt);
+		psim_step(system, dt);
+	}
+	CHECK(psim_get_time(system) == Approx(reference.getTime()));
+
+	double position[2];
+	double velocity[2];
+	REQUIRE(psim_get_state(system, jupiter, position, velocity));
+	ParticleRef expected = reference.findParticle(jupiter);
+	CHECK(position[0] == expected.getPosition().x());
+	CHECK(position[1] == expected.getPosition().y());
+	CHECK(velocity[0] == expected.getVelocity().x());
+	CHECK(velocity[1] == expected.getVelocity().y());
+	CHECK_FALSE(psim_get_state(system, 7, position, velocity));
+	CHECK(psim_find_slot(system, 7) == -1);
+
+	// The buffers are the store's own arrays, so writes show up in the simulation
+	psim_buffers buffers = psim_get_buffers(system);
+	REQUIRE(buffers.count == 2);
+	const long slot = psim_find_slot(system, jupiter);
+	REQUIRE(slot >= 0);
+	CHECK(buffers.id[slot] == jupiter);
+	CHECK(buffers.x[slot] == position[0]);
+	buffers.vx[slot] += 1000.0;
+	REQUIRE(psim_get_state(system, jupiter, position, velocity));
+	CHECK(velocity[0] == expected.getVelocity().x() + 1000.0);
+
+	psim_destroy(system);
+}
+
+TEST_CASE("Stepping after writing the C buffers matches a system built with the new state", "[simulationapi]")
+{
+	const double dt = 24 * 60 * 60;
+	for (int integrator : { PSIM_INTEGRATOR_LEAPFROG, PSIM_INTEGRATOR_WISDOM_HOLMAN, PSIM_INTEGRATOR_BLOCK_TIMESTEPS, PSIM_INTEGRATOR_RESPA })
+	{
+		INFO("Integrator " << integrator);
+		psim_system* system = psim_create(1);
+		psim_add_particle(system, constants::solarMass, constants::solarRadius, 0.0, 0.0, 0.0, 0.0, 0);
+		const int jupiter = psim_add_particle(system, constants::jupiterMass, constants::jupiterRadius, constants::jupiterOrbitRadius, 0.0, 0.0, 13070.0, 0);
+		REQUIRE(psim_set_integrator(system, integrator) == 1);
+		for (int i = 0; i < 10; i++) psim_step(system, dt);
+
+		// Put Jupiter somewhere else on its orbit, so accelerations kept from before are wrong
+		psim_buffers buffers = psim_get_buffers(system);
+		const long slot = psim_find_slot(system, jupiter);
+		REQUIRE(slot >= 0);
+		const long sunSlot = 1 - slot;
+		buffers.x[slot] = 0.0;
+		buffers.y[slot] = constants::jupiterOrbitRadius;
+		buffers.vx[slot] = -13070.0;
+		buffers.vy[slot] = 0.0;
+		REQUIRE(psim_buffers_modified(system) == 1);
+
+		psim_system* fresh = psim_create(1);
+		psim_add_particle(fresh, constants::solarMass, constants::solarRadius, buffers.x[sunSlot], buffers.y[sunSlot], buffers.vx[sunSlot], buffers.vy[sunSlot], 0);
+		psim_add_particle(fresh, constants::jupiterMass, constants::jupiterRadius, 0.0, constants::jupiterOrbitRadius, -13070.0, 0.0, 0);
+		REQUIRE(psim_set_integrator(fresh, integrator) == 1);
+
+		psim_step(system, dt);
+		psim_step(fresh, dt);
+
+		double position[2];
+		double velocity[2];
+		double expectedPosition[2];
+		double expectedVelocity[2];
+		REQUIRE(psim_get_state(system, jupiter, position, velocity));
+		REQUIRE(psim_get_state(fresh, 1, expectedPosition, expectedVelocity));
+		CHECK(position[0] == Approx(expectedPosition[0]));
+		CHECK(position[1] == Approx(expectedPosition[1]));
+		CHECK(velocity[0] == Approx(expectedVelocity[0]));
+		CHECK(velocity[1] == Approx(expectedVelocity[1]));
+
+		psim_destroy(fresh);
+		psim_destroy(system);
+	}
+}
+
+TEST_CASE("The C interface advances to the end of a duration and removes escapees", "[simulationapi]")
+{
+	psim_system* system = psim_create(1);
+	psim_add_particle(system, constants::solarMass, constants::solarRadius, 0.0, 0.0, 0.0, 0.0, 0);
+	// Well past escape velocity
+	psim_add_particle(system, 1.0, 1.0, 1e11, 0.0, 1e5, 0.0, 1);
+	psim_set_integrator(system, PSIM_INTEGRATOR_LEAPFROG);
+	CHECK(psim_set_escape_radius(system, 2e11) == 1);
+
+	const double day = 24 * 60 * 60;
+	CHECK(psim_advance(system, 10.5 * day, day) == 11);
+	CHECK(psim_get_time(system) == Approx(10.5 * day));
+	CHECK(psim_get_removed_count(system) == 0);
+
+	psim_advance(system, 20 * day, day);
+	CHECK(psim_get_removed_count(system) == 1);
+	CHECK(psim_get_particle_count(system) == 1);
+
+	psim_destroy(system);
+}
+
+TEST_CASE("The C interface rejects invalid particles and settings", "[simulationapi]")
+{
+	psim_system* system = psim_create(1);
+	CHECK(psim_add_particle(system, -1.0, 1.0, 0.0, 0.0, 0.0, 0.0, 0) == -1);
+	CHECK(psim_add_particle(system, 1.0, -1.0, 0.0, 0.0, 0.0, 0.0, 0) == -1);
+	CHECK(psim_add_particle(system, 1.0, 1.0, std::nan(""), 0.0, 0.0, 0.0, 0) == -1);
+	CHECK(psim_add_particle(system, 1.0, 1.0, 0.0, 0.0, std::numeric_limits<double>::infinity(), 0.0, 0) == -1);
+	CHECK(psim_get_particle_count(system) == 0);
+
+	CHECK(psim_set_solver(system, PSIM_SOLVER_BARNES_HUT) == 1);
+	CHECK(psim_set_solver(system, -1) == 0);
+	CHECK(psim_set_solver(system, PSIM_SOLVER_FAST_MULTIPOLE + 1) == 0);
+	CHECK(psim_set_integrator(system, PSIM_INTEGRATOR_RESPA) == 1);
+	CHECK(psim_set_integrator(system, -1) == 0);
+	CHECK(psim_set_integrator(system, PSIM_INTEGRATOR_RESPA + 1) == 0);
+
+	// Time arguments that are not finite, or steps that go nowhere, change nothing
+	const double infinity = std::numeric_limits<double>::infinity();
+	const double day = 24 * 60 * 60;
+	const int sun = psim_add_particle(system, constants::solarMass, constants::solarRadius, 0.0, 0.0, 0.0, 0.0, 0);
+	const int earth = psim_add_particle(system, constants::earthMass, constants::earthRadius, constants::earthOrbitRadius, 0.0, 0.0, 29780.0, 0);
+	REQUIRE(sun >= 0);
+	REQUIRE(earth >= 0);
+	for (double dt : { std::nan(""), infinity, -infinity, 0.0, -day })
+	{
+		CHECK(psim_step(system, dt) == 0);
+	}
+	CHECK(psim_advance(system, infinity, day) == 0);
+	CHECK(psim_advance(system, std::nan(""), day) == 0);
+	CHECK(psim_advance(system, 10 * day, infinity) == 0);
+	CHECK(psim_advance(system, 10 * day, std::nan("")) == 0);
+	CHECK(psim_get_time(system) == 0.0);
+
+	double position[2];
+	double velocity[2];
+	REQUIRE(psim_get_state(system, earth, position, velocity));
+	CHECK(position[0] == constants::earthOrbitRadius);
+	CHECK(position[1] == 0.0);
+	CHECK(velocity[1] == 29780.0);
+
+	CHECK(psim_step(system, day) == 1);
+	CHECK(psim_get_time(system) == day);
+
+	psim_destroy(system);
+}
+
+TEST_CASE("Massless test particles added through the C interface orbit the Sun", "[simulationapi]")
+{
+	const double mu = constants::G * constants::solarMass;
+	const double radius = constants::earthOrbitRadius;
+	const double speed = std::sqrt(mu / radius);
+	for (int integrator : { PSIM_INTEGRATOR_LEAPFROG, PSIM_INTEGRATOR_WISDOM_HOLMAN, PSIM_INTEGRATOR_RESPA })
+	{
+		psim_system* system = psim_create(1);
+		psim_add_particle(system, constants::solarMass, constants::solarRadius, 0.0, 0.0, 0.0, 0.0, 0);
+		const int tracer = psim_add_particle(system, 0.0, 1.0, radius, 0.0, 0.0, speed, 1);
+		REQUIRE(tracer == 1);
+		REQUIRE(psim_set_integrator(system, integrator) == 1);
+		psim_advance(system, 100 * 24 * 3600.0, 24 * 3600.0);
+
+		// Still on its circle
+		INFO("Integrator " << integrator);
+		double position[2];
+		double velocity[2];
+		REQUIRE(psim_get_state(system, tracer, position, velocity));
+		REQUIRE(std::isfinite(position[0]));
+		REQUIRE(std::isfinite(position[1]));
+		CHECK(std::hypot(position[0], position[1]) == Approx(radius).epsilon(1e-3));
+		CHECK(std::hypot(velocity[0], velocity[1]) == Approx(speed).epsilon(1e-3));
+
+		psim_destroy(system);
+	}
+}
+
+TEST_CASE("The C interface builds the scenario of the app and the headless runner", "[simulationapi]")
+{
+	for (int randomLayout : { 0, 1 })
+	{
+		INFO("Random layout " << randomLayout);
+		ScenarioSettings settings;
+		settings.asteroids = 50;
+		settings.layout = randomLayout ? AsteroidLayout::Random : AsteroidLayout::Ring;
+		settings.seed = 7;
+		const ParticleSystem reference = makeJupiterScenario(settings);
+
+		psim_system* system = psim_create_jupiter_scenario(1, 50, randomLayout, 7);
+		REQUIRE(psim_get_particle_count(system) == 52);
+		const psim_buffers buffers = psim_get_buffers(system);
+		const ParticleStore& particles = reference.getStore();
+		for (size_t i = 0; i < buffers.count; i++)
+		{
+			REQUIRE(buffers.id[i] == particles.id[i]);
+			REQUIRE(buffers.x[i] == particles.x[i]);
+			REQUIRE(buffers.vy[i] == particles.vy[i]);
+		}
+		psim_destroy(system);
+	}
+}
+
+TEST_CASE("The app's asteroids start on an evenly spaced ring outside Jupiter's orbit", "[simulationapi]")
+{
+	ScenarioSettings settings;
+	settings.asteroids = 4;
+	ParticleSystem particleSystem = makeJupiterScenario(settings);
+	for (int i = 0; i < 4; i++)
+	{
+		const Eigen::Rotation2Dd rotation(i * 2 * M_PI / 4 + .1);
+		ParticleRef asteroid = particleSystem.findParticle(2 + i);
+		REQUIRE(asteroid);
+		CHECK((asteroid.getPosition() - rotation * Eigen::Vector2d(constants::jupiterOrbitRadius + 1e9, 0.0)).norm() == Approx(0.0).margin(1.0));
+		CHECK((asteroid.getVelocity() - rotation * Eigen::Vector2d(0.0, 13070.0)).norm() == Approx(0.0).margin(1e-6));
+	}
+}
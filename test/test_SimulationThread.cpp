@@ -0,0 +1,156 @@
+#include <catch2/catch.hpp>
+
+#include "SimulationThread.hpp"
+#include "SpscQueue.hpp"
+#include "TripleBuffer.hpp"
+#include "utils.hpp"
+
+#include <thread>
+
+namespace
+{
+ParticleSystem makeOrbit()
+{
+	ParticleSystem particleSystem;
+	particleSystem.addParticle(Particle(constants::solarRadius, constants::solarMass, Eigen::Vector2d::Zero(), Eigen::Vector2d::Zero()));
+	particleSystem.addParticle(Particle(constants::jupiterRadius, constants::jupiterMass, Eigen::Vector2d(constants::jupiterOrbitRadius, 0.0), Eigen::Vector2d(0.0, 13070.0)));
+	particleSystem.setThreadCount(1);
+	return particleSystem;
+}
+
+// Take snapshots until one passes the check, or give up after a few seconds
+template <typename Check>
+bool waitFor(SimulationThread& simulation, Check check)
+{
+	for (int i = 0; i < 5000; i++)
+	{
+		if (simulation.receive() && check(simulation.getSnapshot()))
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+}
+
+TEST_CASE("Triple buffer hands over whole values, newest first", "[simulationthread]")
+{
+	util::TripleBuffer<std::vector<int>> buffer;
+	REQUIRE(!buffer.update());
+
+	// Every value is a run of one number, so a torn read would mix two
+	const int count = 20000;
+	std::thread writer([&] {
+		for (int i = 1; i <= count; i++)
+		{
+			buffer.getBack().assign(64, i);
+			buffer.publish();
+		}
+	});
+
+	int last = 0;
+	while (last < count)
+	{
+		if (!buffer.update()) continue;
+		const std::vector<int>& value = buffer.getFront();
+		REQUIRE(value.size() == 64);
+		REQUIRE(std::count(value.begin(), value.end(), value[0]) == 64);
+		REQUIRE(value[0] > last);
+		last = value[0];
+	}
+	writer.join();
+	REQUIRE(!buffer.update());
+}
+
+TEST_CASE("Single producer queue delivers everything in order", "[simulationthread]")
+{
+	util::SpscQueue<int, 16> queue;
+	int item = 0;
+	REQUIRE(!queue.pop(item));
+
+	const int count = 100000;
+	std::thread producer([&] {
+		for (int i = 0; i < count; i++)
+		{
+			while (!queue.push(i))
+			{
+			}
+		}
+	});
+
+	for (int expected = 0; expected < count; expected++)
+	{
+		while (!queue.pop(item))
+		{
+		}
+		REQUIRE(item == expected);
+	}
+	producer.join();
+
+	// One slot always stays empty
+	for (int i = 0; i < 15; i++)
+	{
+		REQUIRE(queue.push(i));
+	}
+	REQUIRE(!queue.push(15));
+}
+
+TEST_CASE("Snapshots are interpolated by particle id", "[simulationthread]")
+{
+	ParticleSystem particleSystem = makeOrbit();
+	Snapshot previous;
+	particleSystem.writeSnapshot(previous);
+
+	// The Barnes-Hut tree may reorder the store, the snapshots are by id either way
+	particleSystem.calculateForcesBarnesHut();
+	particleSystem.update(1e6);
+	particleSystem.addParticle(Particle(1.0f, 1.0, Eigen::Vector2d(1e11, 0.0), Eigen::Vector2d::Zero()));
+	Snapshot latest;
+	particleSystem.writeSnapshot(latest);
+	REQUIRE(latest.time == 1e6);
+	REQUIRE(latest.size() == 3);
+
+	Snapshot displayed;
+	displayed.interpolate(previous, latest, 0.25);
+	REQUIRE(displayed.time == 0.25e6);
+	for (int id = 0; id < 2; id++)
+	{
+		const Eigen::Vector2d expected = previous.getPosition(id) + 0.25 * (latest.getPosition(id) - previous.getPosition(id));
+		REQUIRE((displayed.getPosition(id) - expected).norm() < 1e-6);
+	}
+
+	// Only in the latest snapshot, so drawn where it is
+	REQUIRE(displayed.alive[2]);
+	REQUIRE(displayed.getPosition(2) == Eigen::Vector2d(1e11, 0.0));
+
+	// Nothing is interpolated across a reset
+	latest.epoch++;
+	displayed.interpolate(previous, latest, 0.25);
+	REQUIRE(displayed.getPosition(1) == latest.getPosition(1));
+}
+
+TEST_CASE("Simulation thread runs and answers commands", "[simulationthread]")
+{
+	SimulationThread simulation(makeOrbit, 3600.0 * 24 * 365, 200.0);
+
+	// It runs on its own
+	REQUIRE(waitFor(simulation, [](const Snapshot& snapshot) { return snapshot.time > 1e6; }));
+	REQUIRE(simulation.getSnapshot().size() == 2);
+
+	REQUIRE(simulation.send({ SimulationCommandType::Select, { 1, 0 } }));
+	REQUIRE(waitFor(simulation, [](const Snapshot& snapshot) { return snapshot.selected == ParticleHandle { 1, 0 }; }));
+
+	// Paused, time only moves on by explicit steps
+	REQUIRE(simulation.send({ SimulationCommandType::TogglePause }));
+	REQUIRE(waitFor(simulation, [](const Snapshot& snapshot) { return snapshot.paused; }));
+	const double pausedTime = simulation.getSnapshot().time;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	REQUIRE(waitFor(simulation, [&](const Snapshot& snapshot) { return snapshot.time == pausedTime; }));
+	REQUIRE(simulation.send({ SimulationCommandType::Step, ParticleHandle(), 3600.0 }));
+	REQUIRE(waitFor(simulation, [&](const Snapshot& snapshot) { return snapshot.time == pausedTime + 3600.0; }));
+
+	// A reset starts a new epoch from the beginning, without the selection
+	REQUIRE(simulation.send({ SimulationCommandType::Reset }));
+	REQUIRE(waitFor(simulation, [](const Snapshot& snapshot) { return snapshot.epoch == 1; }));
+	REQUIRE(simulation.getSnapshot().time == 0.0);
+	REQUIRE(simulation.getSnapshot().selected.id == -1);
+}